@@ -18,9 +18,6 @@
 
 bool sorts_need_saving = false;
 
-#define swap(type, x, y) \
-   { type temp = x; x = y; y = temp;}
-
 /*
  * List of command-mode commands.  Take note of the following: XXX
  *    1. See 'match_cmd_name()' for the handling of abbreviations.
@@ -41,7 +38,8 @@ const cmd CommandPath[] = {
    {  "sort",     cmd_sort },
    {  "unbind",   cmd_unbind },
    {  "w",        cmd_write },
-   {  "toggle",   cmd_toggle }
+   {  "toggle",   cmd_toggle },
+   {  "watch",    cmd_watch }
 };
 const int CommandPathSize = (sizeof(CommandPath) / sizeof(cmd));
 
@@ -197,9 +195,14 @@ toggle_get(int registr)
  * Misc handy functions
  ***************************************************************************/
 
+/* view a playlist in the playlist window, reading it first if need be */
 void
 setup_viewing_playlist(playlist *p)
 {
+   if (medialib_playlist_resolve(p) == -1)
+      paint_error("failed to read playlist '%s': %s", p->name,
+         strerror(errno));
+
    viewing_playlist = p;
 
    ui.playlist->nrows   = p->nfiles;
@@ -297,9 +300,9 @@ cmd_write(int argc, char *argv[])
       }
 
       /* do the save... */
-      playlist_save(viewing_playlist);
+      playlist_save(viewing_playlist, mdb.index);
       viewing_playlist->needs_saving = false;
-      paint_library();
+      paint_damage(PAINT_LIBRARY);
       paint_message("\"%s\" %d songs written",
          viewing_playlist->filename, viewing_playlist->nfiles);
 
@@ -343,13 +346,13 @@ cmd_write(int argc, char *argv[])
        */
 
       /* do the save-as... */
-      playlist_save(dup);
+      playlist_save(dup, mdb.index);
       medialib_playlist_add(dup);
 
       dup->needs_saving = false;
       viewing_playlist->needs_saving = false;
 
-      paint_library();
+      paint_damage(PAINT_LIBRARY);
       paint_message("\"%s\" %d songs written",
          filename, viewing_playlist->nfiles);
    }
@@ -424,10 +427,10 @@ cmd_new(int argc, char *argv[])
    medialib_playlist_add(p);
    ui.library->nrows++;
    if (p->filename != NULL)
-      playlist_save(p);
+      playlist_save(p, mdb.index);
 
    /* redraw */
-   paint_library();
+   paint_damage(PAINT_LIBRARY);
    paint_message("playlist \"%s\" added", name);
 
    return 0;
@@ -462,16 +465,17 @@ cmd_filter(int argc, char *argv[])
    /* do actual filter */
    results = playlist_filter(viewing_playlist, match);
 
-   /* swap necessary bits of results with filter playlist */
-   swap(meta_info **, results->files,    mdb.filter_results->files);
-   swap(int, results->nfiles,   mdb.filter_results->nfiles);
-   swap(int, results->capacity, mdb.filter_results->capacity);
+   /* move the results into the filter playlist (keeping its refs) */
+   if (mdb.filter_results->nfiles > 0)
+      playlist_files_remove(mdb.filter_results, 0,
+         mdb.filter_results->nfiles, false);
+   playlist_files_append(mdb.filter_results, playlist_files(results),
+      results->nfiles, false);
    playlist_free(results);
 
    /* redraw */
    setup_viewing_playlist(mdb.filter_results);
-   paint_library();
-   paint_playlist();
+   paint_damage(PAINT_LIBRARY | PAINT_PLAYLIST);
 
    return 0;
 }
@@ -493,19 +497,18 @@ cmd_sort(int argc, char *argv[])
    }
 
    /* do the actual sort */
-   qsort(viewing_playlist->files, viewing_playlist->nfiles,
-      sizeof(meta_info*), mi_compare);
+   mi_sort(playlist_files(viewing_playlist), viewing_playlist->nfiles);
 
    if(!ui_is_init())
       return 0;
 
    /* redraw */
-   paint_playlist();
+   paint_damage(PAINT_PLAYLIST);
 
    /* if we sorted a playlist other than library, and user wants to save sorts */
    if (viewing_playlist != mdb.library && sorts_need_saving) {
       viewing_playlist->needs_saving = true;
-      paint_library();
+      paint_damage(PAINT_LIBRARY);
    }
 
    return 0;
@@ -530,7 +533,7 @@ cmd_display(int argc, char *argv[])
    /* reset display to default? */
    if (strcasecmp(argv[1], "reset") == 0) {
       mi_display_reset();
-      paint_playlist();
+      paint_damage(PAINT_PLAYLIST);
       return 0;
    }
 
@@ -542,7 +545,7 @@ cmd_display(int argc, char *argv[])
    }
 
    if(ui_is_init())
-      paint_playlist();
+      paint_damage(PAINT_PLAYLIST);
 
    return 0;
 }
@@ -727,7 +730,7 @@ cmd_reload(int argc, char *argv[])
 
       /* reload db */
       medialib_destroy();
-      medialib_load(db_file, playlist_dir);
+      medialib_load(db_file, playlist_dir, true);
 
       free(db_file);
       free(playlist_dir);
@@ -906,6 +909,61 @@ cmd_playlist(int argc, char *argv[])
    return 0;
 }
 
+/*
+ * watch directories for changes to apply to the library (see watcher.h),
+ * show those being watched, or stop watching them (with "watch!")
+ */
+int
+cmd_watch(int argc, char *argv[])
+{
+   char  **roots;
+   char   *list, *more;
+   int     i, n, total;
+
+   if (strchr(argv[0], '!') != NULL) {
+      if (argc != 1) {
+         paint_error("usage: watch[!] [directory ...]");
+         return 1;
+      }
+
+      watcher_stop();
+      paint_message("not watching any directories");
+      return 0;
+   }
+
+   if (argc == 1) {
+      if ((roots = watcher_roots()) == NULL) {
+         paint_message("not watching any directories");
+         return 0;
+      }
+
+      if ((list = strdup(roots[0])) == NULL)
+         err(1, "cmd_watch: strdup(3) failed");
+      for (i = 1; roots[i] != NULL; i++) {
+         if (asprintf(&more, "%s, %s", list, roots[i]) == -1)
+            errx(1, "cmd_watch: asprintf(3) failed");
+         free(list);
+         list = more;
+      }
+
+      paint_message("watching: %s", list);
+      free(list);
+      return 0;
+   }
+
+   total = 0;
+   for (i = 1; i < argc; i++) {
+      if ((n = watcher_add(argv[i])) == -1) {
+         paint_error("failed to watch '%s': %s", argv[i], strerror(errno));
+         return 2;
+      }
+      total += n;
+   }
+
+   paint_message("watching %d directories", total);
+   return 0;
+}
+
 void
 cmd_execute(char *cmd)
 {
@@ -913,6 +971,7 @@ cmd_execute(char *cmd)
    bool   found;
    char **argv;
    int    argc;
+   size_t len;
    int    found_idx = 0;
    int    num_matches;
    int    i;
@@ -929,6 +988,13 @@ cmd_execute(char *cmd)
          found = true;
          found_idx = i;
          num_matches++;
+
+         /* the whole name of one ("w", not short for "watch") always wins */
+         len = strcspn(argv[0], "!");
+         if (strlen(CommandPath[i].name) == len) {
+            num_matches = 1;
+            break;
+         }
       }
    }
 
@@ -959,7 +1025,8 @@ user_getstr(const char *prompt, char **response)
    char *input;
    int  pos, ch, ret;
 
-   /* display the prompt */
+   /* bring the screen up to date, then display the prompt */
+   paint_flush();
    werase(ui.command);
    mvwprintw(ui.command, 0, 0, "%s", prompt);
 
@@ -977,15 +1044,18 @@ user_getstr(const char *prompt, char **response)
    /* start getting input */
    ret = 0;
    pos = 0;
+   timeout(player_poll_timeout());
    while ((ch = getch()) && !VSIG_QUIT) {
 
       /*
-       * Handle any signals.  Note that the use of curs_set, wmvoe, and
-       * wrefresh here are all necessary to ensure that the cursor does
-       * not show anywhere outside of the command window.
+       * Handle any signals and keep the player going.  Note that the use of
+       * curs_set, wmvoe, and wrefresh here are all necessary to ensure that
+       * the cursor does not show anywhere outside of the command window.
        */
       curs_set(0);
       process_signals();
+      paint_flush();
+      timeout(player_poll_timeout());
       curs_set(1);
       wmove(ui.command, 0, strlen(prompt) + pos);
       wrefresh(ui.command);
@@ -1049,6 +1119,7 @@ user_getstr(const char *prompt, char **response)
    snprintf(*response, strlen(input) + 1, "%s", input);
 
 end:
+   timeout(-1);
    free(input);
    curs_set(0);
    return ret;
@@ -72,6 +72,16 @@
 #  endif
 #endif
 
+/* Linux has makedev(3) here */
+#if defined(__linux)
+#  include <sys/sysmacros.h>
+#endif
+
+/* Linux can tell us when files change (see watcher.c) */
+#if defined(__linux)
+#  define COMPAT_HAVE_INOTIFY
+#endif
+
 
 /* Now add necessary prototypes... */
 
@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "dirtab.h"
+
+/* stat(2)'s queued per thread by dirtab_check() */
+#define DIRTAB_JOBS_PER_THREAD  32
+
+/* a directory to check, and when the check started */
+typedef struct {
+   dirtab_entry  *e;
+   time_t         now;
+} dirtab_job;
+
+/* compare paths so that everything below a directory sorts right after it */
+static int
+dirtab_pathcmp(const char *a, const char *b)
+{
+   unsigned char ca, cb;
+
+   for (;; a++, b++) {
+      ca = (*a == '/') ? 1 : (unsigned char) *a;
+      cb = (*b == '/') ? 1 : (unsigned char) *b;
+      if (ca != cb || ca == '\0')
+         return ca - cb;
+   }
+}
+
+static int
+dirtab_entrycmp(const void *a, const void *b)
+{
+   return dirtab_pathcmp(((const dirtab_entry *) a)->path,
+                         ((const dirtab_entry *) b)->path);
+}
+
+/* find a directory among the sorted entries */
+static dirtab_entry *
+dirtab_find(const dirtab *t, const char *path)
+{
+   dirtab_entry key;
+
+   key.path = (char *) path;
+   return bsearch(&key, t->entries, t->nsorted, sizeof(dirtab_entry),
+      dirtab_entrycmp);
+}
+
+static dirtab_entry *
+dirtab_append(dirtab *t, const char *path)
+{
+   dirtab_entry *e;
+
+   if (t->nentries == t->capacity) {
+      t->capacity = (t->capacity == 0) ? 256 : t->capacity * 2;
+      e = realloc(t->entries, t->capacity * sizeof(dirtab_entry));
+      if (e == NULL)
+         err(1, "%s: realloc(3) failed", __FUNCTION__);
+      t->entries = e;
+   }
+
+   e = &t->entries[t->nentries++];
+   memset(e, 0, sizeof(dirtab_entry));
+   if ((e->path = strdup(path)) == NULL)
+      err(1, "%s: strdup(3) failed", __FUNCTION__);
+
+   return e;
+}
+
+uint64_t
+dirtab_hash(const char *name)
+{
+   uint64_t h = 14695981039346656037ULL;   /* 64-bit FNV-1a */
+
+   while (*name != '\0') {
+      h ^= (unsigned char) *name++;
+      h *= 1099511628211ULL;
+   }
+
+   return h;
+}
+
+dirtab *
+dirtab_load(const char *filename, uint64_t db_stamp)
+{
+   dirtab_header   hdr;
+   dirtab_record   rec;
+   dirtab_entry   *e;
+   struct stat     sb;
+   dirtab         *t;
+   FILE           *fin;
+   char           *data;
+   size_t          len, off;
+   uint32_t        i;
+   bool            ok;
+
+   if ((t = calloc(1, sizeof(dirtab))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+   t->db_stamp = db_stamp;
+
+   if (db_stamp == 0 || (fin = fopen(filename, "r")) == NULL)
+      return t;
+
+   /* read all of it, to check the checksum */
+   data = NULL;
+   ok = (fstat(fileno(fin), &sb) == 0
+      && (data = malloc(sb.st_size + 1)) != NULL
+      && fread(data, 1, sb.st_size, fin) == (size_t) sb.st_size
+      && savefile_verify(data, sb.st_size, &len));
+   fclose(fin);
+
+   off = sizeof(DIRTAB_MAGIC);
+   memset(&hdr, 0, sizeof(hdr));
+   if (ok && len >= off + sizeof(hdr)
+   &&  memcmp(data, DIRTAB_MAGIC, sizeof(DIRTAB_MAGIC)) == 0) {
+      memcpy(&hdr, data + off, sizeof(hdr));
+      off += hdr.header_size;
+   } else
+      ok = false;
+
+   if (ok && (hdr.header_size < sizeof(hdr)
+   ||  hdr.record_size < sizeof(rec) || hdr.db_stamp != db_stamp))
+      ok = false;
+
+   for (i = 0; ok && i < hdr.nentries; i++) {
+      if (off + hdr.record_size > len) {
+         ok = false;
+         break;
+      }
+      memcpy(&rec, data + off, sizeof(rec));
+      off += hdr.record_size;
+
+      if (rec.path_size == 0 || off + rec.path_size > len
+      ||  data[off + rec.path_size - 1] != '\0') {
+         ok = false;
+         break;
+      }
+
+      e = dirtab_append(t, data + off);
+      e->mtime   = rec.mtime;
+      e->scanned = rec.scanned;
+      e->hash    = rec.hash;
+      e->nnames  = rec.nnames;
+      off += rec.path_size;
+   }
+   free(data);
+
+   if (!ok) {
+      warnx("ignoring damaged directory table '%s'", filename);
+      for (i = 0; i < (uint32_t) t->nentries; i++)
+         free(t->entries[i].path);
+      t->nentries = 0;
+   }
+
+   qsort(t->entries, t->nentries, sizeof(dirtab_entry), dirtab_entrycmp);
+   t->nsorted = t->nentries;
+   return t;
+}
+
+int
+dirtab_save(dirtab *t, const char *filename)
+{
+   dirtab_header   hdr;
+   dirtab_record   rec;
+   dirtab_entry   *e, *prev;
+   savefile       *fout;
+   int             i;
+
+   qsort(t->entries, t->nentries, sizeof(dirtab_entry), dirtab_entrycmp);
+   t->nsorted = t->nentries;
+
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.header_size = sizeof(hdr);
+   hdr.record_size = sizeof(rec);
+   hdr.db_stamp    = t->db_stamp;
+   for (i = 0, prev = NULL; i < t->nentries; i++) {
+      e = &t->entries[i];
+      if (e->state != DIRTAB_GONE
+      &&  (prev == NULL || strcmp(prev->path, e->path) != 0)) {
+         hdr.nentries++;
+         prev = e;
+      }
+   }
+
+   if ((fout = savefile_open(filename)) == NULL)
+      return -1;
+
+   savefile_write(fout, DIRTAB_MAGIC, sizeof(DIRTAB_MAGIC));
+   savefile_write(fout, &hdr, sizeof(hdr));
+   for (i = 0, prev = NULL; i < t->nentries; i++) {
+      e = &t->entries[i];
+      if (e->state == DIRTAB_GONE
+      ||  (prev != NULL && strcmp(prev->path, e->path) == 0))
+         continue;
+      prev = e;
+
+      memset(&rec, 0, sizeof(rec));
+      rec.mtime     = e->mtime;
+      rec.scanned   = e->scanned;
+      rec.hash      = e->hash;
+      rec.nnames    = e->nnames;
+      rec.path_size = strlen(e->path) + 1;
+      savefile_write(fout, &rec, sizeof(rec));
+      savefile_write(fout, e->path, rec.path_size);
+   }
+
+   return savefile_close(fout, true);
+}
+
+void
+dirtab_free(dirtab *t)
+{
+   int i;
+
+   for (i = 0; i < t->nentries; i++)
+      free(t->entries[i].path);
+   free(t->entries);
+   free(t);
+}
+
+/* run on the worker threads: compare a directory with its signature */
+static void
+dirtab_check_job(void *arg)
+{
+   dirtab_job     *job = arg;
+   dirtab_entry   *e = job->e;
+   struct dirent  *de;
+   struct stat     sb;
+   uint64_t        hash;
+   uint32_t        nnames;
+   DIR            *dir;
+
+   if (stat(e->path, &sb) == -1) {
+      e->state = (errno == ENOENT || errno == ENOTDIR)
+               ? DIRTAB_GONE : DIRTAB_CHANGED;
+      return;
+   }
+
+   if (!S_ISDIR(sb.st_mode)) {
+      e->state = DIRTAB_GONE;
+      return;
+   }
+
+   if (sb.st_mtime != e->mtime) {
+      e->state = DIRTAB_CHANGED;
+      return;
+   }
+
+   /* modified in the second it was read in: compare the names */
+   if (e->mtime >= e->scanned) {
+      if ((dir = opendir(e->path)) == NULL) {
+         e->state = DIRTAB_CHANGED;
+         return;
+      }
+
+      hash = 0;
+      nnames = 0;
+      while ((de = readdir(dir)) != NULL) {
+         if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+         hash += dirtab_hash(de->d_name);
+         nnames++;
+      }
+      closedir(dir);
+
+      if (hash != e->hash || nnames != e->nnames) {
+         e->state = DIRTAB_CHANGED;
+         return;
+      }
+      e->scanned = job->now;
+   }
+
+   e->state = DIRTAB_CLEAN;
+}
+
+/* is path at or below one of the roots? */
+static bool
+dirtab_below(const char *path, char *roots[], int nroots)
+{
+   size_t len;
+   int    i;
+
+   for (i = 0; i < nroots; i++) {
+      len = strlen(roots[i]);
+      if (len > 0 && roots[i][len - 1] == '/')
+         len--;
+      if (strncmp(path, roots[i], len) == 0
+      &&  (path[len] == '\0' || path[len] == '/'))
+         return true;
+   }
+
+   return false;
+}
+
+void
+dirtab_check(dirtab *t, char *roots[], int nroots, int nthreads)
+{
+   dirtab_entry  *e, *parent;
+   dirtab_job    *jobs;
+   workq         *q;
+   char           path[PATH_MAX], *slash;
+   int            i, njobs;
+
+   t->now = time(NULL);
+   if (t->nsorted == 0)
+      return;
+
+   if ((jobs = calloc(t->nsorted, sizeof(dirtab_job))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   /* the results are written to the entries, so the order doesn't matter */
+   q = workq_new(nthreads, nthreads * DIRTAB_JOBS_PER_THREAD,
+      dirtab_check_job);
+   for (i = 0, njobs = 0; i < t->nsorted; i++) {
+      e = &t->entries[i];
+      if (!dirtab_below(e->path, roots, nroots))
+         continue;
+      jobs[njobs].e = e;
+      jobs[njobs].now = t->now;
+      workq_submit(q, &jobs[njobs++]);
+   }
+   while (workq_next(q) != NULL)
+      continue;
+   workq_free(q);
+   free(jobs);
+
+   /* mark everything above a directory that changed */
+   for (i = 0; i < t->nsorted; i++) {
+      e = &t->entries[i];
+      if (e->state != DIRTAB_CHANGED && e->state != DIRTAB_GONE)
+         continue;
+
+      strlcpy(path, e->path, sizeof(path));
+      while ((slash = strrchr(path, '/')) != NULL && slash != path) {
+         *slash = '\0';
+         if ((parent = dirtab_find(t, path)) == NULL)
+            continue;
+         if (parent->changed_below)
+            break;
+         parent->changed_below = true;
+      }
+   }
+}
+
+bool
+dirtab_unchanged(const dirtab *t, const char *path)
+{
+   dirtab_entry *e;
+
+   e = dirtab_find(t, path);
+   return (e != NULL && e->state == DIRTAB_CLEAN && !e->changed_below);
+}
+
+void
+dirtab_put(dirtab *t, const char *path, time_t mtime, uint32_t nnames,
+   uint64_t hash)
+{
+   dirtab_entry *e;
+
+   if ((e = dirtab_find(t, path)) == NULL)
+      e = dirtab_append(t, path);
+
+   e->mtime   = mtime;
+   e->scanned = t->now;
+   e->hash    = hash;
+   e->nnames  = nnames;
+   e->state   = DIRTAB_CLEAN;
+}
+
+void
+dirtab_forget(dirtab *t, const char *path)
+{
+   dirtab_entry *e;
+
+   if ((e = dirtab_find(t, path)) != NULL)
+      e->state = DIRTAB_GONE;
+}
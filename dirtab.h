@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef DIRTAB_H
+#define DIRTAB_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "savefile.h"
+#include "workq.h"
+
+#include "compat.h"
+
+/*
+ * The directory table, "<db_file>.dirs", remembers each directory that
+ * "-e add" walked, so the next one can skip those that haven't changed
+ * (see medialib_db_scan_dirs()).  Each directory has a signature: its
+ * modification time, and the number and a hash of the names in it.  Adding,
+ * removing, or renaming anything in a directory changes its mtime, so one
+ * with the same mtime holds the same files as last time, all of which were
+ * seen then.  A directory is only recorded once everything below it was
+ * walked without errors, so a subtree of unchanged directories need not be
+ * walked at all.  Files changed in place don't change their directory, and
+ * are left to "-e update".
+ *
+ * An mtime only has one second resolution, so a directory modified no
+ * earlier than the second it was read in could have changed since without
+ * its mtime showing it.  Those are read again, and compared by the number
+ * and hash of their names.
+ *
+ * On disk, as a savefile with a trailer:
+ *
+ *    DIRTAB_MAGIC
+ *    dirtab_header
+ *    entries, each:  dirtab_record, char path[path_size]
+ */
+#define DIRTAB_MAGIC  "vitunes-dirs1"
+
+typedef struct {
+   uint32_t header_size;   /* sizeof(dirtab_header) when written */
+   uint32_t record_size;   /* sizeof(dirtab_record) when written */
+   uint32_t nentries;
+   uint32_t reserved;
+   uint64_t db_stamp;      /* the database the table belongs to */
+} dirtab_header;
+
+typedef struct {
+   int64_t  mtime;         /* of the directory when it was read */
+   int64_t  scanned;       /* time it was read at (or before) */
+   uint64_t hash;          /* dirtab_hash() of the names in it */
+   uint32_t nnames;        /* number of names in it (less "." and "..") */
+   uint32_t path_size;     /* bytes of path that follow, NUL included */
+} dirtab_record;
+
+typedef struct {
+   char     *path;         /* realpath(3) of the directory walked from */
+   time_t    mtime;
+   time_t    scanned;
+   uint64_t  hash;
+   uint32_t  nnames;
+#define DIRTAB_UNCHECKED  0
+#define DIRTAB_CLEAN      1
+#define DIRTAB_CHANGED    2
+#define DIRTAB_GONE       3
+   int       state;        /* set by dirtab_check() */
+   bool      changed_below;   /* a directory below it changed or is gone */
+} dirtab_entry;
+
+typedef struct {
+   dirtab_entry *entries;  /* the first nsorted are sorted by path */
+   int           nentries;
+   int           nsorted;
+   int           capacity;
+   uint64_t      db_stamp;
+   time_t        now;      /* when dirtab_check() started */
+} dirtab;
+
+/*
+ * load the table for a database, which is empty if the file doesn't exist,
+ * is damaged, or belongs to another database.  save returns -1 (and errno)
+ * if it can't be written.
+ */
+dirtab *dirtab_load(const char *filename, uint64_t db_stamp);
+int dirtab_save(dirtab *t, const char *filename);
+void dirtab_free(dirtab *t);
+
+/*
+ * check the signature of every loaded directory at or below one of the given
+ * paths (realpath(3)'d), using nthreads threads to stat(2) them.
+ */
+void dirtab_check(dirtab *t, char *roots[], int nroots, int nthreads);
+
+/* was a directory checked and found unchanged, along with all below it? */
+bool dirtab_unchanged(const dirtab *t, const char *path);
+
+/*
+ * record the signature of a directory just read, replacing any it had, or
+ * forget a directory that couldn't be.  names are hashed with dirtab_hash(),
+ * summing them so that the order they're read in doesn't matter.
+ */
+void dirtab_put(dirtab *t, const char *path, time_t mtime, uint32_t nnames,
+   uint64_t hash);
+void dirtab_forget(dirtab *t, const char *path);
+uint64_t dirtab_hash(const char *name);
+
+#endif
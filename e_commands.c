@@ -25,6 +25,7 @@ const struct ecmd ECMD_PATH[] = {
    { "rm",        ecmd_rmfile,   ecmd_help_rmfile },
    { "update",    ecmd_update,   ecmd_help_update },
    { "flush",     ecmd_flush,    ecmd_help_flush },
+   { "compact",   ecmd_compact,  ecmd_help_compact },
    { "tag",       ecmd_tag,      ecmd_help_tag },
    { "help",      ecmd_help,     NULL }
 };
@@ -43,22 +44,65 @@ ecmd_init(int argc, char *argv[])
    return 0;
 }
 
+/* parse the argument to a -j option (number of worker threads) */
+static int
+ecmd_parse_jobs(const char *cmd, const char *arg)
+{
+   const char *errstr;
+   int         n;
+
+   n = strtonum(arg, 1, ECMD_MAX_JOBS, &errstr);
+   if (errstr != NULL)
+      errx(1, "%s: -j %s: number of jobs is %s", cmd, arg, errstr);
+
+   return n;
+}
+
 int
 ecmd_update(int argc, char *argv[])
 {
    bool show_skipped = false;
+   bool properties = false;
+   int  nthreads = 1;
+   int  ch;
 
-   if (argc == 2 && strcmp(argv[1], "-s") == 0)
-      show_skipped = true;
+   static struct option longopts[] = {
+      { "properties", no_argument, NULL, 'p' },
+      { NULL,         0,           NULL,  0  }
+   };
 
-   if (argc != 1 && !show_skipped)
-      errx(1, "usage: -e %s [-s]", argv[0]);
+   optreset = 1;
+   optind = 0;
+   while ((ch = getopt_long(argc, argv, "j:ps", longopts, NULL)) != -1) {
+      switch (ch) {
+         case 'j':
+            nthreads = ecmd_parse_jobs(argv[0], optarg);
+            break;
+         case 'p':
+            properties = true;
+            break;
+         case 's':
+            show_skipped = true;
+            break;
+         case '?':
+         default:
+            errx(1, "usage: -e %s [-ps] [-j jobs]", argv[0]);
+      }
+   }
+
+   if (optind != argc)
+      errx(1, "usage: -e %s [-ps] [-j jobs]", argv[0]);
 
    printf("Loading existing database...\n");
-   medialib_load(db_file, playlist_dir);
+   medialib_load(db_file, playlist_dir, false);
 
-   printf("Updating existing database...\n");
-   medialib_db_update(show_skipped);
+   if (properties) {
+      printf("Finding play-lengths missing from the database...\n");
+      medialib_db_properties(nthreads, mplayer_length);
+   } else {
+      printf("Updating existing database...\n");
+      medialib_db_update(show_skipped, nthreads);
+   }
 
    medialib_destroy();
    return 0;
@@ -67,14 +111,41 @@ ecmd_update(int argc, char *argv[])
 int
 ecmd_add(int argc, char *argv[])
 {
-   if (argc == 1)
-      errx(1, "usage: -e %s /path/to/filesORdirs [ ... ] ", argv[0]);
+   bool full = false;
+   int  nthreads = 1;
+   int  ch;
+
+   static struct option longopts[] = {
+      { "full", no_argument, NULL, 'f' },
+      { NULL,   0,           NULL,  0  }
+   };
+
+   optreset = 1;
+   optind = 0;
+   while ((ch = getopt_long(argc, argv, "fj:", longopts, NULL)) != -1) {
+      switch (ch) {
+         case 'f':
+            full = true;
+            break;
+         case 'j':
+            nthreads = ecmd_parse_jobs(argv[0], optarg);
+            break;
+         case '?':
+         default:
+            errx(1, "usage: -e %s [-f] [-j jobs] /path/to/filesORdirs [ ... ]",
+               argv[0]);
+      }
+   }
+
+   if (optind == argc)
+      errx(1, "usage: -e %s [-f] [-j jobs] /path/to/filesORdirs [ ... ]",
+         argv[0]);
 
    printf("Loading existing database...\n");
-   medialib_load(db_file, playlist_dir);
+   medialib_load(db_file, playlist_dir, false);
 
    printf("Scanning directories for files to add to database...\n");
-   medialib_db_scan_dirs(argv + 1);
+   medialib_db_scan_dirs(argv + optind, nthreads, full);
 
    medialib_destroy();
    return 0;
@@ -84,10 +155,8 @@ int
 ecmd_addurl(int argc, char *argv[])
 {
    meta_info   *m;
-   bool         found;
-   int          found_idx;
    char         input[255];
-   int          field, i;
+   int          field;
 
    if (argc != 2)
       errx(1, "usage: -e %s filename|URL", argv[0]);
@@ -111,24 +180,14 @@ ecmd_addurl(int argc, char *argv[])
       if (input[strlen(input) - 1] == '\n')
          input[strlen(input) - 1] = '\0';
 
-      if ((m->cinfo[field] = strdup(input)) == NULL)
-         err(1, "%s: strdup failed (field)", argv[0]);
+      mi_cinfo_set(m, field, input);
    }
 
    /* load existing database and see if file/URL already exists */
-   medialib_load(db_file, playlist_dir);
+   medialib_load(db_file, playlist_dir, false);
 
    /* does the URL already exist in the database? */
-   found = false;
-   found_idx = -1;
-   for (i = 0; i < mdb.library->nfiles && !found; i++) {
-      if (strcmp(m->filename, mdb.library->files[i]->filename) == 0) {
-         found = true;
-         found_idx = i;
-      }
-   }
-
-   if (found) {
+   if (libindex_get(mdb.index, m->filename, NULL) != NULL) {
       printf("Warning: file/URL '%s' already in the database.\n", argv[0]);
       printf("Do you want to replace the existing record? [y/n] ");
 
@@ -141,10 +200,10 @@ ecmd_addurl(int argc, char *argv[])
       }
 
       mi_sanitize(m);
-      playlist_file_replace(mdb.library, found_idx, m);
+      medialib_db_replace(playlist_find(mdb.library, m->filename), m);
    } else {
       mi_sanitize(m);
-      playlist_files_append(mdb.library, &m, 1, false);
+      medialib_db_add(m);
    }
 
    medialib_db_save(db_file);
@@ -158,7 +217,6 @@ ecmd_check(int argc, char *argv[])
 {
    meta_info *mi;
    bool   show_raw, show_sanitized, show_database;
-   bool   found;
    char   ch;
    char   realfile[PATH_MAX];
    char **files;
@@ -215,7 +273,8 @@ ecmd_check(int argc, char *argv[])
             if (show_raw) {
                printf("\tThe RAW meta-information from the file is:\n");
                for (i = 0; i < MI_NUM_CINFO; i++)
-                  printf("\t%10.10s: '%s'\n", MI_CINFO_NAMES[i], mi->cinfo[i]);
+                  printf("\t%10.10s: '%s'\n", MI_CINFO_NAMES[i],
+                     mi_cinfo(mi, i));
             }
 
             /* show sanitized info */
@@ -223,7 +282,8 @@ ecmd_check(int argc, char *argv[])
                mi_sanitize(mi);
                printf("\tThe SANITIZED meta-information from the file is:\n");
                for (i = 0; i < MI_NUM_CINFO; i++)
-                  printf("\t%10.10s: '%s'\n", MI_CINFO_NAMES[i], mi->cinfo[i]);
+                  printf("\t%10.10s: '%s'\n", MI_CINFO_NAMES[i],
+                     mi_cinfo(mi, i));
             }
          }
       }
@@ -238,23 +298,16 @@ ecmd_check(int argc, char *argv[])
          }
 
          /* check if file is in database */
-         medialib_load(db_file, playlist_dir);
-
-         found = false;
-         mi = NULL;
-         for (i = 0; i < mdb.library->nfiles && !found; i++) {
-            if (strcmp(realfile, mdb.library->files[i]->filename) == 0) {
-               found = true;
-               mi = mdb.library->files[i];
-            }
-         }
+         medialib_load(db_file, playlist_dir, false);
+
+         mi = libindex_get(mdb.index, realfile, NULL);
 
-         if (!found)
+         if (mi == NULL)
             warnx("File '%s' does NOT exist in the database", files[f]);
          else {
             printf("\tThe meta-information in the DATABASE is:\n");
             for (i = 0; i < MI_NUM_CINFO; i++)
-               printf("\t%10.10s: '%s'\n", MI_CINFO_NAMES[i], mi->cinfo[i]);
+               printf("\t%10.10s: '%s'\n", MI_CINFO_NAMES[i], mi_cinfo(mi, i));
          }
 
          medialib_destroy();
@@ -271,7 +324,6 @@ ecmd_rmfile(int argc, char *argv[])
    char *filename;
    char  input[255];
    bool  forced;
-   bool  found;
    int   found_idx;
    int   i;
 
@@ -292,18 +344,11 @@ ecmd_rmfile(int argc, char *argv[])
 
 
    /* load database and search for record */
-   medialib_load(db_file, playlist_dir);
-   found = false;
-   found_idx = -1;
-   for (i = 0; i < mdb.library->nfiles && !found; i++) {
-      if (strcmp(filename, mdb.library->files[i]->filename) == 0) {
-         found = true;
-         found_idx = i;
-      }
-   }
+   medialib_load(db_file, playlist_dir, false);
+   found_idx = playlist_find(mdb.library, filename);
 
    /* if not found then error */
-   if (!found) {
+   if (found_idx == -1) {
       i = (forced ? 0 : 1);
       errx(i, "%s: %s: No such file or URL", argv[0], filename);
    }
@@ -316,7 +361,7 @@ ecmd_rmfile(int argc, char *argv[])
          errx(1, "%s: operation canceled.  Database unchanged.", argv[0]);
    }
 
-   playlist_files_remove(mdb.library, found_idx, 1, false);
+   medialib_db_remove(found_idx);
    medialib_db_save(db_file);
    medialib_destroy();
    return 0;
@@ -343,12 +388,24 @@ ecmd_flush(int argc, char *argv[])
       }
    }
    
-   medialib_load(db_file, playlist_dir);
+   medialib_load(db_file, playlist_dir, false);
    medialib_db_flush(stdout, time_format);
    medialib_destroy();
    return 0;
 }
 
+int
+ecmd_compact(int argc, char *argv[])
+{
+   if (argc != 1)
+      errx(1, "usage: -e %s", argv[0]);
+
+   medialib_load(db_file, playlist_dir, false);
+   medialib_db_compact(db_file);
+   medialib_destroy();
+   return 0;
+}
+
 int
 ecmd_tag(int argc, char *argv[])
 {
@@ -512,7 +569,7 @@ ecmd_help_add(void)
 {
    printf("\
 VITUNES COMMAND:\n\tadd - add files to the vitunes database\n\n\
-SYNOPSIS:\n\tadd /path/to/files1 [ path2 ... ]\n\n\
+SYNOPSIS:\n\tadd [-f] [-j jobs] /path/to/files1 [ path2 ... ]\n\n\
 DESCRIPTION:\n\
    The add command is used to add files to the database used by vitunes.\n\
    For every file/directory provided as a parameter, vitunes will scan that\n\
@@ -520,6 +577,17 @@ DESCRIPTION:\n\
    any meta information.  Any such files found are added to the database\n\
    used by vitunes.  If any of the files found are already in the database\n\
    then they will be re-scanned and any changes will be updated.\n\n\
+   The directories scanned are remembered (in the database file with\n\
+   \".dirs\" appended), and those that have had no files added, removed, or\n\
+   renamed in them since are skipped the next time, along with the\n\
+   directories below them.  Files modified in place are found by the update\n\
+   command instead.\n\n\
+   A file that was moved or renamed (on the same file system) since it was\n\
+   added is recognized by its device, inode, size, and modification time.\n\
+   Its meta information is kept rather than extracted again, under its new\n\
+   name, and the playlists holding it are rewritten with that name.  Such\n\
+   files are reported with 'm'.  After moving files, run add on their new\n\
+   location before update, which would remove them as gone.\n\n\
    Note that vitunes only maintains information about the file, and not the\n\
    file itself.  It does NOT move/copy/modify the files in its database in\n\
    any way.\n\n\
@@ -532,8 +600,15 @@ DESCRIPTION:\n\
    and serves as the key-field within the database.\n\n\
    If any file encountered has no meta information, it is NOT added to the\n\
    database.\n\n\
+      -f, --full\n\
+               Scan every directory, even those unchanged since last time.\n\n\
+      -j jobs  Extract meta information from up to this many files at once\n\
+               (using this many threads).  The default is 1.  Results are\n\
+               still reported and added in the order the files are found.\n\n\
 EXAMPLE:\n\
-   $ vitunes -e add ~/music /usr/local/share/music\n\n\
+   $ vitunes -e add ~/music /usr/local/share/music\n\
+   $ vitunes -e add -j 4 ~/music\n\
+   $ vitunes -e add --full ~/music\n\n\
 ");
 }
 
@@ -644,7 +719,7 @@ ecmd_help_update(void)
 {
    printf("\
 VITUNES COMMAND:\n\tupdate - update vitunes database\n\n\
-SYNOPSIS:\n\tupdate [-s]\n\n\
+SYNOPSIS:\n\tupdate [-ps] [-j jobs]\n\n\
 DESCRIPTION:\n\
    The update command loads the existing meta information database used\n\
    by vitunes and for each media file listed in the database, the file is\n\
@@ -652,20 +727,29 @@ DESCRIPTION:\n\
    to the database.\n\n\
    If the file has been removed, it will be removed from the database.  If\n\
    the file has been modified, it's meta information will be extracted\n\
-   again and the database will be updated.\n\
+   again and the database will be updated.  Files that were moved are\n\
+   found by the add command instead, if it's run first (see 'help add').\n\
    Note that if there are errors while checking the file, the error will be\n\
    reported but the file, and its meta information, will remain in the\n\
    vitunes database.\n\n\
       -s       When present, files that are skipped because they have not\n\
                been modified will also be reported to stdout.  Normally,\n\
                only files that are updated are reported.\n\n\
+      -p       (or --properties) Instead of the above, find the play-length\n\
+               of each file in the database that has none, which TagLib\n\
+               couldn't find when the file was added, by running mplayer\n\
+               on it with -identify.  These are shown as --:-- until then.\n\n\
+      -j jobs  Check and extract meta information from (or with -p, find\n\
+               the play-length of) up to this many files at once (using\n\
+               this many threads).  The default is 1.\n\n\
    In short, anytime you remove/modify media files already in the vitunes\n\
    database, you should run this command.\n\n\
 NOTE ABOUT URLS:\n\
    Note that files added to the database using the 'addurl' e-command will\n\
    NOT be checked/updated in any way, for obvious reasons.\n\n\
 EXAMPLE:\n\
-      $ vitunes -e update\n\n\
+      $ vitunes -e update\n\
+      $ vitunes -e update -p -j 4\n\n\
 ");
 }
 
@@ -698,6 +782,25 @@ REFERENCES:\n\
 ");
 }
 
+void
+ecmd_help_compact(void)
+{
+   printf("\
+VITUNES COMMAND:\n\tcompact - rewrite the database, emptying its journal\n\n\
+SYNOPSIS:\n\tcompact\n\n\
+DESCRIPTION:\n\
+   Changes made by the add, addurl, rm and update commands are appended to\n\
+   a journal next to the database, rather than rewriting the whole database\n\
+   each time.  The journal is read whenever the database is loaded, and is\n\
+   folded back into the database automatically once it grows past about a\n\
+   quarter of the database's size.\n\n\
+   The compact command does this immediately: the database is rewritten with\n\
+   all changes from the journal, and the journal is removed.\n\n\
+EXAMPLE:\n\
+   $ vitunes -e compact\n\n\
+");
+}
+
 void
 ecmd_help_tag(void)
 {
@@ -789,6 +892,7 @@ The list of available commands are:\n\n\
    tag         Add/modify meta-information tags of raw files.\n\n\
    flush       Load the existing database and dump it's information in an\n\
                easy-to-parse format to stdout.\n\n\
+   compact     Fold the database journal back into the database.\n\n\
    help        This command.\n\n\
 ");
       return 0;
@@ -27,9 +27,13 @@
 #include "meta_info.h"
 #include "medialib.h"
 #include "playlist.h"
+#include "players/mplayer.h"
 
 #include "compat.h"
 
+/* maximum number of worker threads for -j */
+#define ECMD_MAX_JOBS   256
+
 /* from vitunes.c */
 extern char *vitunes_dir;
 extern char *playlist_dir;
@@ -40,6 +44,7 @@ int ecmd_init(int argc, char *argv[]);
 int ecmd_add(int argc, char *argv[]);
 int ecmd_addurl(int argc, char *argv[]);
 int ecmd_flush(int argc, char *argv[]);
+int ecmd_compact(int argc, char *argv[]);
 int ecmd_check(int argc, char *argv[]);
 int ecmd_rmfile(int argc, char *argv[]);
 int ecmd_tag(int argc, char *argv[]);
@@ -54,6 +59,7 @@ void ecmd_help_check(void);
 void ecmd_help_rmfile(void);
 void ecmd_help_update(void);
 void ecmd_help_flush(void);
+void ecmd_help_compact(void);
 void ecmd_help_tag(void);
 
 /* e-command struct and set of commands */
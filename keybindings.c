@@ -509,7 +509,7 @@ kba_scroll_row(KbaArgs a)
 
    /* redraw */
    redraw_active();
-   paint_status_bar();
+   paint_damage(PAINT_STATUS);
 }
 
 void
@@ -598,7 +598,7 @@ kba_scroll_page(KbaArgs a)
    }
 
    redraw_active();
-   paint_status_bar();
+   paint_damage(PAINT_STATUS);
 }
 
 void
@@ -656,7 +656,7 @@ kba_scroll_col(KbaArgs a)
 
    /* redraw */
    redraw_active();
-   paint_status_bar();
+   paint_damage(PAINT_STATUS);
 }
 
 void
@@ -705,7 +705,7 @@ kba_jumpto_screen(KbaArgs a)
 
    /* redraw */
    redraw_active();
-   paint_status_bar();
+   paint_damage(PAINT_STATUS);
 }
 
 void
@@ -785,7 +785,7 @@ kba_jumpto_file(KbaArgs a)
    redraw_active();
 
    if (a.num != -1)   /* XXX a damn dirty hack for now. see search_find */
-      paint_status_bar();
+      paint_damage(PAINT_STATUS);
 }
 
 void
@@ -882,6 +882,9 @@ kba_search_find(KbaArgs a)
          errx(1, "search_find: invalid direction");
    }
 
+   if (ui.active != ui.library)
+      playlist_match_prepare(viewing_playlist);
+
    /* start looking from current row */
    start_idx = ui.active->voffset + ui.active->crow;
    msg = NULL;
@@ -907,7 +910,8 @@ kba_search_find(KbaArgs a)
       if (ui.active == ui.library)
          matches = str_match_query(mdb.playlists[idx]->name);
       else
-         matches = mi_match(viewing_playlist->files[idx]);
+         matches = playlist_match(viewing_playlist,
+            playlist_file(viewing_playlist, idx));
 
       /* found one, jump to it */
       if (matches) {
@@ -940,7 +944,7 @@ kba_visual(KbaArgs a UNUSED)
    else
       visual_mode_start = -1;
 
-   paint_playlist();
+   paint_damage(PAINT_PLAYLIST);
 }
 
 /*
@@ -951,6 +955,7 @@ kba_visual(KbaArgs a UNUSED)
 void
 kba_cut(KbaArgs a UNUSED)
 {
+   playlist_slice *s;
    playlist *p;
    char *warning;
    bool  got_target;
@@ -1050,14 +1055,14 @@ kba_cut(KbaArgs a UNUSED)
          ui.playlist->crow = 0;
          ui.playlist->voffset = 0;
          ui.playlist->hoffset = 0;
-         paint_playlist();
+         paint_damage(PAINT_PLAYLIST);
       }
       ui.library->nrows--;
       if (ui.library->voffset + ui.library->crow >= ui.library->nrows)
          ui.library->crow = ui.library->nrows - ui.library->voffset - 1;
 
       medialib_playlist_remove(n);
-      paint_library();
+      paint_damage(PAINT_LIBRARY);
       free(warning);
       return;
    }
@@ -1074,13 +1079,9 @@ kba_cut(KbaArgs a UNUSED)
    if (end > ui.active->nrows)
       end = ui.active->nrows;
 
-   /* clear existing yank buffer and add new stuff */
-   ybuffer_clear();
-   for (n = start; n < end; n++)
-      ybuffer_add(viewing_playlist->files[n]);
-
-   /* delete files */
-   playlist_files_remove(viewing_playlist, start, end - start, true);
+   /* delete files, putting them in the yank buffer */
+   s = playlist_files_cut(viewing_playlist, start, end - start, true);
+   ybuffer_set(s, s->files, end - start);
 
    /* update ui appropriately */
    viewing_playlist->needs_saving = true;
@@ -1090,14 +1091,15 @@ kba_cut(KbaArgs a UNUSED)
 
 
    /* redraw */
-   paint_playlist();
-   paint_library();
+   paint_damage(PAINT_LIBRARY | PAINT_PLAYLIST);
    paint_message("%d fewer files.", end - start);
 }
 
 void
 kba_yank(KbaArgs a UNUSED)
 {
+   playlist_slice *s;
+   meta_info **f;
    bool got_target;
    int  start, end;
    int  input;
@@ -1168,12 +1170,11 @@ kba_yank(KbaArgs a UNUSED)
    if (end > ui.active->nrows)
       end = ui.active->nrows;
 
-   /* clear existing yank buffer and add new stuff */
-   ybuffer_clear();
-   for (n = start; n < end; n++)
-      ybuffer_add(viewing_playlist->files[n]);
+   /* replace the yank buffer with the files */
+   s = playlist_files_share(viewing_playlist, start, end - start, &f);
+   ybuffer_set(s, f, end - start);
 
-   paint_playlist();
+   paint_damage(PAINT_PLAYLIST);
    /* notify user # of rows yanked */
    paint_message("Yanked %d files.", end - start);
 }
@@ -1194,6 +1195,11 @@ kba_paste(KbaArgs a)
    if (ui.active == ui.library) {
       i = ui.active->voffset + ui.active->crow;
       p = mdb.playlists[i];
+      if (medialib_playlist_resolve(p) == -1) {
+         paint_error("failed to read playlist '%s': %s", p->name,
+            strerror(errno));
+         return;
+      }
    } else {
       p = viewing_playlist;
    }
@@ -1233,7 +1239,8 @@ kba_paste(KbaArgs a)
    }
 
    /* add files */
-   playlist_files_add(p, _yank_buffer.files, start, _yank_buffer.nfiles, true);
+   playlist_files_add_slice(p, _yank_buffer.slice, _yank_buffer.files, start,
+      _yank_buffer.nfiles, true);
 
    if (p == viewing_playlist)
       ui.playlist->nrows = p->nfiles;
@@ -1241,8 +1248,7 @@ kba_paste(KbaArgs a)
    p->needs_saving = true;
 
    /* redraw */
-   paint_library();
-   paint_playlist();
+   paint_damage(PAINT_LIBRARY | PAINT_PLAYLIST);
    if (ui.active == ui.library)
       paint_message("Pasted %d files to '%s'", _yank_buffer.nfiles, p->name);
    else
@@ -1269,7 +1275,7 @@ kba_undo(KbaArgs a UNUSED)
    if (ui.playlist->voffset + ui.playlist->crow >= ui.playlist->nrows)
       ui.playlist->crow = ui.playlist->nrows - ui.playlist->voffset - 1;
 
-   paint_playlist();
+   paint_damage(PAINT_PLAYLIST);
 }
 
 void
@@ -1291,7 +1297,7 @@ kba_redo(KbaArgs a UNUSED)
    if (ui.playlist->voffset + ui.playlist->crow >= ui.playlist->nrows)
       ui.playlist->crow = ui.playlist->nrows - ui.playlist->voffset - 1;
 
-   paint_playlist();
+   paint_damage(PAINT_PLAYLIST);
 }
 
 void
@@ -1361,7 +1367,6 @@ kba_switch_windows(KbaArgs a UNUSED)
    }
 
    paint_all();
-   paint_status_bar();
 }
 
 void
@@ -1378,11 +1383,16 @@ kba_show_file_info(KbaArgs a UNUSED)
    }
 
    if (showing_file_info)
-      paint_playlist();
+      paint_damage(PAINT_PLAYLIST);
    else {
+      /* the playlists holding the file come from its refs, which those
+       * not read yet (see medialib_load()) don't have */
+      while (mdb.nunloaded > 0)
+         medialib_playlist_resolve_next();
+
       /* get file index and show */
       idx = ui.active->voffset + ui.active->crow;
-      paint_playlist_file_info(viewing_playlist->files[idx]);
+      paint_playlist_file_info(playlist_file(viewing_playlist, idx));
    }
 }
 
@@ -1394,13 +1404,9 @@ kba_load_playlist(KbaArgs a UNUSED)
    if (ui.active == ui.library) {
       /* load playlist & switch focus */
       idx = ui.library->voffset + ui.library->crow;
-      viewing_playlist = mdb.playlists[idx];
-      ui.playlist->nrows = mdb.playlists[idx]->nfiles;
-      ui.playlist->crow  = 0;
-      ui.playlist->voffset = 0;
-      ui.playlist->hoffset = 0;
+      setup_viewing_playlist(mdb.playlists[idx]);
 
-      paint_playlist();
+      paint_damage(PAINT_PLAYLIST);
       kba_switch_windows(get_dummy_args());
    } else {
       /* play song */
@@ -1422,13 +1428,9 @@ kba_play(KbaArgs a UNUSED)
    if (ui.active == ui.library) {
       /* load playlist & switch focus */
       idx = ui.library->voffset + ui.library->crow;
-      viewing_playlist = mdb.playlists[idx];
-      ui.playlist->nrows = mdb.playlists[idx]->nfiles;
-      ui.playlist->crow  = 0;
-      ui.playlist->voffset = 0;
-      ui.playlist->hoffset = 0;
+      setup_viewing_playlist(mdb.playlists[idx]);
 
-      paint_playlist();
+      paint_damage(PAINT_PLAYLIST);
       kba_switch_windows(get_dummy_args());
    } else {
       /* play song */
@@ -1666,46 +1668,34 @@ yank_buffer _yank_buffer;
 void
 ybuffer_init()
 {
-   _yank_buffer.files = calloc(YANK_BUFFER_CHUNK_SIZE, sizeof(meta_info*));
-   if (_yank_buffer.files == NULL)
-      err(1, "ybuffer_init: calloc(3) failed");
-
-   _yank_buffer.capacity = YANK_BUFFER_CHUNK_SIZE;
+   _yank_buffer.slice = NULL;
+   _yank_buffer.files = NULL;
    _yank_buffer.nfiles = 0;
 }
 
 void
 ybuffer_clear()
 {
-   _yank_buffer.nfiles = 0;
+   if (_yank_buffer.slice != NULL)
+      playlist_slice_unref(_yank_buffer.slice);
+
+   ybuffer_init();
 }
 
 void
 ybuffer_free()
 {
-   free(_yank_buffer.files);
-   _yank_buffer.capacity = 0;
-   _yank_buffer.nfiles = 0;
+   ybuffer_clear();
 }
 
+/* set the buffer to n files f in slice s, taking over the reference to s */
 void
-ybuffer_add(meta_info *f)
+ybuffer_set(playlist_slice *s, meta_info **f, int n)
 {
-   meta_info **new_buff;
-   int   new_capacity;
-
-   /* do we need to realloc()? */
-   if (_yank_buffer.nfiles == _yank_buffer.capacity) {
-      _yank_buffer.capacity += YANK_BUFFER_CHUNK_SIZE;
-      new_capacity = _yank_buffer.capacity * sizeof(meta_info*);
-      if ((new_buff = realloc(_yank_buffer.files, new_capacity)) == NULL)
-         err(1, "ybuffer_add: realloc(3) failed [%i]", new_capacity);
-
-      _yank_buffer.files = new_buff;
-   }
-
-   /* add the file */
-   _yank_buffer.files[ _yank_buffer.nfiles++ ] = f;
+   ybuffer_clear();
+   _yank_buffer.slice = s;
+   _yank_buffer.files = f;
+   _yank_buffer.nfiles = n;
 }
 
 
@@ -1719,9 +1709,9 @@ void
 redraw_active()
 {
    if (ui.active == ui.library)
-      paint_library();
+      paint_damage(PAINT_LIBRARY);
    else
-      paint_playlist();
+      paint_damage(PAINT_PLAYLIST);
 }
 
 /*
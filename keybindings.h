@@ -174,19 +174,22 @@ Direction search_dir_get();
 void  search_dir_set(Direction d);
 
 
-/* This is the copy/cut buffer and the routines used to manipulate it. */
-#define YANK_BUFFER_CHUNK_SIZE 100
+/*
+ * This is the copy/cut buffer and the routines used to manipulate it.  The
+ * files are held in a slice, which for a large yank is shared with the
+ * playlist yanked from, and is shared in turn with what they're pasted into.
+ */
 typedef struct {
-   meta_info   **files;
-   int           nfiles;
-   int           capacity;
+   playlist_slice  *slice;
+   meta_info      **files;
+   int              nfiles;
 } yank_buffer;
 extern yank_buffer _yank_buffer;
 
 void ybuffer_init();
 void ybuffer_clear();
 void ybuffer_free();
-void ybuffer_add(meta_info *f);
+void ybuffer_set(playlist_slice *s, meta_info **f, int n);
 
 
 /* Misc. handy functions used frequently */
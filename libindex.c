@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "libindex.h"
+
+#define LIBINDEX_INITIAL_CAPACITY   1024
+
+/* marks slots whose record was removed (probe sequences continue past) */
+static meta_info libindex_tombstone;
+#define DELETED   (&libindex_tombstone)
+
+/* FNV-1a hash of a filename */
+static uint32_t
+libindex_hash(const char *s)
+{
+   uint32_t h = 2166136261u;
+
+   while (*s != '\0') {
+      h ^= (unsigned char) *s++;
+      h *= 16777619u;
+   }
+
+   return h;
+}
+
+/*
+ * Return the slot holding the given filename, or if it's not in the table,
+ * the slot where it should be inserted.
+ */
+static libindex_entry *
+libindex_slot(const libindex *idx, const char *filename, uint32_t hash)
+{
+   libindex_entry *e, *free_slot;
+   size_t          mask, i;
+
+   mask = idx->capacity - 1;
+   free_slot = NULL;
+   for (i = hash & mask; ; i = (i + 1) & mask) {
+      e = &(idx->entries[i]);
+      if (e->mi == NULL)
+         return (free_slot != NULL ? free_slot : e);
+
+      if (e->mi == DELETED) {
+         if (free_slot == NULL)
+            free_slot = e;
+      } else if (e->hash == hash && strcmp(e->mi->filename, filename) == 0)
+         return e;
+   }
+}
+
+/* rebuild the table with the given capacity, dropping all tombstones */
+static void
+libindex_resize(libindex *idx, size_t capacity)
+{
+   libindex_entry *old, *e;
+   size_t          oldcap, i;
+
+   old = idx->entries;
+   oldcap = idx->capacity;
+
+   if ((idx->entries = calloc(capacity, sizeof(libindex_entry))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   idx->capacity = capacity;
+   idx->ndeleted = 0;
+
+   for (i = 0; i < oldcap; i++) {
+      if (old[i].mi == NULL || old[i].mi == DELETED)
+         continue;
+
+      e = libindex_slot(idx, old[i].mi->filename, old[i].hash);
+      *e = old[i];
+   }
+
+   free(old);
+}
+
+/* grow the id table to hold the given id */
+static void
+libindex_grow_ids(libindex *idx, uint32_t id)
+{
+   meta_info **byid;
+   uint32_t    n;
+
+   n = (idx->nids == 0 ? 1024 : idx->nids);
+   while (n <= id) {
+      if (n > UINT32_MAX / 2)
+         errx(1, "%s: id %u out of range", __FUNCTION__, id);
+      n *= 2;
+   }
+
+   if ((byid = realloc(idx->byid, n * sizeof(meta_info*))) == NULL)
+      err(1, "%s: realloc(3) failed", __FUNCTION__);
+
+   memset(byid + idx->nids, 0, (n - idx->nids) * sizeof(meta_info*));
+   idx->byid = byid;
+   idx->nids = n;
+}
+
+libindex *
+libindex_new(void)
+{
+   libindex *idx;
+
+   if ((idx = malloc(sizeof(libindex))) == NULL)
+      err(1, "%s: malloc(3) failed", __FUNCTION__);
+
+   idx->entries  = NULL;
+   idx->capacity = 0;
+   idx->nused    = 0;
+   idx->ndeleted = 0;
+   idx->byid     = NULL;
+   idx->nids     = 0;
+   idx->stamp    = 0;
+   libindex_resize(idx, LIBINDEX_INITIAL_CAPACITY);
+
+   return idx;
+}
+
+void
+libindex_free(libindex *idx)
+{
+   free(idx->entries);
+   free(idx->byid);
+   free(idx);
+}
+
+/*
+ * Keep the load (including tombstones) under 3/4.  A rebuild drops all
+ * tombstones and leaves the table at most half full.
+ */
+void
+libindex_reserve(libindex *idx, size_t n)
+{
+   size_t capacity;
+
+   if ((n + idx->ndeleted) * 4 < idx->capacity * 3)
+      return;
+
+   capacity = idx->capacity;
+   while (n * 2 >= capacity)
+      capacity *= 2;
+
+   libindex_resize(idx, capacity);
+}
+
+void
+libindex_add(libindex *idx, meta_info *mi, int hint)
+{
+   libindex_entry *e;
+   uint32_t        hash;
+
+   libindex_reserve(idx, idx->nused + 1);
+
+   hash = libindex_hash(mi->filename);
+   e = libindex_slot(idx, mi->filename, hash);
+   if (e->mi == NULL || e->mi == DELETED) {
+      if (e->mi == DELETED)
+         idx->ndeleted--;
+      idx->nused++;
+   }
+
+   e->mi   = mi;
+   e->hash = hash;
+   e->hint = hint;
+
+   if (mi->id != 0) {
+      if (mi->id >= idx->nids)
+         libindex_grow_ids(idx, mi->id);
+      idx->byid[mi->id] = mi;
+   }
+}
+
+void
+libindex_remove(libindex *idx, const meta_info *mi)
+{
+   libindex_entry *e;
+
+   e = libindex_slot(idx, mi->filename, libindex_hash(mi->filename));
+
+   /* only remove if it's this very record that's indexed */
+   if (e->mi != mi)
+      return;
+
+   e->mi = DELETED;
+   idx->nused--;
+   idx->ndeleted++;
+
+   if (mi->id != 0 && mi->id < idx->nids && idx->byid[mi->id] == mi)
+      idx->byid[mi->id] = NULL;
+}
+
+meta_info *
+libindex_get(const libindex *idx, const char *filename, int *hint)
+{
+   libindex_entry *e;
+
+   e = libindex_slot(idx, filename, libindex_hash(filename));
+   if (e->mi == NULL || e->mi == DELETED)
+      return NULL;
+
+   if (hint != NULL)
+      *hint = e->hint;
+
+   return e->mi;
+}
+
+meta_info *
+libindex_get_id(const libindex *idx, uint32_t id)
+{
+   if (id == 0 || id >= idx->nids)
+      return NULL;
+
+   return idx->byid[id];
+}
+
+void
+libindex_set_hint(libindex *idx, const meta_info *mi, int hint)
+{
+   libindex_entry *e;
+
+   e = libindex_slot(idx, mi->filename, libindex_hash(mi->filename));
+   if (e->mi == mi)
+      e->hint = hint;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBINDEX_H
+#define LIBINDEX_H
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "meta_info.h"
+
+#include "compat.h"
+
+/*
+ * The library index: a hash table mapping the filename of every record in
+ * the media library to its meta_info.  It is owned by the global medialib
+ * (mdb.index) and kept in sync with mdb.library by the playlist_files_*
+ * routines, so looking up whether a file is already in the library is O(1).
+ *
+ * Each entry also keeps a hint of the record's position within the library.
+ * Hints are set when a record is added but are NOT updated when other
+ * records shift around it (inserts, removals, sorting), so they are only a
+ * starting point for searching.  See playlist_find().
+ *
+ * The keys are the filename strings of the meta_info's themselves (nothing
+ * is copied), so a record's filename must not change while it is indexed.
+ *
+ * Records with a database id (mi->id != 0) are also kept in a table indexed
+ * by id, which is how ID-based playlist files are resolved.  The stamp is
+ * that of the database the ids belong to (see medialib.h).
+ */
+
+typedef struct {
+   meta_info  *mi;      /* NULL = empty slot */
+   uint32_t    hash;    /* hash of mi->filename */
+   int         hint;    /* last known position in the library */
+} libindex_entry;
+
+typedef struct {
+   libindex_entry *entries;
+   size_t          capacity;   /* always a power of 2 */
+   size_t          nused;      /* live entries */
+   size_t          ndeleted;   /* tombstones */
+
+   meta_info     **byid;       /* records by id, NULL for unused ids */
+   uint32_t        nids;       /* size of the byid table */
+   uint64_t        stamp;      /* database the ids belong to, 0 = none */
+} libindex;
+
+/* create/destroy an index */
+libindex *libindex_new(void);
+void libindex_free(libindex *idx);
+
+/* pre-size the index to hold n records without growing */
+void libindex_reserve(libindex *idx, size_t n);
+
+/* add/remove records (remove is a no-op for records not in the index) */
+void libindex_add(libindex *idx, meta_info *mi, int hint);
+void libindex_remove(libindex *idx, const meta_info *mi);
+
+/*
+ * lookup a record by filename, returning NULL if there is none.  if hint is
+ * not NULL it is set to the position hint of the record.
+ */
+meta_info *libindex_get(const libindex *idx, const char *filename, int *hint);
+
+/* lookup a record by database id, returning NULL if there is none */
+meta_info *libindex_get_id(const libindex *idx, uint32_t id);
+
+/* update the position hint of a record in the index */
+void libindex_set_hint(libindex *idx, const meta_info *mi, int hint);
+
+#endif
@@ -19,17 +19,38 @@
 /* The global media library struct */
 medialib mdb;
 
+static void medialib_db_write(const char *db_file, meta_info **files,
+   int nfiles);
+static char *db_journal_name(const char *db_file);
+static char *db_dirs_name(const char *db_file);
+
+/* number of jobs that may be in flight, per worker thread */
+#define MEDIALIB_JOBS_PER_THREAD 32
+
+/* files stat(2)'d and extracted together by update and scan, see below */
+#define MEDIALIB_BATCH_SIZE 1024
+
+/* run on the worker threads of medialib_load(): read a playlist's file */
+static void
+medialib_playlist_read(void *arg)
+{
+   playlist_read(arg, mdb.index);
+}
+
 /*
  * Load the global media library from disk. The location of the database file
- * and the directory containing all of the playlists must be specified.
+ * and the directory containing all of the playlists must be specified.  If
+ * lazy is set, the playlists are only registered by name, and read when
+ * medialib_playlist_resolve() is first called on them.
  */
 void
-medialib_load(const char *db_file, const char *playlist_dir)
+medialib_load(const char *db_file, const char *playlist_dir, bool lazy)
 {
-   playlist  *p;
-   char     **pfiles;
-   int        npfiles;
-   int        i;
+   playlist_contents *c;
+   workq             *q;
+   char             **pfiles;
+   int                npfiles, nthreads;
+   int                i;
 
    /* copy file/directory names */
    mdb.db_file      = strdup(db_file);
@@ -41,6 +62,10 @@ medialib_load(const char *db_file, const char *playlist_dir)
    mdb.library = playlist_new();
    mdb.library->filename = NULL;
    mdb.library->name = strdup("--LIBRARY--");
+   mdb.index = libindex_new();
+   mdb.library->index = mdb.index;
+   mdb.tokens = tokindex_new();
+   mdb.library->tokens = mdb.tokens;
 
    mdb.filter_results = playlist_new();
    mdb.filter_results->filename = NULL;
@@ -63,12 +88,31 @@ medialib_load(const char *db_file, const char *playlist_dir)
    medialib_playlist_add(mdb.library);
    medialib_playlist_add(mdb.filter_results);
 
-   /* load the rest */
+   /*
+    * load the rest: read by worker threads (the index isn't changed until
+    * they're done) and built here in order, as glob(3) sorted them
+    */
    npfiles = retrieve_playlist_filenames(mdb.playlist_dir, &pfiles);
-   for (i = 0; i < npfiles; i++) {
-      p = playlist_load(pfiles[i], mdb.library->files, mdb.library->nfiles);
-      medialib_playlist_add(p);
-      free(pfiles[i]);
+   nthreads = MIN(npfiles, MEDIALIB_LOAD_THREADS);
+   if (lazy) {
+      for (i = 0; i < npfiles; i++) {
+         medialib_playlist_add(playlist_lazy(pfiles[i]));
+         free(pfiles[i]);
+      }
+   } else if (nthreads > 0) {
+      q = workq_new(nthreads, nthreads * MEDIALIB_JOBS_PER_THREAD,
+         medialib_playlist_read);
+
+      for (i = 0; i < npfiles; i++) {
+         if ((c = workq_submit(q, playlist_contents_new(pfiles[i]))) != NULL)
+            medialib_playlist_add(playlist_build(c));
+         free(pfiles[i]);
+      }
+
+      while ((c = workq_next(q)) != NULL)
+         medialib_playlist_add(playlist_build(c));
+
+      workq_free(q);
    }
 
    /* set all playlists as saved initially */
@@ -84,25 +128,70 @@ medialib_destroy()
 {
    int i;
 
-   /* free the database */
+   /* free all the playlists (dropping their refs) before the database */
+   for (i = 0; i < mdb.nplaylists; i++) {
+      if (mdb.playlists[i] != mdb.library)
+         playlist_free(mdb.playlists[i]);
+   }
+
    for (i = 0; i < mdb.library->nfiles; i++)
-      mi_free(mdb.library->files[i]);
+      mi_free(playlist_file(mdb.library, i));
 
-   /* free all the playlists */
-   for (i = 0; i < mdb.nplaylists; i++)
-      playlist_free(mdb.playlists[i]);
+   playlist_free(mdb.library);
+
+   for (i = 0; i < mdb.norphans; i++)
+      mi_free(mdb.orphans[i]);
+
+   free(mdb.orphans);
+   mdb.orphans = NULL;
+   mdb.norphans = 0;
+   mdb.orphans_capacity = 0;
+
+   /* rows cached for the freed records must not match new ones */
+   mi_display_invalidate();
 
    /* free all other allocated mdb members */
+   for (i = 0; i < mdb.ndirty; i++)
+      free(mdb.dirty[i]);
+
+   free(mdb.dirty);
+   mdb.dirty = NULL;
+   mdb.ndirty = 0;
+   mdb.dirty_capacity = 0;
+
+   libindex_free(mdb.index);
+   tokindex_free(mdb.tokens);
+
+   /* the pool holds strings of the mapping below */
+   strpool_clear();
    free(mdb.playlists);
    free(mdb.db_file);
    free(mdb.playlist_dir);
 
+   /* release the database mapping (after all records pointing into it) */
+   if (mdb.db_map != NULL && munmap(mdb.db_map, mdb.db_map_size) == -1)
+      err(1, "medialib_destroy: munmap failed");
+
+   if (mdb.journal_map != NULL
+   &&  munmap(mdb.journal_map, mdb.journal_map_size) == -1)
+      err(1, "medialib_destroy: munmap failed");
+
+   mdb.db_map = NULL;
+   mdb.db_map_size = 0;
+   mdb.journal_map = NULL;
+   mdb.journal_map_size = 0;
+   mdb.journal_size = 0;
+
    /* reset counters */
    mdb.nplaylists = 0;
    mdb.playlists_capacity = 0;
+   mdb.nunloaded = 0;
 }
 
-/* add a new playlist to the media library */
+/*
+ * add a new playlist to the media library.  all of them but the library
+ * itself keep the refs of their files.
+ */
 void
 medialib_playlist_add(playlist *p)
 {
@@ -120,6 +209,11 @@ medialib_playlist_add(playlist *p)
    }
 
    mdb.playlists[mdb.nplaylists++] = p;
+   if (p != mdb.library)
+      playlist_refs_track(p, true);
+
+   if (!p->loaded)
+      mdb.nunloaded++;
 }
 
 /*
@@ -134,6 +228,9 @@ medialib_playlist_remove(int pindex)
    if (pindex < 0 || pindex >= mdb.nplaylists)
       errx(1, "medialib_playlist_remove: index %d out of range", pindex);
 
+   if (!mdb.playlists[pindex]->loaded)
+      mdb.nunloaded--;
+
    playlist_delete(mdb.playlists[pindex]);
 
    /* reorder */
@@ -143,6 +240,37 @@ medialib_playlist_remove(int pindex)
    mdb.nplaylists--;
 }
 
+/*
+ * read a playlist registered by a lazy medialib_load(), if it isn't yet.
+ * returns -1 with errno set if its file couldn't be read (it's left empty).
+ */
+int
+medialib_playlist_resolve(playlist *p)
+{
+   if (p->loaded)
+      return 0;
+
+   mdb.nunloaded--;
+   return playlist_resolve(p, mdb.index);
+}
+
+/*
+ * read the first playlist not loaded yet (see above), if any, ignoring
+ * errors since nothing asked for it.  used to load them all while idle.
+ */
+void
+medialib_playlist_resolve_next(void)
+{
+   int i;
+
+   for (i = 0; i < mdb.nplaylists; i++) {
+      if (!mdb.playlists[i]->loaded) {
+         medialib_playlist_resolve(mdb.playlists[i]);
+         return;
+      }
+   }
+}
+
 /*
  * create the vitunes directory, database file (initially empty, and
  * playlists directory.
@@ -152,8 +280,7 @@ medialib_setup_files(const char *vitunes_dir, const char *db_file,
    const char *playlist_dir)
 {
    struct stat sb;
-   FILE *f;
-   int   version[3] = {DB_VERSION_MAJOR, DB_VERSION_MINOR, DB_VERSION_OTHER};
+   char       *journal_file;
 
    /* create vitunes directory */
    if (mkdir(vitunes_dir, S_IRWXU) == -1) {
@@ -176,17 +303,14 @@ medialib_setup_files(const char *vitunes_dir, const char *db_file,
    /* create database file */
    if (stat(db_file, &sb) < 0) {
       if (errno == ENOENT) { 
-
-         /* open for writing */
-         if ((f = fopen(db_file, "w")) == NULL)
-            err(1, "failed to create database file '%s'", db_file);
-
-         /* save header & version */
-         fwrite("vitunes", strlen("vitunes"), 1, f);
-         fwrite(version, sizeof(version), 1, f);
-
+         medialib_db_write(db_file, NULL, 0);
          warnx("empty database at '%s' created", db_file);
-         fclose(f);
+
+         /* a journal left from a removed database does not apply to it */
+         journal_file = db_journal_name(db_file);
+         if (unlink(journal_file) == -1 && errno != ENOENT)
+            err(1, "unable to remove old journal '%s'", journal_file);
+         free(journal_file);
       } else
          err(1, "database file '%s' exists, but cannot access it", db_file);
    } else
@@ -204,27 +328,347 @@ static int mi_cmp_fn(const void *ai, const void *bi)
    return strcmp(a->filename, b->filename);
 }
 
-/* load the library database into the global media library */
-void
-medialib_db_load(const char *db_file)
+/*
+ * Convert a record of the mmap'd record table to a meta_info.  The strings
+ * are not copied, they point into the heap (the cinfo strings are added to
+ * the string pool as they are, unless the pool has them already).  Returns NULL if the record
+ * references anything outside of the heap.
+ */
+static meta_info *
+db_record_map(const db_record *r, char *heap, uint64_t heap_size)
+{
+   meta_info *mi;
+   int        i;
+
+   if (r->filename == 0 || r->filename >= heap_size)
+      return NULL;
+
+   for (i = 0; i < MI_NUM_CINFO; i++) {
+      if (r->cinfo[i] >= heap_size)
+         return NULL;
+   }
+
+   mi = mi_new();
+   mi->is_mapped = true;
+   mi->filename = heap + r->filename;
+   mi->id = r->id;
+   for (i = 0; i < MI_NUM_CINFO; i++) {
+      if (r->cinfo[i] == 0)
+         continue;
+
+      /* records older than 3.1 have track & year as strings */
+      if (MI_CINFO_NUMERIC(i))
+         mi_cinfo_set(mi, i, heap + r->cinfo[i]);
+      else
+         mi->cinfo[i] = strpool_adopt(heap + r->cinfo[i]);
+   }
+
+   if (r->track != 0)
+      mi->track = r->track;
+   if (r->year != 0)
+      mi->year = r->year;
+   mi->length = r->length;
+   mi->last_updated = r->last_updated;
+   mi->fid.dev = r->dev;
+   mi->fid.ino = r->ino;
+   mi->fid.size = r->size;
+   mi->fid.mtime = r->mtime;
+   mi->is_url = (r->flags & DB_RECORD_IS_URL) != 0;
+
+   return mi;
+}
+
+/* a new database stamp (the time of creation in microseconds) */
+static uint64_t
+db_new_stamp(void)
+{
+   struct timeval tv;
+
+   if (gettimeofday(&tv, NULL) == -1)
+      err(1, "%s: gettimeofday failed", __FUNCTION__);
+
+   return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * Give a record being added to the library a new id if it doesn't have one
+ * yet, returning true if it was given one.  A record that has one already
+ * only moves mdb.next_id past it.
+ */
+static bool
+db_assign_id(meta_info *mi)
+{
+   if (mi->id != 0) {
+      if (mi->id >= mdb.next_id)
+         mdb.next_id = mi->id + 1;
+      return false;
+   }
+
+   if (mdb.next_id == UINT32_MAX)
+      errx(1, "%s: out of record ids", __FUNCTION__);
+
+   mi->id = mdb.next_id++;
+   return true;
+}
+
+/*
+ * Read a version 2.1.0 database (a stream of variable length records) into
+ * an array of records, returning the number read.
+ */
+static int
+medialib_db_migrate(const char *db_file, int version[3], meta_info ***records)
 {
    meta_info *mi;
    FILE      *fin;
-   char       header[255] = { 0 };
-   int        version[3];
+   int        n, capacity;
+
+   warnx("converting database '%s' from version %d.%d.%d to %d.%d.%d",
+      db_file, version[0], version[1], version[2],
+      DB_VERSION_MAJOR, DB_VERSION_MINOR, DB_VERSION_OTHER);
 
    if ((fin = fopen(db_file, "r")) == NULL)
       err(1, "medialib_db_load: failed to open database file '%s'", db_file);
 
+   if (fseek(fin, strlen("vitunes") + 3 * sizeof(int), SEEK_SET) == -1)
+      err(1, "medialib_db_load: failed to seek in '%s'", db_file);
+
+   n = 0;
+   capacity = 0;
+   *records = NULL;
+   while (!feof(fin)) {
+      mi = mi_new();
+      mi_fread(mi, fin);
+      if (feof(fin))
+         mi_free(mi);
+      else if (ferror(fin))
+         err(1, "medialib_db_load: error loading database file '%s'", db_file);
+      else {
+         if (n == capacity) {
+            capacity += MEDIALIB_PLAYLISTS_CHUNK_SIZE;
+            *records = realloc(*records, capacity * sizeof(meta_info*));
+            if (*records == NULL)
+               err(1, "medialib_db_load: realloc failed");
+         }
+         (*records)[n++] = mi;
+      }
+   }
+
+   fclose(fin);
+   return n;
+}
+
+/* name of the journal file of a database */
+static char *
+db_journal_name(const char *db_file)
+{
+   char *journal_file;
+
+   if (asprintf(&journal_file, "%s.journal", db_file) == -1)
+      errx(1, "%s: asprintf failed", __FUNCTION__);
+
+   return journal_file;
+}
+
+/* name of the directory table of a database (see dirtab.h) */
+static char *
+db_dirs_name(const char *db_file)
+{
+   char *dirs_file;
+
+   if (asprintf(&dirs_file, "%s.dirs", db_file) == -1)
+      errx(1, "%s: asprintf failed", __FUNCTION__);
+
+   return dirs_file;
+}
+
+/* checksum of a journal entry (32-bit FNV-1a) */
+static uint32_t
+db_checksum(const char *buf, size_t len)
+{
+   uint32_t h = 2166136261u;
+   size_t   i;
+
+   for (i = 0; i < len; i++) {
+      h ^= (unsigned char) buf[i];
+      h *= 16777619u;
+   }
+
+   return h;
+}
+
+/*
+ * Apply the journal of a database (if any) to the library just loaded from
+ * it.  Replayed records point into the mmap'd journal, which is kept in
+ * mdb.journal_map.  mdb.journal_size is set to the length of the valid part
+ * of the journal, which is where the next save appends.  Returns true if
+ * any record had to be given an id (it was journaled by an older version).
+ */
+static bool
+medialib_db_replay(const char *db_file)
+{
+   db_journal_header  jhdr;
+   db_journal_entry   entry;
+   db_record          rec;
+   struct stat        sb;
+   meta_info         *mi, *existing;
+   char              *journal_file, *map, *body;
+   size_t             prefix, offset;
+   int                version[3];
+   int                fd, idx, i, nreplayed;
+   bool               assigned;
+
+   journal_file = db_journal_name(db_file);
+   if ((fd = open(journal_file, O_RDONLY)) == -1) {
+      if (errno != ENOENT)
+         err(1, "medialib_db_load: failed to open journal '%s'", journal_file);
+      free(journal_file);
+      return false;
+   }
+
+   if (fstat(fd, &sb) == -1)
+      err(1, "medialib_db_load: failed to stat journal '%s'", journal_file);
+
+   prefix = strlen("vitunes") + sizeof(version) + sizeof(jhdr);
+   if ((size_t) sb.st_size < prefix) {
+      close(fd);
+      free(journal_file);
+      return false;
+   }
+
+   map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED)
+      err(1, "medialib_db_load: failed to mmap journal '%s'", journal_file);
+
+   close(fd);
+   mdb.journal_map = map;
+   mdb.journal_map_size = sb.st_size;
+
+   memcpy(version, map + strlen("vitunes"), sizeof(version));
+   memcpy(&jhdr, map + strlen("vitunes") + sizeof(version), sizeof(jhdr));
+   if (strncmp(map, "vitunes", strlen("vitunes")) != 0
+   ||  version[0] != DB_VERSION_MAJOR || version[1] > DB_VERSION_MINOR
+   ||  jhdr.header_size < sizeof(jhdr) || jhdr.record_size == 0) {
+      warnx("ignoring unknown journal '%s'", journal_file);
+      free(journal_file);
+      return false;
+   }
+
+   nreplayed = 0;
+   assigned = false;
+   offset = strlen("vitunes") + sizeof(version) + jhdr.header_size;
+   while (offset + sizeof(entry) <= mdb.journal_map_size) {
+      memcpy(&entry, map + offset, sizeof(entry));
+      body = map + offset + sizeof(entry);
+
+      /* stop at a torn/corrupt entry */
+      if (entry.size <= jhdr.record_size
+      ||  entry.size > mdb.journal_map_size - offset - sizeof(entry)
+      ||  entry.checksum != db_checksum(body, entry.size)
+      ||  body[entry.size - 1] != '\0'
+      ||  (entry.op != DB_JOURNAL_PUT && entry.op != DB_JOURNAL_DEL))
+         break;
+
+      memset(&rec, 0, sizeof(rec));
+      memcpy(&rec, body, MIN(sizeof(rec), jhdr.record_size));
+      mi = db_record_map(&rec, body + jhdr.record_size,
+         entry.size - jhdr.record_size);
+      if (mi == NULL)
+         break;
+
+      existing = libindex_get(mdb.index, mi->filename, NULL);
+      if (entry.op == DB_JOURNAL_PUT) {
+         if (existing != NULL && mi->id == 0)
+            mi->id = existing->id;
+         if (db_assign_id(mi))
+            assigned = true;
+      }
+
+      if (existing != NULL) {
+         idx = playlist_find(mdb.library, mi->filename);
+         if (entry.op == DB_JOURNAL_PUT)
+            playlist_file_replace(mdb.library, idx, mi);
+         else
+            playlist_files_remove(mdb.library, idx, 1, false);
+         mi_free(existing);
+      } else if (entry.op == DB_JOURNAL_PUT)
+         playlist_files_append(mdb.library, &mi, 1, false);
+
+      if (entry.op == DB_JOURNAL_DEL)
+         mi_free(mi);
+
+      nreplayed++;
+      offset += sizeof(entry) + entry.size;
+   }
+
+   mdb.journal_size = offset;
+   free(journal_file);
+
+   /* keep the library in the same order as if it had been compacted */
+   if (nreplayed > 0) {
+      qsort(playlist_files(mdb.library), mdb.library->nfiles,
+         sizeof(meta_info*), mi_cmp_fn);
+      for (i = 0; i < mdb.library->nfiles; i++)
+         libindex_set_hint(mdb.index, playlist_file(mdb.library, i), i);
+   }
+
+   return assigned;
+}
+
+/* load the library database into the global media library */
+void
+medialib_db_load(const char *db_file)
+{
+   struct stat sb;
+   db_header   hdr;
+   db_record   rec;
+   meta_info **records;
+   char       *map, *table, *heap;
+   size_t      prefix, size;
+   uint64_t    need;
+   uint32_t    i, nrecords;
+   int         version[3];
+   int         fd;
+   bool        migrated;
+
+   if ((fd = open(db_file, O_RDONLY)) == -1)
+      err(1, "medialib_db_load: failed to open database file '%s'", db_file);
+
+   if (fstat(fd, &sb) == -1)
+      err(1, "medialib_db_load: failed to stat database file '%s'", db_file);
+
    /* read and check header & version */
-   fread(header, strlen("vitunes"), 1, fin);
-   if (strncmp(header, "vitunes", strlen("vitunes")) != 0)
+   prefix = strlen("vitunes") + sizeof(version);
+   if ((size_t) sb.st_size < prefix)
       errx(1, "medialib_db_load: db file '%s' NOT a vitunes database", db_file);
 
-   fread(version, sizeof(version), 1, fin);
-   if (version[0] != DB_VERSION_MAJOR || version[1] != DB_VERSION_MINOR
-   ||  version[2] != DB_VERSION_OTHER) {
-      printf("Loading vitunes database: old database version detected.\n");
+   map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED)
+      err(1, "medialib_db_load: failed to mmap database file '%s'", db_file);
+
+   close(fd);
+
+   if (strncmp(map, "vitunes", strlen("vitunes")) != 0)
+      errx(1, "medialib_db_load: db file '%s' NOT a vitunes database", db_file);
+
+   memcpy(version, map + strlen("vitunes"), sizeof(version));
+
+   /*
+    * the last version before the mmap'able format is converted, and older
+    * minor versions are rewritten in the current one after loading
+    */
+   migrated = (version[0] == DB_VERSION_MAJOR
+            && version[1] < DB_VERSION_MINOR);
+   if (version[0] == 2 && version[1] == 1 && version[2] == 0) {
+      munmap(map, sb.st_size);
+      nrecords = medialib_db_migrate(db_file, version, &records);
+      mdb.db_stamp = 0;
+      mdb.next_id = 0;
+      migrated = true;
+      goto sort;
+   }
+
+   if (version[0] != DB_VERSION_MAJOR || version[1] > DB_VERSION_MINOR) {
+      printf("Loading vitunes database: unknown database version detected.\n");
       printf("\tExisting database at '%s' is of version %d.%d.%d\n",
          db_file, version[0], version[1], version[2]);
       printf("\tThis version of vitunes only works with version %d.%d.%d\n",
@@ -237,47 +681,594 @@ medialib_db_load(const char *db_file)
       exit(1);
    }
 
-   /* read rest of records */
-   while (!feof(fin)) {
-      mi = mi_new();
-      mi_fread(mi, fin);
-      if (feof(fin))
-         mi_free(mi);
-      else if (ferror(fin))
-         err(1, "medialib_db_load: error loading database file '%s'", db_file);
-      else
-         playlist_files_append(mdb.library, &mi, 1, false);
+   /* since 3.3 the file ends with a checksum of the rest */
+   size = sb.st_size;
+   if (version[1] >= 3 && !savefile_verify(map, sb.st_size, &size))
+      errx(1, "medialib_db_load: db file '%s' is corrupt (bad checksum)",
+         db_file);
+
+   /*
+    * read the section sizes and make sure they all fit in the file.  the
+    * header of a file older than 3.2 ends before the stamp.
+    */
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(&hdr, map + prefix, MIN(sizeof(hdr), size - prefix));
+   if (hdr.header_size < sizeof(hdr))
+      memset((char *) &hdr + hdr.header_size, 0,
+         sizeof(hdr) - hdr.header_size);
+   need = (uint64_t) prefix + hdr.header_size
+        + (uint64_t) hdr.nrecords * hdr.record_size + hdr.heap_size;
+
+   if (hdr.header_size < offsetof(db_header, stamp) || hdr.record_size == 0
+   ||  hdr.heap_size == 0 || need > (uint64_t) size)
+      errx(1, "medialib_db_load: db file '%s' is corrupt", db_file);
+
+   table = map + prefix + hdr.header_size;
+   heap  = table + (size_t) hdr.nrecords * hdr.record_size;
+   if (heap[hdr.heap_size - 1] != '\0')
+      errx(1, "medialib_db_load: db file '%s' is corrupt", db_file);
+
+   mdb.db_map = map;
+   mdb.db_map_size = sb.st_size;
+   mdb.db_stamp = hdr.stamp;
+   mdb.next_id = hdr.next_id;
+
+   /* build a meta_info for each record, pointing into the heap */
+   nrecords = hdr.nrecords;
+   if ((records = calloc(nrecords + 1, sizeof(meta_info*))) == NULL)
+      err(1, "medialib_db_load: failed to allocate records");
+
+   for (i = 0; i < nrecords; i++) {
+      memset(&rec, 0, sizeof(rec));
+      memcpy(&rec, table + (size_t) i * hdr.record_size,
+         MIN(sizeof(rec), hdr.record_size));
+
+      if ((records[i] = db_record_map(&rec, heap, hdr.heap_size)) == NULL)
+         errx(1, "medialib_db_load: db file '%s' is corrupt (record %u)",
+            db_file, i);
    }
 
-   fclose(fin);
+sort:
+   /*
+    * sort records by filenames before adding them to the library, so the
+    * index's position hints are exact
+    */
+   qsort(records, nrecords, sizeof(meta_info*), mi_cmp_fn);
+
+   /* databases older than 3.2 have no stamp or ids yet */
+   if (mdb.db_stamp == 0) {
+      mdb.db_stamp = db_new_stamp();
+      migrated = true;
+   }
+   if (mdb.next_id == 0)
+      mdb.next_id = 1;
+   for (i = 0; i < nrecords; i++) {
+      if (records[i]->id != 0)
+         db_assign_id(records[i]);
+   }
+   for (i = 0; i < nrecords; i++) {
+      if (db_assign_id(records[i]))
+         migrated = true;
+   }
+
+   mdb.index->stamp = mdb.db_stamp;
+   libindex_reserve(mdb.index, nrecords);
+   playlist_files_append(mdb.library, records, nrecords, false);
+   free(records);
+
+   if (medialib_db_replay(db_file))
+      migrated = true;
+
+   if (migrated)
+      medialib_db_compact(db_file);
+}
+
+/* heap offset of a string being saved, 0 (empty string) for NULL or "" */
+static uint32_t
+db_heap_add(const char *s, uint64_t *heap_size)
+{
+   uint64_t offset;
+
+   if (s == NULL || s[0] == '\0')
+      return 0;
+
+   offset = *heap_size;
+   *heap_size += strlen(s) + 1;
+   if (*heap_size > UINT32_MAX)
+      errx(1, "medialib_db_save: database string heap too large");
+
+   return offset;
+}
+
+/*
+ * Table of the cinfo strings already placed in a heap being written, keyed
+ * by address.  Equal cinfo strings are the same pooled string, so this is
+ * enough to store each of them only once.
+ */
+typedef struct {
+   const char **strings;
+   uint32_t    *offsets;
+   size_t       capacity;   /* always a power of 2 */
+   size_t       nused;
+} db_heap_table;
+
+static size_t
+db_heap_slot(const db_heap_table *t, const char *s)
+{
+   size_t mask, i;
+
+   mask = t->capacity - 1;
+   i = ((uintptr_t) s >> 3) * 2654435761u;
+   for (i &= mask; t->strings[i] != NULL && t->strings[i] != s;
+        i = (i + 1) & mask)
+      ;
+   return i;
+}
+
+/* heap offset of a cinfo string being saved, adding it if it's new */
+static uint32_t
+db_heap_intern(db_heap_table *t, const char *s, uint64_t *heap_size)
+{
+   const char **strings;
+   uint32_t    *offsets;
+   size_t       capacity, i, j;
+
+   if (s == NULL || s[0] == '\0')
+      return 0;
+
+   if (t->nused * 2 >= t->capacity) {
+      strings = t->strings;
+      offsets = t->offsets;
+      capacity = t->capacity;
+
+      t->capacity = (capacity == 0 ? 1024 : capacity * 2);
+      t->strings = calloc(t->capacity, sizeof(char*));
+      t->offsets = calloc(t->capacity, sizeof(uint32_t));
+      if (t->strings == NULL || t->offsets == NULL)
+         err(1, "%s: calloc failed", __FUNCTION__);
+
+      for (i = 0; i < capacity; i++) {
+         if (strings[i] != NULL) {
+            j = db_heap_slot(t, strings[i]);
+            t->strings[j] = strings[i];
+            t->offsets[j] = offsets[i];
+         }
+      }
+      free(strings);
+      free(offsets);
+   }
+
+   i = db_heap_slot(t, s);
+   if (t->strings[i] == NULL) {
+      t->strings[i] = s;
+      t->offsets[i] = db_heap_add(s, heap_size);
+      t->nused++;
+   }
+
+   return t->offsets[i];
+}
+
+/* write a string to the heap if it belongs at offset (its first use) */
+static void
+db_heap_write(const char *s, uint32_t offset, uint64_t *written,
+   savefile *fout)
+{
+   if (s == NULL || s[0] == '\0' || offset != *written)
+      return;
+
+   savefile_write(fout, s, strlen(s) + 1);
+   *written += strlen(s) + 1;
+}
+
+/*
+ * Write the given array of records as a complete database file, with a
+ * checksum trailer.  It's written as a savefile, so a crash never leaves a
+ * partial database behind.
+ */
+static void
+medialib_db_write(const char *db_file, meta_info **files, int nfiles)
+{
+   db_heap_table  table;
+   db_header      hdr;
+   db_record     *recs;
+   meta_info     *mi;
+   savefile      *fout;
+   uint64_t       written;
+   int            version[3] = {DB_VERSION_MAJOR, DB_VERSION_MINOR, DB_VERSION_OTHER};
+   int            i, j;
+
+   if ((fout = savefile_open(db_file)) == NULL)
+      err(1, "medialib_db_save: failed to open database file '%s'", db_file);
+
+   /* lay out the record table and heap */
+   if ((recs = calloc(nfiles + 1, sizeof(db_record))) == NULL)
+      err(1, "medialib_db_save: failed to allocate record table");
+
+   /* a new database */
+   if (mdb.db_stamp == 0)
+      mdb.db_stamp = db_new_stamp();
+   if (mdb.next_id == 0)
+      mdb.next_id = 1;
+
+   memset(&table, 0, sizeof(table));
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.header_size = sizeof(db_header);
+   hdr.record_size = sizeof(db_record);
+   hdr.nrecords    = nfiles;
+   hdr.next_id     = mdb.next_id;
+   hdr.heap_size   = 1;
+   hdr.stamp       = mdb.db_stamp;
+   for (i = 0; i < nfiles; i++) {
+      mi = files[i];
+      recs[i].filename = db_heap_add(mi->filename, &hdr.heap_size);
+      for (j = 0; j < MI_NUM_CINFO; j++)
+         recs[i].cinfo[j] = db_heap_intern(&table, mi->cinfo[j], &hdr.heap_size);
+
+      recs[i].id = mi->id;
+      recs[i].track = mi->track;
+      recs[i].year = mi->year;
+      recs[i].length = mi->length;
+      recs[i].last_updated = mi->last_updated;
+      recs[i].flags = (mi->is_url ? DB_RECORD_IS_URL : 0);
+      recs[i].dev = mi->fid.dev;
+      recs[i].ino = mi->fid.ino;
+      recs[i].size = mi->fid.size;
+      recs[i].mtime = mi->fid.mtime;
+   }
+
+   /* save header & version, record table */
+   savefile_puts(fout, "vitunes");
+   savefile_write(fout, version, sizeof(version));
+   savefile_write(fout, &hdr, sizeof(hdr));
+   savefile_write(fout, recs, sizeof(db_record) * nfiles);
+
+   /* save string heap, each string where the layout above put it */
+   savefile_write(fout, "", 1);
+   written = 1;
+   for (i = 0; i < nfiles; i++) {
+      db_heap_write(files[i]->filename, recs[i].filename, &written, fout);
+      for (j = 0; j < MI_NUM_CINFO; j++)
+         db_heap_write(files[i]->cinfo[j], recs[i].cinfo[j], &written, fout);
+   }
+
+   free(recs);
+   free(table.strings);
+   free(table.offsets);
+
+   if (savefile_close(fout, true) == -1)
+      err(1, "medialib_db_save: error saving database '%s'", db_file);
+}
+
+/*
+ * Build a journal entry for a record (or, if mi is NULL, for the removal of
+ * the record with the given filename).  Returns a buffer of the entry header
+ * followed by the record and its heap, and its total size in len.
+ */
+static char *
+db_journal_encode(const char *filename, const meta_info *mi, size_t *len)
+{
+   db_journal_entry  entry;
+   db_record         rec;
+   uint64_t          heap_size;
+   char             *buf, *heap;
+   int               i;
+
+   memset(&rec, 0, sizeof(rec));
+   heap_size = 1;
+   rec.filename = db_heap_add(filename, &heap_size);
+   if (mi != NULL) {
+      for (i = 0; i < MI_NUM_CINFO; i++)
+         rec.cinfo[i] = db_heap_add(mi->cinfo[i], &heap_size);
+
+      rec.id = mi->id;
+      rec.track = mi->track;
+      rec.year = mi->year;
+      rec.length = mi->length;
+      rec.last_updated = mi->last_updated;
+      rec.flags = (mi->is_url ? DB_RECORD_IS_URL : 0);
+      rec.dev = mi->fid.dev;
+      rec.ino = mi->fid.ino;
+      rec.size = mi->fid.size;
+      rec.mtime = mi->fid.mtime;
+   }
+
+   memset(&entry, 0, sizeof(entry));
+   entry.op = (mi == NULL ? DB_JOURNAL_DEL : DB_JOURNAL_PUT);
+   entry.size = sizeof(rec) + heap_size;
+
+   *len = sizeof(entry) + entry.size;
+   if ((buf = malloc(*len)) == NULL)
+      err(1, "%s: malloc failed", __FUNCTION__);
+
+   /* fill the heap in the same order db_heap_add saw the strings */
+   heap = buf + sizeof(entry) + sizeof(rec);
+   *heap++ = '\0';
+   heap = stpcpy(heap, filename) + 1;
+   for (i = 0; mi != NULL && i < MI_NUM_CINFO; i++) {
+      if (mi->cinfo[i] != NULL && mi->cinfo[i][0] != '\0')
+         heap = stpcpy(heap, mi->cinfo[i]) + 1;
+   }
+
+   memcpy(buf + sizeof(entry), &rec, sizeof(rec));
+   entry.checksum = db_checksum(buf + sizeof(entry), entry.size);
+   memcpy(buf, &entry, sizeof(entry));
 
-   /* sort library by filenames */
-   qsort(mdb.library->files, mdb.library->nfiles, sizeof(meta_info*), mi_cmp_fn);
+   return buf;
 }
 
-/* save the library database from the global media library to disk */
+/*
+ * Save the changes made to the library since it was loaded (or last saved)
+ * by appending them to the journal.  If that would make the journal too
+ * large compared to the database, compact instead.
+ */
 void
 medialib_db_save(const char *db_file)
 {
-   FILE *fout;
-   int   version[3] = {DB_VERSION_MAJOR, DB_VERSION_MINOR, DB_VERSION_OTHER};
-   int   i;
+   db_journal_header  jhdr;
+   meta_info         *mi;
+   FILE              *fout;
+   char             **entries, *journal_file;
+   size_t            *lengths;
+   off_t              size;
+   int                version[3] = {DB_VERSION_MAJOR, DB_VERSION_MINOR,
+                                    DB_VERSION_OTHER};
+   int                fd, i;
+
+   if (mdb.ndirty == 0)
+      return;
+
+   entries = calloc(mdb.ndirty, sizeof(char*));
+   lengths = calloc(mdb.ndirty, sizeof(size_t));
+   if (entries == NULL || lengths == NULL)
+      err(1, "medialib_db_save: calloc failed");
+
+   /* a record changed several times is saved as it is now, each time */
+   size = mdb.journal_size;
+   for (i = 0; i < mdb.ndirty; i++) {
+      mi = libindex_get(mdb.index, mdb.dirty[i], NULL);
+      entries[i] = db_journal_encode(mdb.dirty[i], mi, &lengths[i]);
+      size += lengths[i];
+   }
 
-   if ((fout = fopen(db_file, "w")) == NULL)
-      err(1, "medialib_db_save: failed to open database file '%s'", db_file);
+   if (size > DB_JOURNAL_COMPACT_MIN
+   &&  (size_t) size > mdb.db_map_size / DB_JOURNAL_COMPACT_RATIO) {
+      for (i = 0; i < mdb.ndirty; i++)
+         free(entries[i]);
+      free(entries);
+      free(lengths);
+      medialib_db_compact(db_file);
+      return;
+   }
 
-   /* save header & version */
-   fwrite("vitunes", strlen("vitunes"), 1, fout);
-   fwrite(version, sizeof(version), 1, fout);
+   journal_file = db_journal_name(db_file);
+   if ((fd = open(journal_file, O_WRONLY | O_CREAT, 0666)) == -1)
+      err(1, "medialib_db_save: failed to open journal '%s'", journal_file);
+
+   /* drop anything after the last valid entry (a crash while appending) */
+   if (ftruncate(fd, mdb.journal_size) == -1
+   ||  lseek(fd, mdb.journal_size, SEEK_SET) == -1)
+      err(1, "medialib_db_save: failed to truncate journal '%s'",
+         journal_file);
+
+   if ((fout = fdopen(fd, "w")) == NULL)
+      err(1, "medialib_db_save: fdopen failed");
+
+   if (mdb.journal_size == 0) {
+      memset(&jhdr, 0, sizeof(jhdr));
+      jhdr.header_size = sizeof(db_journal_header);
+      jhdr.record_size = sizeof(db_record);
+      fwrite("vitunes", strlen("vitunes"), 1, fout);
+      fwrite(version, sizeof(version), 1, fout);
+      fwrite(&jhdr, sizeof(jhdr), 1, fout);
+      size += strlen("vitunes") + sizeof(version) + sizeof(jhdr);
+   }
 
-   /* save records */
-   for (i = 0; i < mdb.library->nfiles; i++) {
-      mi_fwrite(mdb.library->files[i], fout);
-      if (ferror(fout))
-         err(1, "medialib_db_save: error saving database");
+   for (i = 0; i < mdb.ndirty; i++) {
+      fwrite(entries[i], lengths[i], 1, fout);
+      free(entries[i]);
+      free(mdb.dirty[i]);
    }
 
+   if (fflush(fout) == EOF || ferror(fout) || fsync(fileno(fout)) == -1)
+      err(1, "medialib_db_save: error saving journal '%s'", journal_file);
+
    fclose(fout);
+   free(journal_file);
+   free(entries);
+   free(lengths);
+
+   mdb.journal_size = size;
+   mdb.ndirty = 0;
+}
+
+/*
+ * Write the whole library as the database and remove the journal.  The
+ * journal is removed only after the new database is in place, and replaying
+ * it again would change nothing, so a crash in between is harmless.
+ */
+void
+medialib_db_compact(const char *db_file)
+{
+   char *journal_file;
+   int   i;
+
+   medialib_db_write(db_file, playlist_files(mdb.library),
+      mdb.library->nfiles);
+
+   journal_file = db_journal_name(db_file);
+   if (unlink(journal_file) == -1 && errno != ENOENT)
+      err(1, "medialib_db_compact: failed to remove journal '%s'",
+         journal_file);
+   free(journal_file);
+
+   for (i = 0; i < mdb.ndirty; i++)
+      free(mdb.dirty[i]);
+
+   mdb.ndirty = 0;
+   mdb.journal_size = 0;
+}
+
+/* remember that the record with the given filename changed */
+static void
+medialib_db_dirty(const char *filename)
+{
+   if (mdb.ndirty == mdb.dirty_capacity) {
+      mdb.dirty_capacity += MEDIALIB_PLAYLISTS_CHUNK_SIZE;
+      mdb.dirty = realloc(mdb.dirty, mdb.dirty_capacity * sizeof(char*));
+      if (mdb.dirty == NULL)
+         err(1, "%s: realloc failed", __FUNCTION__);
+   }
+
+   if ((mdb.dirty[mdb.ndirty++] = strdup(filename)) == NULL)
+      err(1, "%s: strdup failed", __FUNCTION__);
+}
+
+/* keep a record no longer in the library until medialib_destroy() */
+static void
+medialib_db_orphan(meta_info *mi)
+{
+   if (mdb.norphans == mdb.orphans_capacity) {
+      mdb.orphans_capacity += MEDIALIB_PLAYLISTS_CHUNK_SIZE;
+      mdb.orphans = realloc(mdb.orphans,
+         mdb.orphans_capacity * sizeof(meta_info*));
+      if (mdb.orphans == NULL)
+         err(1, "%s: realloc failed", __FUNCTION__);
+   }
+
+   mdb.orphans[mdb.norphans++] = mi;
+}
+
+/* add a record to the end of the library */
+void
+medialib_db_add(meta_info *mi)
+{
+   db_assign_id(mi);
+   playlist_files_append(mdb.library, &mi, 1, false);
+   medialib_db_dirty(mi->filename);
+}
+
+/*
+ * replace the record at the given index of the library, and in every
+ * playlist holding it
+ */
+void
+medialib_db_replace(int index, meta_info *mi)
+{
+   meta_info *old;
+
+   if (index < 0 || index >= mdb.library->nfiles)
+      errx(1, "medialib_db_replace: index %d out of range", index);
+
+   old = playlist_file(mdb.library, index);
+   mi->id = old->id;
+   playlist_file_replace(mdb.library, index, mi);
+   playlist_refs_patch(old, mi);
+   medialib_db_orphan(old);
+   medialib_db_dirty(mi->filename);
+}
+
+/* give the record at the given index of the library the new name of its file */
+void
+medialib_db_move(int index, const char *filename, const mi_file_id *fid)
+{
+   meta_info *old, *mi;
+
+   if (index < 0 || index >= mdb.library->nfiles)
+      errx(1, "medialib_db_move: index %d out of range", index);
+
+   old = playlist_file(mdb.library, index);
+   medialib_db_dirty(old->filename);
+
+   /* the same info (the strings are pooled), but not the refs */
+   mi = mi_new();
+   memcpy(mi->cinfo, old->cinfo, sizeof(mi->cinfo));
+   mi->track = old->track;
+   mi->year = old->year;
+   mi->length = old->length;
+   mi->last_updated = old->last_updated;
+   mi->fid = *fid;
+   if ((mi->filename = strdup(filename)) == NULL)
+      err(1, "medialib_db_move: strdup failed");
+
+   medialib_db_replace(index, mi);
+}
+
+/*
+ * remove the record at the given index of the library.  playlists holding
+ * it are given a record with just the filename instead, the same as for a
+ * file not in the database when a playlist is loaded.
+ */
+void
+medialib_db_remove(int index)
+{
+   meta_info *old, *mi;
+
+   if (index < 0 || index >= mdb.library->nfiles)
+      errx(1, "medialib_db_remove: index %d out of range", index);
+
+   old = playlist_file(mdb.library, index);
+   medialib_db_dirty(old->filename);
+   playlist_files_remove(mdb.library, index, 1, false);
+
+   if (old->nrefs > 0) {
+      mi = mi_new();
+      if ((mi->filename = strdup(old->filename)) == NULL)
+         err(1, "medialib_db_remove: strdup failed");
+      playlist_refs_patch(old, mi);
+      medialib_db_orphan(mi);
+   }
+
+   medialib_db_orphan(old);
+}
+
+/*
+ * bring the record of a single file up to date, the same as -e update does
+ * for a file in the library and -e add for one that isn't: a file that is
+ * gone or has lost its meta information is removed, one modified since it
+ * was last checked is extracted again, and a new one with meta information
+ * is added.  returns which of those was done (see medialib.h).
+ */
+int
+medialib_db_check(const char *filename)
+{
+   struct stat  sb;
+   meta_info   *existing, *mi;
+   char         fullname[PATH_MAX];
+   int          idx;
+
+   /* the library has full names, but a file that's gone can't have one */
+   if (stat(filename, &sb) == -1 || !S_ISREG(sb.st_mode)
+   ||  realpath(filename, fullname) == NULL) {
+      if ((existing = libindex_get(mdb.index, filename, NULL)) == NULL)
+         return MEDIALIB_CHECK_SAME;
+
+      medialib_db_remove(playlist_find(mdb.library, filename));
+      return MEDIALIB_CHECK_REMOVED;
+   }
+
+   existing = libindex_get(mdb.index, fullname, NULL);
+   if (existing != NULL && sb.st_mtime <= existing->last_updated)
+      return MEDIALIB_CHECK_SAME;
+
+   if ((mi = mi_extract(fullname)) != NULL)
+      mi_sanitize(mi);
+
+   if (existing == NULL) {
+      if (mi == NULL)
+         return MEDIALIB_CHECK_SAME;
+
+      medialib_db_add(mi);
+      return MEDIALIB_CHECK_ADDED;
+   }
+
+   idx = playlist_find(mdb.library, fullname);
+   if (mi == NULL) {
+      medialib_db_remove(idx);
+      return MEDIALIB_CHECK_REMOVED;
+   }
+
+   medialib_db_replace(idx, mi);
+   return MEDIALIB_CHECK_UPDATED;
 }
 
 /* flush the library to stdout in a csv format */
@@ -301,12 +1292,12 @@ medialib_db_flush(FILE *fout, const char *timefmt)
    for (f = 0; f < mdb.library->nfiles; f++) {
 
       /* get record */
-      mi = mdb.library->files[f];
+      mi = playlist_file(mdb.library, f);
 
       /* output record */
       fprintf(fout, "%s, ", mi->filename);
       for (i = 0; i < MI_NUM_CINFO; i++)
-         fprintf(fout, "\"%s\", ", mi->cinfo[i]);
+         fprintf(fout, "\"%s\", ", mi_cinfo(mi, i));
 
       /* convert last-updated time to string */
       ltime = localtime(&(mi->last_updated));
@@ -320,129 +1311,779 @@ medialib_db_flush(FILE *fout, const char *timefmt)
 }
 
 /*
- * AFTER loading the global media library using medialib_load(), this function
- * is used to re-scan all files that exist in the database and re-check their
- * meta_info.  Any files that no longer exist are removed, and any meta
- * information that has changed is updated.
+ * A unit of work for the worker threads used by medialib_db_update() and
+ * medialib_db_scan_dirs().  Everything the main thread prints for a file (or
+ * directory) goes through one of these, so output stays in walk order no
+ * matter which worker finishes first.
  *
- * The database is then re-saved to disk.
+ * Jobs are handled in batches of MEDIALIB_BATCH_SIZE, so that the disk can be
+ * read in an order that suits it rather than the library's.  The files of a
+ * batch are stat(2)'d in the order of their paths, keeping the files of a
+ * directory together, and then extracted in the order of their device and
+ * inode, which is roughly their order on disk.  One batch is extracted while
+ * the next is stat(2)'d (or walked), and then merged in its original order.
  */
-void
-medialib_db_update(bool show_skipped)
+typedef struct {
+   int          type;       /* FTS_* type of the entry (scan only) */
+   char        *path;       /* path as given/found, used for output */
+   char        *fullname;   /* realpath(3) of path (scan only) */
+   time_t       mtime;      /* modification time of the file */
+   mi_file_id   fid;        /* the file (its inode orders extraction) */
+   meta_info   *moved;      /* record the file was moved from (scan only) */
+   time_t       last_updated;  /* of the existing record (update only) */
+   int          pos;        /* position in library when queued (update only) */
+   bool         stat_file;  /* stat(2) the file first (update only) */
+   bool         extract;    /* run mi_extract() on the file */
+   bool         extracted;  /* if mi below is valid */
+   int          stat_errno; /* errno from stat(2), 0 if it succeeded */
+   meta_info   *mi;         /* result of mi_extract() + mi_sanitize() */
+   int          length;     /* play-length found (properties only) */
+} medialib_job;
+
+static medialib_job *
+medialib_job_new(int type, const char *path)
 {
-   meta_info *mi;
-   struct stat sb;
-   char  *filename;
-   int    i;
+   medialib_job *job;
 
-   /* stat counters */
-   int    count_removed_file_gone = 0;
-   int    count_removed_meta_gone = 0;
-   int    count_skipped_not_updated = 0;
-   int    count_updated = 0;
-   int    count_errors = 0;
-   int    count_urls = 0;
+   if ((job = calloc(1, sizeof(medialib_job))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
 
-   for (i = 0; i < mdb.library->nfiles; i++) {
+   job->type = type;
+   if ((job->path = strdup(path)) == NULL)
+      err(1, "%s: strdup(3) failed", __FUNCTION__);
 
-      filename = mdb.library->files[i]->filename;
+   return job;
+}
 
-      /* skip url's */
-      if (mdb.library->files[i]->is_url) {
-         printf("s %s\n", filename);
-         count_urls++;
-         continue;
-      }
+static void
+medialib_job_free(medialib_job *job)
+{
+   free(job->path);
+   free(job->fullname);
+   free(job);
+}
 
-      if (stat(filename, &sb) == -1) {
+/* stat a job's file, asking for just what's used if statx(2) is around */
+static int
+medialib_job_statx(medialib_job *job)
+{
+   struct stat   sb;
+#ifdef STATX_INO
+   struct statx  stx;
+
+   if (statx(AT_FDCWD, job->path, 0,
+         STATX_TYPE | STATX_MTIME | STATX_INO | STATX_SIZE, &stx) == 0) {
+      job->mtime = stx.stx_mtime.tv_sec;
+      job->fid.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+      job->fid.ino = stx.stx_ino;
+      job->fid.size = stx.stx_size;
+      job->fid.mtime = stx.stx_mtime.tv_sec;
+      return 0;
+   }
+   if (errno != ENOSYS)
+      return -1;
+#endif
 
-         /* file was removed -or- stat() failed */
+   if (stat(job->path, &sb) == -1)
+      return -1;
 
-         if (errno == ENOENT) {
-            /* file was removed, remove from library */
-            playlist_files_remove(mdb.library, i, 1, false);
-            i--;  /* since removed a file, we want to decrement i */
-            printf("x %s\n", filename);
-            count_removed_file_gone++;
-         } else {
-            /* stat() failed for some reason - unknown error */
-            printf("? %s\n", filename);
-            count_errors++;
-         }
+   job->mtime = sb.st_mtime;
+   mi_file_id_set(&job->fid, &sb);
+   return 0;
+}
+
+/* run on the stat(2) workers: see if the job's file needs extracting */
+static void
+medialib_job_stat(void *arg)
+{
+   medialib_job *job = arg;
+
+   if (medialib_job_statx(job) == -1) {
+      job->stat_errno = errno;
+      return;
+   }
+
+   job->extract = (job->mtime > job->last_updated);
+}
+
+/* run on the extraction workers: extract the job's file */
+static void
+medialib_job_extract(void *arg)
+{
+   medialib_job *job = arg;
+
+   job->mi = mi_extract(job->path);
+   if (job->mi != NULL)
+      mi_sanitize(job->mi);
+   job->extracted = true;
+}
+
+static int
+medialib_job_pathcmp(const void *a, const void *b)
+{
+   return strcmp((*(medialib_job * const *) a)->path,
+                 (*(medialib_job * const *) b)->path);
+}
+
+static int
+medialib_job_inocmp(const void *a, const void *b)
+{
+   const medialib_job *ja = *(medialib_job * const *) a;
+   const medialib_job *jb = *(medialib_job * const *) b;
+
+   if (ja->fid.dev != jb->fid.dev)
+      return (ja->fid.dev < jb->fid.dev) ? -1 : 1;
+   if (ja->fid.ino != jb->fid.ino)
+      return (ja->fid.ino < jb->fid.ino) ? -1 : 1;
+   return 0;
+}
+
+/* the jobs of a batch, in the order they are merged */
+typedef struct {
+   medialib_job  *jobs[MEDIALIB_BATCH_SIZE];
+   int            njobs;
+} medialib_batch;
+
+static medialib_batch *
+medialib_batch_new(void)
+{
+   medialib_batch *b;
+
+   if ((b = calloc(1, sizeof(medialib_batch))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   return b;
+}
+
+/* stat(2) the files of a batch (update only) in path order, and wait */
+static void
+medialib_batch_stat(workq *q, medialib_batch *b)
+{
+   medialib_job *order[MEDIALIB_BATCH_SIZE];
+   int           i, n;
+
+   for (i = 0, n = 0; i < b->njobs; i++) {
+      if (b->jobs[i]->stat_file)
+         order[n++] = b->jobs[i];
+   }
+   qsort(order, n, sizeof(medialib_job*), medialib_job_pathcmp);
+
+   for (i = 0; i < n; i++)
+      workq_submit(q, order[i]);
+   while (workq_next(q) != NULL)
+      continue;
+}
+
+/*
+ * start extracting the files of a batch that need it, in device and inode
+ * order.  the queue holds a whole batch, so this doesn't wait for any.
+ */
+static void
+medialib_batch_extract(workq *q, medialib_batch *b)
+{
+   medialib_job *order[MEDIALIB_BATCH_SIZE];
+   int           i, n;
+
+   for (i = 0, n = 0; i < b->njobs; i++) {
+      if (b->jobs[i]->extract)
+         order[n++] = b->jobs[i];
+   }
+   qsort(order, n, sizeof(medialib_job*), medialib_job_inocmp);
+
+   for (i = 0; i < n; i++)
+      workq_submit(q, order[i]);
+}
+
+/* make sure a job's file has been extracted (on the main thread if not) */
+static meta_info *
+medialib_job_mi(medialib_job *job)
+{
+   if (!job->extracted)
+      medialib_job_extract(job);
+
+   return job->mi;
+}
+
+/*
+ * note which file an unchanged record is for, if that changed (or, for a
+ * record from before 3.4, wasn't known)
+ */
+static void
+medialib_db_identify(meta_info *mi, const mi_file_id *fid)
+{
+   if (!mi_file_id_equal(&mi->fid, fid)) {
+      mi->fid = *fid;
+      medialib_db_dirty(mi->filename);
+   }
+}
+
+/* counters for the summary output of medialib_db_update() */
+typedef struct {
+   int   removed_file_gone;
+   int   removed_meta_gone;
+   int   skipped_not_updated;
+   int   updated;
+   int   errors;
+   int   urls;
+   int   nremoved;   /* records removed so far, to find queued positions */
+} medialib_update_counts;
+
+/* merge one finished job of medialib_db_update() into the library */
+static void
+medialib_update_merge(medialib_job *job, bool show_skipped,
+   medialib_update_counts *c)
+{
+   int idx;
+
+   /* every removal so far was of a record queued before this one */
+   idx = job->pos - c->nremoved;
+
+   if (!job->stat_file) {
+      /* skip url's */
+      printf("s %s\n", job->path);
+      c->urls++;
 
+   } else if (job->stat_errno != 0) {
+
+      /* file was removed -or- stat() failed */
+
+      if (job->stat_errno == ENOENT) {
+         /* file was removed, remove from library */
+         medialib_db_remove(idx);
+         c->nremoved++;
+         printf("x %s\n", job->path);
+         c->removed_file_gone++;
       } else {
+         /* stat() failed for some reason - unknown error */
+         printf("? %s\n", job->path);
+         c->errors++;
+      }
 
-         /*
-          * file still exists... check if it has been modified since we
-          * last extracted meta-info from it (otherwise we ignore)
-          */
+   } else if (job->extract) {
 
-         if (sb.st_mtime > mdb.library->files[i]->last_updated) {
+      /*
+       * file still exists and has been modified since we last extracted
+       * meta-info from it
+       */
 
-            mi = mi_extract(filename);
-            if (mi == NULL) {
-               /* file now has no meta-info, remove from library */
-               playlist_files_remove(mdb.library, i, 1, false);
-               i--;  /* since removed a file, we want to decrement i */
-               printf("- %s\n", filename);
-               count_removed_meta_gone++;
-            } else {
-               /* file's meta-info has changed, update it */
-               mi_sanitize(mi);
-               playlist_file_replace(mdb.library, i, mi);
-               printf("u %s\n", filename);
-               count_updated++;
-            }
-         } else {
-            count_skipped_not_updated++;
-            if (show_skipped)
-               printf(". %s\n", filename);
-         }
+      if (job->mi == NULL) {
+         /* file now has no meta-info, remove from library */
+         medialib_db_remove(idx);
+         c->nremoved++;
+         printf("- %s\n", job->path);
+         c->removed_meta_gone++;
+      } else {
+         /* file's meta-info has changed, update it */
+         medialib_db_replace(idx, job->mi);
+         printf("u %s\n", job->path);
+         c->updated++;
+      }
+
+   } else {
+      medialib_db_identify(playlist_file(mdb.library, idx), &job->fid);
+      c->skipped_not_updated++;
+      if (show_skipped)
+         printf(". %s\n", job->path);
+   }
 
+   medialib_job_free(job);
+}
+
+/*
+ * AFTER loading the global media library using medialib_load(), this function
+ * is used to re-scan all files that exist in the database and re-check their
+ * meta_info.  Any files that no longer exist are removed, and any meta
+ * information that has changed is updated.
+ *
+ * The files are stat(2)'d by at least MEDIALIB_STAT_THREADS threads, and
+ * extracted by nthreads, a batch at a time (see medialib_job), while the
+ * results are applied (and output) in library order.
+ *
+ * The database is then re-saved to disk.
+ */
+void
+medialib_db_update(bool show_skipped, int nthreads)
+{
+   medialib_update_counts counts;
+   medialib_batch *cur, *prev, *tmp;
+   medialib_job   *job;
+   meta_info      *mi;
+   workq          *statq, *extq;
+   int             i, j, nfiles, nstat;
+
+   memset(&counts, 0, sizeof(counts));
+   nstat = MAX(nthreads, MEDIALIB_STAT_THREADS);
+   statq = workq_new(nstat, nstat * MEDIALIB_JOBS_PER_THREAD,
+      medialib_job_stat);
+   extq = workq_new(nthreads, MEDIALIB_BATCH_SIZE, medialib_job_extract);
+   cur = medialib_batch_new();
+   prev = medialib_batch_new();
+
+   /*
+    * records are only removed/replaced when jobs are merged, which is always
+    * of batches before the one being filled, so the positions below are
+    * right.  the records are never freed, so the filenames stay valid.
+    */
+   nfiles = mdb.library->nfiles;
+   for (i = 0; i < nfiles || prev->njobs > 0; i++) {
+      if (i < nfiles) {
+         mi = playlist_file(mdb.library, i - counts.nremoved);
+
+         job = medialib_job_new(0, mi->filename);
+         job->pos = i;
+         job->last_updated = mi->last_updated;
+         job->stat_file = !mi->is_url;
+         cur->jobs[cur->njobs++] = job;
+
+         if (cur->njobs < MEDIALIB_BATCH_SIZE && i < nfiles - 1)
+            continue;
       }
+
+      /* stat this batch while the last one is extracted, then merge that */
+      medialib_batch_stat(statq, cur);
+      while (workq_next(extq) != NULL)
+         continue;
+      for (j = 0; j < prev->njobs; j++)
+         medialib_update_merge(prev->jobs[j], show_skipped, &counts);
+      prev->njobs = 0;
+
+      medialib_batch_extract(extq, cur);
+      tmp = prev;
+      prev = cur;
+      cur = tmp;
    }
 
+   workq_free(statq);
+   workq_free(extq);
+   free(cur);
+   free(prev);
+
    /* save to file */
    medialib_db_save(mdb.db_file);
 
    /* output some of our stats */
    printf("--------------------------------------------------\n");
    printf("Results of updating database...\n");
-   printf("(s) %9d url's skipped\n", count_urls);
-   printf("(u) %9d files updated\n", count_updated);
+   printf("(s) %9d url's skipped\n", counts.urls);
+   printf("(u) %9d files updated\n", counts.updated);
    printf("(x) %9d files removed (file no longer exists)\n",
-      count_removed_file_gone);
+      counts.removed_file_gone);
    printf("(-) %9d files removed (meta-info gone)\n",
-      count_removed_meta_gone);
+      counts.removed_meta_gone);
    printf("(.) %9d files skipped (file unchanged since last checked)\n",
-      count_skipped_not_updated);
+      counts.skipped_not_updated);
    printf("(?) %9d files with errors (couldn't stat, but kept)\n",
-      count_errors);
+      counts.errors);
+}
+
+/* how medialib_db_properties() finds the length of a file */
+static int (*medialib_length_fn)(const char *);
+
+/* run on the workers of medialib_db_properties(): find a file's length */
+static void
+medialib_job_length(void *arg)
+{
+   medialib_job *job = arg;
+
+   job->length = medialib_length_fn(job->path);
+}
+
+/* counters for the summary output of medialib_db_properties() */
+typedef struct {
+   int   found;
+   int   errors;
+} medialib_properties_counts;
+
+/* merge one finished job of medialib_db_properties() into the library */
+static void
+medialib_properties_merge(medialib_job *job, medialib_properties_counts *c)
+{
+   meta_info *mi;
+
+   if (job->length > 0) {
+      mi = playlist_file(mdb.library, job->pos);
+      mi->length = job->length;
+      medialib_db_dirty(mi->filename);
+      printf("l %s\n", job->path);
+      c->found++;
+   } else {
+      printf("? %s\n", job->path);
+      c->errors++;
+   }
+
+   medialib_job_free(job);
 }
 
 /*
  * AFTER loading the global media library using medialib_load(), this function
- * will scan the list of directories specified in the parameter and
+ * finds the play-length of the files in the database that have none, with the
+ * given function (run by nthreads threads), and re-saves the database.
  */
 void
-medialib_db_scan_dirs(char *dirlist[])
+medialib_db_properties(int nthreads, int (*length)(const char *))
+{
+   medialib_properties_counts counts;
+   medialib_job   *job;
+   meta_info      *mi;
+   workq          *q;
+   int             i;
+
+   memset(&counts, 0, sizeof(counts));
+   medialib_length_fn = length;
+   q = workq_new(nthreads, nthreads * MEDIALIB_JOBS_PER_THREAD,
+      medialib_job_length);
+
+   /* no records are added or removed, so the positions stay right */
+   for (i = 0; i < mdb.library->nfiles; i++) {
+      mi = playlist_file(mdb.library, i);
+      if (mi->is_url || mi->length > 0)
+         continue;
+
+      job = medialib_job_new(0, mi->filename);
+      job->pos = i;
+      if ((job = workq_submit(q, job)) != NULL)
+         medialib_properties_merge(job, &counts);
+   }
+   while ((job = workq_next(q)) != NULL)
+      medialib_properties_merge(job, &counts);
+
+   workq_free(q);
+
+   /* save to file */
+   medialib_db_save(mdb.db_file);
+
+   /* output some of our stats */
+   printf("--------------------------------------------------\n");
+   printf("Results of finding play-lengths...\n");
+   printf("(l) %9d files with a play-length found\n", counts.found);
+   printf("(?) %9d files with errors (play-length still unknown)\n",
+      counts.errors);
+}
+
+/* counters for the summary output of medialib_db_scan_dirs() */
+typedef struct {
+   int   removed_lost_info;
+   int   updated;
+   int   skipped_no_info;
+   int   skipped_dir;
+   int   skipped_error;
+   int   skipped_not_updated;
+   int   skipped_unchanged;   /* directories, see dirtab.h */
+   int   added;
+   int   moved;
+   int   playlists;           /* rewritten for files moved */
+} medialib_scan_counts;
+
+/*
+ * the records of the library by the device and inode of their files, built
+ * when medialib_db_scan_dirs() first finds a new file, to see if it's one
+ * that was moved
+ */
+typedef struct {
+   meta_info  **files;
+   int          nfiles;
+   bool         built;
+} medialib_scan_fids;
+
+static int
+medialib_fid_cmp(const void *a, const void *b)
+{
+   const mi_file_id *fa = &(*(meta_info * const *) a)->fid;
+   const mi_file_id *fb = &(*(meta_info * const *) b)->fid;
+
+   if (fa->dev != fb->dev)
+      return (fa->dev < fb->dev) ? -1 : 1;
+   if (fa->ino != fb->ino)
+      return (fa->ino < fb->ino) ? -1 : 1;
+   return 0;
+}
+
+/*
+ * the record a new file was moved from: one for the same file (the same
+ * inode, size, and mtime), which is no longer where the record has it
+ */
+static meta_info *
+medialib_scan_moved(medialib_scan_fids *f, const mi_file_id *fid)
+{
+   meta_info    key, *keyp, **found, *mi;
+   struct stat  sb;
+   int          i;
+
+   if (fid->ino == 0)
+      return NULL;
+
+   if (!f->built) {
+      f->files = calloc(mdb.library->nfiles + 1, sizeof(meta_info*));
+      if (f->files == NULL)
+         err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+      for (i = 0; i < mdb.library->nfiles; i++) {
+         mi = playlist_file(mdb.library, i);
+         if (!mi->is_url && mi->fid.ino != 0)
+            f->files[f->nfiles++] = mi;
+      }
+      qsort(f->files, f->nfiles, sizeof(meta_info*), medialib_fid_cmp);
+      f->built = true;
+   }
+
+   key.fid = *fid;
+   keyp = &key;
+   found = bsearch(&keyp, f->files, f->nfiles, sizeof(meta_info*),
+      medialib_fid_cmp);
+   if (found == NULL || !mi_file_id_equal(&(*found)->fid, fid))
+      return NULL;
+
+   if (stat((*found)->filename, &sb) == 0
+   ||  (errno != ENOENT && errno != ENOTDIR))
+      return NULL;
+
+   return *found;
+}
+
+/*
+ * what medialib_db_scan_dirs() knows about a directory it's walking (hung on
+ * its fts_pointer), to record it in the directory table once it's done
+ */
+typedef struct {
+   char     *path;       /* realpath(3) as walked, NULL if unknown */
+   time_t    mtime;
+   uint32_t  nnames;
+   uint64_t  hash;
+   bool      complete;   /* everything below was walked without errors */
+} medialib_scan_dir;
+
+static medialib_scan_dir *
+medialib_scan_dir_new(FTSENT *ftsent)
+{
+   medialib_scan_dir *d, *parent;
+   char               fullname[PATH_MAX];
+
+   if ((d = calloc(1, sizeof(medialib_scan_dir))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   d->mtime = ftsent->fts_statp->st_mtime;
+   d->complete = true;
+
+   /* below the roots, paths are built from the names walked through */
+   if (ftsent->fts_level == FTS_ROOTLEVEL) {
+      if (realpath(ftsent->fts_accpath, fullname) != NULL
+      &&  (d->path = strdup(fullname)) == NULL)
+         err(1, "%s: strdup(3) failed", __FUNCTION__);
+   } else {
+      parent = ftsent->fts_parent->fts_pointer;
+      if (parent != NULL && parent->path != NULL
+      &&  asprintf(&d->path, "%s/%s", parent->path, ftsent->fts_name) == -1)
+         errx(1, "%s: asprintf failed", __FUNCTION__);
+   }
+
+   return d;
+}
+
+/* a directory couldn't be walked completely, nor the ones above it */
+static void
+medialib_scan_dir_incomplete(FTSENT *ftsent)
+{
+   medialib_scan_dir *d;
+
+   if (ftsent->fts_level > FTS_ROOTLEVEL
+   &&  (d = ftsent->fts_parent->fts_pointer) != NULL)
+      d->complete = false;
+}
+
+/* done with a directory: record or forget it in the directory table */
+static void
+medialib_scan_dir_done(FTSENT *ftsent, dirtab *dirs)
+{
+   medialib_scan_dir *d;
+
+   if ((d = ftsent->fts_pointer) == NULL)
+      return;
+
+   if (d->path != NULL) {
+      if (d->complete)
+         dirtab_put(dirs, d->path, d->mtime, d->nnames, d->hash);
+      else
+         dirtab_forget(dirs, d->path);
+   }
+
+   if (!d->complete)
+      medialib_scan_dir_incomplete(ftsent);
+
+   ftsent->fts_pointer = NULL;
+   free(d->path);
+   free(d);
+}
+
+/*
+ * merge one finished job of medialib_db_scan_dirs() into the library.  what
+ * to do with a file is decided here (again), against the library as it is
+ * now, since a file reached twice (through a symlink) may have been added
+ * by an earlier job.
+ */
+static void
+medialib_scan_merge(medialib_job *job, medialib_scan_counts *c)
 {
-   FTS        *fts;
-   FTSENT     *ftsent;
-   meta_info  *mi;
-   char        fullname[PATH_MAX];
-   int         i, idx;
+   meta_info *existing, *mi;
+   int        idx;
+
+   switch (job->type) {
+      case FTS_D:    /* TYPE: directory (going in) */
+         printf("Checking Directory: %s\n", job->path);
+         break;
+
+      case FTS_DNR:  /* TYPE: unreadable directory */
+         printf("Directory '%s' Unreadable\n", job->path);
+         c->skipped_dir++;
+         break;
+
+      case FTS_NS:   /* TYPE: file/dir that couldn't be stat(2) */
+      case FTS_ERR:  /* TYPE: other error */
+         printf("? %s\n", job->path);
+         c->skipped_error++;
+         break;
+
+      case FTS_F:    /* TYPE: regular file */
+
+         /* check if the file already exists in the db */
+         existing = libindex_get(mdb.index, job->fullname, NULL);
+
+         /* moved from where a record has it (if that's still so) */
+         if (existing == NULL && job->moved != NULL
+         &&  libindex_get(mdb.index, job->moved->filename, NULL)
+             == job->moved) {
+            idx = playlist_find(mdb.library, job->moved->filename);
+            medialib_db_move(idx, job->fullname, &job->fid);
+            printf("m %s\n", job->path);
+            c->moved++;
+            break;
+         }
+
+         if (existing != NULL) {
+            /* file already exists in library database - update */
+
+            if (job->mtime > existing->last_updated) {
+
+               /* file has been modified since we last extracted info */
+
+               idx = playlist_find(mdb.library, job->fullname);
+               mi = medialib_job_mi(job);
+
+               if (mi == NULL) {
+                  /* file now has no meta-info, remove from library */
+                  medialib_db_remove(idx);
+                  printf("- %s\n", job->path);
+                  c->removed_lost_info++;
+               } else {
+                  /* file's meta-info has changed, update it */
+                  medialib_db_replace(idx, mi);
+                  printf("u %s\n", job->path);
+                  c->updated++;
+               }
+            } else {
+               if (job->mi != NULL)
+                  mi_free(job->mi);
+               medialib_db_identify(existing, &job->fid);
+               printf(". %s\n", job->path);
+               c->skipped_not_updated++;
+            }
+
+         } else {
+
+            /* file does NOT exists in library database - add it */
 
-   /* stat counters */
-   int         count_removed_lost_info = 0;
-   int         count_updated = 0;
-   int         count_skipped_no_info = 0;
-   int         count_skipped_dir = 0;
-   int         count_skipped_error = 0;
-   int         count_skipped_not_updated = 0;
-   int         count_added = 0;
+            mi = medialib_job_mi(job);
 
+            if (mi == NULL) {
+               /* file has no info */
+               printf("s %s\n", job->path);
+               c->skipped_no_info++;
+            } else {
+               /* file does have info, add it to library */
+               medialib_db_add(mi);
+               printf("+ %s\n", job->path);
+               c->added++;
+            }
+         }
+         break;
+   }
+
+   medialib_job_free(job);
+}
+
+/*
+ * merge the batch of medialib_db_scan_dirs() before the one just walked, once
+ * it's extracted, and start extracting the one just walked
+ */
+static void
+medialib_scan_batch(workq *q, medialib_batch **cur, medialib_batch **prev,
+   medialib_scan_counts *c)
+{
+   medialib_batch *tmp;
+   int             i;
+
+   while (workq_next(q) != NULL)
+      continue;
+   for (i = 0; i < (*prev)->njobs; i++)
+      medialib_scan_merge((*prev)->jobs[i], c);
+   (*prev)->njobs = 0;
+
+   medialib_batch_extract(q, *cur);
+   tmp = *prev;
+   *prev = *cur;
+   *cur = tmp;
+}
+
+/*
+ * AFTER loading the global media library using medialib_load(), this function
+ * will scan the list of directories specified in the parameter and add any
+ * new files found to the database, and update any that have changed.
+ *
+ * Unless a full scan is asked for, directories the directory table (see
+ * dirtab.h) has unchanged since they were last scanned, along with all below
+ * them, are skipped without reading them or stat(2)'ing their files.
+ *
+ * The walk is done here while nthreads worker threads extract the meta
+ * information of the files found, a batch at a time (see medialib_job).  The
+ * results are applied (and output) in the order the walk found them.
+ */
+void
+medialib_db_scan_dirs(char *dirlist[], int nthreads, bool full)
+{
+   medialib_scan_counts counts;
+   medialib_scan_fids fids;
+   medialib_scan_dir *d;
+   medialib_batch *cur, *prev;
+   playlist       *p;
+   medialib_job   *job;
+   meta_info      *existing;
+   dirtab         *dirs;
+   workq          *q;
+   FTS            *fts;
+   FTSENT         *ftsent, *child;
+   char            fullname[PATH_MAX], *dirs_file, **roots;
+   int             i, nroots;
+
+   memset(&counts, 0, sizeof(counts));
+   memset(&fids, 0, sizeof(fids));
+
+   /* see which of the directories known below the roots have changed */
+   dirs_file = db_dirs_name(mdb.db_file);
+   dirs = dirtab_load(dirs_file, mdb.db_stamp);
+
+   for (nroots = 0; dirlist[nroots] != NULL; nroots++)
+      continue;
+   if ((roots = calloc(nroots + 1, sizeof(char*))) == NULL)
+      err(1, "medialib_db_scan_dirs: calloc(3) failed");
+   for (i = 0, nroots = 0; dirlist[i] != NULL; i++) {
+      if (realpath(dirlist[i], fullname) != NULL
+      &&  (roots[nroots++] = strdup(fullname)) == NULL)
+         err(1, "medialib_db_scan_dirs: strdup(3) failed");
+   }
+   dirtab_check(dirs, roots, nroots, MAX(nthreads, MEDIALIB_STAT_THREADS));
 
+   q = workq_new(nthreads, MEDIALIB_BATCH_SIZE, medialib_job_extract);
+   cur = medialib_batch_new();
+   prev = medialib_batch_new();
 
    fts = fts_open(dirlist, FTS_LOGICAL | FTS_NOCHDIR, NULL);
    if (fts == NULL)
@@ -452,21 +2093,49 @@ medialib_db_scan_dirs(char *dirlist[])
 
       switch (ftsent->fts_info) {   /* file type */
          case FTS_D:    /* TYPE: directory (going in) */
-            printf("Checking Directory: %s\n", ftsent->fts_path);
+            d = medialib_scan_dir_new(ftsent);
+            ftsent->fts_pointer = d;
+
+            if (!full && d->path != NULL
+            &&  dirtab_unchanged(dirs, d->path)) {
+               /* fts_read() won't come out of it (FTS_DP), so free d now */
+               fts_set(fts, ftsent, FTS_SKIP);
+               ftsent->fts_pointer = NULL;
+               free(d->path);
+               free(d);
+               counts.skipped_unchanged++;
+               continue;
+            }
+
+            /* sign the names in it (fts_read() reuses what's read here) */
+            errno = 0;
+            child = fts_children(fts, 0);
+            if (child == NULL && errno != 0)
+               d->complete = false;
+            for (; child != NULL; child = child->fts_link) {
+               d->hash += dirtab_hash(child->fts_name);
+               d->nnames++;
+            }
+
+            job = medialib_job_new(FTS_D, ftsent->fts_path);
             break;
 
          case FTS_DP:   /* TYPE: directory (coming out) */
-            break;
+            medialib_scan_dir_done(ftsent, dirs);
+            continue;
 
          case FTS_DNR:  /* TYPE: unreadable directory */
-            printf("Directory '%s' Unreadable\n", ftsent->fts_accpath);
-            count_skipped_dir++;
+            if (ftsent->fts_pointer != NULL)   /* failed after FTS_D */
+               medialib_scan_dir_done(ftsent, dirs);
+            else
+               medialib_scan_dir_incomplete(ftsent);
+            job = medialib_job_new(FTS_DNR, ftsent->fts_accpath);
             break;
 
          case FTS_NS:   /* TYPE: file/dir that couldn't be stat(2) */
          case FTS_ERR:  /* TYPE: other error */
-            printf("? %s\n", ftsent->fts_path);
-            count_skipped_error++;
+            medialib_scan_dir_incomplete(ftsent);
+            job = medialib_job_new(FTS_ERR, ftsent->fts_path);
             break;
 
          case FTS_F:    /* TYPE: regular file */
@@ -477,77 +2146,80 @@ medialib_db_scan_dirs(char *dirlist[])
                   ftsent->fts_accpath);
             }
 
-            /* check if the file already exists in the db */
-            idx = -1;
-            for (i = 0; i < mdb.library->nfiles; i++) {
-               if (strcmp(fullname, mdb.library->files[i]->filename) == 0)
-                  idx = i;
-            }
-
-            if (idx != -1) {
-               /* file already exists in library database - update */
-
-               if (ftsent->fts_statp->st_mtime >
-                   mdb.library->files[idx]->last_updated) {
-
-                  /* file has been modified since we last extracted info */
+            job = medialib_job_new(FTS_F, ftsent->fts_accpath);
+            if ((job->fullname = strdup(fullname)) == NULL)
+               err(1, "medialib_db_scan_dirs: strdup(3) failed");
+
+            /*
+             * only extract if new (and not just moved), or modified since
+             * we last extracted
+             */
+            job->mtime = ftsent->fts_statp->st_mtime;
+            mi_file_id_set(&job->fid, ftsent->fts_statp);
+            existing = libindex_get(mdb.index, fullname, NULL);
+            if (existing == NULL)
+               job->moved = medialib_scan_moved(&fids, &job->fid);
+            job->extract = (existing == NULL && job->moved == NULL)
+                        || (existing != NULL
+                           && job->mtime > existing->last_updated);
+            break;
 
-                  mi = mi_extract(ftsent->fts_accpath);
+         default:
+            continue;
+      }
 
-                  if (mi == NULL) {
-                     /* file now has no meta-info, remove from library */
-                     playlist_files_remove(mdb.library, idx, 1, false);
-                     printf("- %s\n", ftsent->fts_accpath);
-                     count_removed_lost_info++;
-                  } else {
-                     /* file's meta-info has changed, update it */
-                     mi_sanitize(mi);
-                     playlist_file_replace(mdb.library, idx, mi);
-                     printf("u %s\n", ftsent->fts_accpath);
-                     count_updated++;
-                  }
-               } else {
-                  printf(". %s\n", ftsent->fts_accpath);
-                  count_skipped_not_updated++;
-               }
+      cur->jobs[cur->njobs++] = job;
+      if (cur->njobs == MEDIALIB_BATCH_SIZE)
+         medialib_scan_batch(q, &cur, &prev, &counts);
+   }
 
-            } else {
+   if (fts_close(fts) == -1)
+      err(1, "medialib_db_scan_dirs: failed to close file heirarchy");
 
-               /* file does NOT exists in library database - add it */
+   /* the last batch, and then merge it */
+   medialib_scan_batch(q, &cur, &prev, &counts);
+   medialib_scan_batch(q, &cur, &prev, &counts);
 
-               mi = mi_extract(ftsent->fts_accpath);
+   workq_free(q);
+   free(cur);
+   free(prev);
 
-               if (mi == NULL) {
-                  /* file has no info */
-                  printf("s %s\n", ftsent->fts_accpath);
-                  count_skipped_no_info++;
-               } else {
-                  /* file does have info, add it to library */
-                  mi_sanitize(mi);
-                  playlist_files_append(mdb.library, &mi, 1, false);
-                  printf("+ %s\n", ftsent->fts_accpath);
-                  count_added++;
-               }
-            }
+   /* save to file, and only then what was scanned */
+   medialib_db_save(mdb.db_file);
+   if (dirtab_save(dirs, dirs_file) == -1)
+      warn("failed to save directory table '%s'", dirs_file);
+
+   /* and the playlists with files that moved */
+   for (i = 0; i < mdb.nplaylists; i++) {
+      p = mdb.playlists[i];
+      if (p->needs_saving && p != mdb.library && p != mdb.filter_results) {
+         playlist_save(p, mdb.index);
+         p->needs_saving = false;
+         counts.playlists++;
       }
    }
 
-   if (fts_close(fts) == -1)
-      err(1, "medialib_db_scan_dirs: failed to close file heirarchy");
-
-   /* save to file */
-   medialib_db_save(mdb.db_file);
+   free(fids.files);
+   dirtab_free(dirs);
+   free(dirs_file);
+   for (i = 0; i < nroots; i++)
+      free(roots[i]);
+   free(roots);
 
    /* output some of our stats */
    printf("--------------------------------------------------\n");
    printf("Results of scanning directories...\n");
-   printf("(+) %9d files added\n", count_added);
-   printf("(u) %9d files updated\n", count_updated);
+   printf("(+) %9d files added\n", counts.added);
+   printf("(u) %9d files updated\n", counts.updated);
+   printf("(m) %9d files moved (meta-info kept, %d playlists rewritten)\n",
+      counts.moved, counts.playlists);
    printf("(-) %9d files removed (was in DB, but no longer has meta-info)\n",
-      count_removed_lost_info);
+      counts.removed_lost_info);
    printf("(.) %9d files skipped (in DB, file unchanged since last checked)\n",
-      count_skipped_not_updated);
-   printf("(s) %9d files skipped (no info)\n", count_skipped_no_info);
-   printf("(?) %9d files skipped (other error)\n", count_skipped_error);
-   printf("    %9d directories skipped (couldn't read)\n", count_skipped_dir);
+      counts.skipped_not_updated);
+   printf("(s) %9d files skipped (no info)\n", counts.skipped_no_info);
+   printf("(?) %9d files skipped (other error)\n", counts.skipped_error);
+   printf("    %9d directories skipped (couldn't read)\n", counts.skipped_dir);
+   printf("    %9d directories skipped (unchanged since last scanned)\n",
+      counts.skipped_unchanged);
 }
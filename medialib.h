@@ -14,44 +14,191 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-/*
- * TODO Maintain an index of the filenames of each meta_info in the db
- * and provide ability to bin-search against that when loading
- * playlists from file.  As-is, really large playlists can take a
- * while.  Also could be used in medialib_scan_dirs when checking if file
- * already exists in database.  Possibly elsewhere too.
- */
-
 #ifndef MEDIALIB_H
 #define MEDIALIB_H
 
 #include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/param.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
+#include <fcntl.h>
 #include <fts.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include "debug.h"
+#include "dirtab.h"
+#include "libindex.h"
 #include "meta_info.h"
 #include "playlist.h"
+#include "savefile.h"
+#include "workq.h"
 
 #include "compat.h"
 
 #define MEDIALIB_PLAYLISTS_CHUNK_SIZE  100
 
+/* playlist files read at once by medialib_load() (mostly waiting on I/O) */
+#define MEDIALIB_LOAD_THREADS  8
+
+/*
+ * files stat(2)'d at once (at least) by medialib_db_update(), and
+ * directories by medialib_db_scan_dirs(), which also mostly wait on I/O
+ */
+#define MEDIALIB_STAT_THREADS  8
+
 /* current database file-format version */
-#define DB_VERSION_MAJOR   2
-#define DB_VERSION_MINOR   1
+#define DB_VERSION_MAJOR   3
+#define DB_VERSION_MINOR   4
 #define DB_VERSION_OTHER   0
 
+/*
+ * On-disk layout of the database (version 3.x):
+ *
+ *    "vitunes" + int version[3]    same prefix as all older versions
+ *    db_header                     sizes of the sections below
+ *    db_record[nrecords]           fixed-size record table
+ *    char heap[heap_size]          NUL-terminated strings
+ *    savefile_trailer              checksum of all of the above (since 3.3)
+ *
+ * All strings of a record are stored as offsets into the heap.  Offset 0 is
+ * always the empty string and is used for NULL fields.  A meta-info string
+ * shared by several records (an album's artist, say) is stored once.  The
+ * whole file is mmap(2)'d when loaded and the meta_info's point straight
+ * into the heap, so loading does no parsing or copying of strings.
+ *
+ * The header and record sizes are stored in the file so that new fields can
+ * be appended in later minor versions.  Fields missing from an older file
+ * are read as zero.  Since 3.1 the track number and year are stored as
+ * numbers, and their cinfo offsets (and that of the length) are always 0;
+ * 3.0 files, which have them as strings, are rewritten when loaded.
+ *
+ * Since 3.2 every record has an id, unique within the database and never
+ * reused, which playlists use to refer to records (see playlist.h).  The
+ * stamp identifies the database, so that ids saved against another one
+ * (after the database was rebuilt, say) are not mistaken for its own.
+ * Records of older files, and records journaled by older versions, are
+ * given ids when loaded and the database is rewritten.
+ *
+ * Since 3.3 the file is written as a savefile (see savefile.h), ending with
+ * a checksum that is verified when it's loaded.  Older files are rewritten
+ * with one when loaded.
+ *
+ * Since 3.4 every record has the identity of its file (see mi_file_id) as
+ * it was when extracted, so that a moved file can be recognized by it.
+ * Records of older files have none until updated (see medialib_db_update()).
+ */
+typedef struct {
+   uint32_t header_size;   /* sizeof(db_header) when written */
+   uint32_t record_size;   /* sizeof(db_record) when written */
+   uint32_t nrecords;      /* number of records in the table */
+   uint32_t next_id;       /* id of the next record added (since 3.2) */
+   uint64_t heap_size;     /* size of the string heap in bytes */
+   uint64_t stamp;         /* identifies the database (since 3.2) */
+} db_header;
+
+typedef struct {
+   uint32_t filename;               /* heap offset of filename */
+   uint32_t cinfo[MI_NUM_CINFO];    /* heap offsets of cinfo (0 = NULL) */
+   int32_t  length;                 /* play length in seconds */
+   uint32_t flags;                  /* DB_RECORD_* flags below */
+   int64_t  last_updated;           /* last time info was extracted */
+   int32_t  track;                  /* track number (since 3.1) */
+   int32_t  year;                   /* year (since 3.1) */
+   uint32_t id;                     /* record id (since 3.2) */
+   uint64_t dev;                    /* mi_file_id of the file (since 3.4) */
+   uint64_t ino;
+   int64_t  size;
+   int64_t  mtime;
+} db_record;
+
+#define DB_RECORD_IS_URL   0x01
+
+/*
+ * Changes made since the database was last written in full are appended to
+ * a journal, "<db_file>.journal", instead of rewriting the whole database:
+ *
+ *    "vitunes" + int version[3]    same prefix as the database
+ *    db_journal_header
+ *    entries, each:  db_journal_entry, db_record, char heap[]
+ *
+ * An entry holds one whole record with a heap of just its own strings.
+ * DB_JOURNAL_PUT adds the record, or replaces the one with the same filename,
+ * and DB_JOURNAL_DEL removes the record with that filename.  Since an entry
+ * only depends on its filename, replaying a journal over a database that
+ * already contains its changes is harmless.  A trailing entry that is short
+ * or fails its checksum (a crash while appending) ends the journal.
+ *
+ * The journal is replayed by medialib_db_load() and folded back into the
+ * database (compacted) once it grows past DB_JOURNAL_COMPACT_RATIO of it.
+ */
+typedef struct {
+   uint32_t header_size;   /* sizeof(db_journal_header) when written */
+   uint32_t record_size;   /* sizeof(db_record) when written */
+} db_journal_header;
+
+typedef struct {
+   uint32_t op;         /* DB_JOURNAL_* below */
+   uint32_t size;       /* bytes of record + heap that follow */
+   uint32_t checksum;   /* of the bytes that follow */
+   uint32_t reserved;
+} db_journal_entry;
+
+#define DB_JOURNAL_PUT  1
+#define DB_JOURNAL_DEL  2
+
+/*
+ * the journal is compacted once it is larger than 1/DB_JOURNAL_COMPACT_RATIO
+ * of the database, but never while smaller than DB_JOURNAL_COMPACT_MIN bytes
+ */
+#define DB_JOURNAL_COMPACT_RATIO 4
+#define DB_JOURNAL_COMPACT_MIN   (64 * 1024)
+
 typedef struct {
    /* some locations of where things are loaded/saved */
    char     *db_file;      /* file containing the database */
    char     *playlist_dir; /* directory where playlists are stored */
 
+   /* identity of the database and the id for the next record added */
+   uint64_t  db_stamp;
+   uint32_t  next_id;
+
+   /* the mmap(2)'d database file (all loaded records point into this) */
+   char     *db_map;
+   size_t    db_map_size;
+
+   /* the mmap(2)'d journal (records replayed from it point into this) */
+   char     *journal_map;
+   size_t    journal_map_size;
+   off_t     journal_size;     /* bytes of valid journal, 0 if none */
+
+   /* filenames of records added/replaced/removed since the last save */
+   char    **dirty;
+   int       ndirty;
+   int       dirty_capacity;
+
+   /*
+    * records taken out of the library (replaced or removed), and the ones
+    * made to stand in for removed ones in playlists.  the yank buffer, the
+    * undo history, the player, and cached rows may still point to them, so
+    * they are kept until medialib_destroy().  in a long running session
+    * (see watcher.h) this grows by a record for each file changed.
+    */
+   meta_info **orphans;
+   int         norphans;
+   int         orphans_capacity;
+
+   /* filename index of every record in the library (see libindex.h) */
+   libindex *index;
+
+   /* word index of every record in the library (see tokindex.h) */
+   tokindex *tokens;
+
    /* psuedo-playlists */
    playlist *library;         /* playlist representing the database */
    playlist *filter_results;  /* playlist representing results of a filter */
@@ -65,6 +212,7 @@ typedef struct {
    playlist **playlists;            /* array of all playlists */
    int        nplaylists;           /* num playlists in array */
    int        playlists_capacity;   /* total size of playlists array */
+   int        nunloaded;            /* how many are still to be read */
 
 } medialib;
 
@@ -73,25 +221,78 @@ typedef struct {
 extern medialib mdb;
 
 
-/* load/free the global media library */
-void medialib_load(const char *db_file, const char *playlist_dir);
+/*
+ * load/free the global media library.  a lazy load only registers the
+ * playlists, to be read by medialib_playlist_resolve() when they are used.
+ */
+void medialib_load(const char *db_file, const char *playlist_dir, bool lazy);
 void medialib_destroy();
 
 /* add/remove playlists to/from the global media library */
 void medialib_playlist_add(playlist *p);
 void medialib_playlist_remove(int pindex);
 
+/*
+ * read a playlist not loaded yet, which must be done before its files are
+ * used, or the next of them not loaded (while idle, after the first paint)
+ */
+int  medialib_playlist_resolve(playlist *p);
+void medialib_playlist_resolve_next(void);
+
 /* create all the necessary files/directories for vitunes medialib */
 void medialib_setup_files(const char *vitunes_dir, const char *db_file,
    const char *playlist_dir);
 
-/* load/save the core database from/to disk */
+/*
+ * load/save the core database from/to disk.  loading replays the journal,
+ * and converts a version 2.1.0 database to the current format.  saving
+ * appends the records changed through medialib_db_add() and friends to the
+ * journal, or compacts if the journal has grown too large.  compacting
+ * writes the whole database to a temporary file that is rename(2)'d over
+ * the existing one, and removes the journal.
+ */
 void medialib_db_load(const char *db_file);
 void medialib_db_save(const char *db_file);
+void medialib_db_compact(const char *db_file);
+
+/*
+ * add/replace/remove records of the library, remembering the change for the
+ * next medialib_db_save().  use these instead of the playlist_file*()
+ * routines on mdb.library for anything that should be saved.  an added
+ * record gets a new id, a replacement keeps the id of the one it replaces.
+ * moving a record gives it the new filename of its file, in every playlist
+ * holding it too (which then need saving).
+ */
+void medialib_db_add(meta_info *mi);
+void medialib_db_replace(int index, meta_info *mi);
+void medialib_db_move(int index, const char *filename, const mi_file_id *fid);
+void medialib_db_remove(int index);
+
+/*
+ * bring the record of one file up to date with the file (if it's gone, by
+ * the name it had), returning which of these was done
+ */
+#define MEDIALIB_CHECK_SAME      0
+#define MEDIALIB_CHECK_ADDED     1
+#define MEDIALIB_CHECK_UPDATED   2
+#define MEDIALIB_CHECK_REMOVED   3
+int medialib_db_check(const char *filename);
 
-/* update/add files to the database */
-void medialib_db_update(bool show_skipped);
-void medialib_db_scan_dirs(char *dirlist[]);
+/*
+ * update/add files to the database, extracting meta information with the
+ * given number of worker threads.  scanning skips the directories that the
+ * directory table (see dirtab.h) says are unchanged, unless asked for a full
+ * scan.
+ */
+void medialib_db_update(bool show_skipped, int nthreads);
+void medialib_db_scan_dirs(char *dirlist[], int nthreads, bool full);
+
+/*
+ * the second, slower, pass for files added without a play-length (those that
+ * mi_extract() couldn't find one for): find it with the given function, for
+ * up to nthreads files at once.
+ */
+void medialib_db_properties(int nthreads, int (*length)(const char *));
 
 /* debug routine for dumping db contents to stdout */
 void medialib_db_flush(FILE *f, const char *time_fmt);
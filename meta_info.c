@@ -42,9 +42,17 @@ mi_new(void)
       err(1, "mi_new: meta_info malloc failed");
 
    mi->filename = NULL;
+   mi->id = 0;
+   mi->track = 0;
+   mi->year = 0;
    mi->length = 0;
    mi->last_updated = 0;
+   memset(&mi->fid, 0, sizeof(mi->fid));
    mi->is_url = false;
+   mi->is_mapped = false;
+   mi->refs = NULL;
+   mi->nrefs = 0;
+   mi->refs_capacity = 0;
 
    for (i = 0; i < MI_NUM_CINFO; i++)
       mi->cinfo[i] = NULL;
@@ -53,58 +61,27 @@ mi_new(void)
 }
 
 
-/* Function to free() all memory allocated by a given meta_info struct.  */
+/*
+ * Function to free() all memory allocated by a given meta_info struct.
+ * The filename of a record loaded from the mmap(2)'d database belongs to the
+ * mapping, and the cinfo strings to the string pool, so they are left alone.
+ */
 void
 mi_free(meta_info *mi)
 {
-   int i;
-
-   if (mi->filename != NULL)
+   if (!mi->is_mapped && mi->filename != NULL)
       free(mi->filename);
 
-   for (i = 0; i < MI_NUM_CINFO; i++) {
-      if (mi->cinfo[i] != NULL)
-         free(mi->cinfo[i]);
-   }
-
+   free(mi->refs);
    free(mi);
 }
 
-/* Function to write a meta_info struct to a file stream.  */
-void
-mi_fwrite(meta_info *mi, FILE *fout)
-{
-   static uint16_t lengths[MI_NUM_CINFO + 1];   /* +1 for filename */
-   int i;
-
-   /* store all necessary numeric values in the above array */
-   lengths[0] = strlen(mi->filename);
-   for (i = 0; i < MI_NUM_CINFO; i++) {
-      if (mi->cinfo[i] == NULL)
-         lengths[i+1] = 0;
-      else
-         lengths[i+1] = strlen(mi->cinfo[i]);
-   }
-
-   /* write */
-   fwrite(lengths, sizeof(lengths), 1, fout);
-   fwrite(mi->filename, sizeof(char), lengths[0], fout);
-   for (i = 0; i < MI_NUM_CINFO; i++) {
-      if (mi->cinfo[i] != NULL)
-         fwrite(mi->cinfo[i], sizeof(char), lengths[i+1], fout);
-   }
-   fwrite(&(mi->length),   sizeof(int), 1, fout);
-   fwrite(&(mi->last_updated), sizeof(time_t),   1, fout);
-   fwrite(&(mi->is_url),       sizeof(bool),     1, fout);
-
-   fflush(fout);
-}
-
-/* Function to read a meta_info struct from a file stream */
+/* Function to read a version 2.x meta_info record from a file stream */
 void
 mi_fread(meta_info *mi, FILE *fin)
 {
    static uint16_t lengths[MI_NUM_CINFO + 1];   /* +1 for filename */
+   char buf[UINT16_MAX + 1];
    int i;
 
    /* first read all necessary numeric values */
@@ -116,20 +93,14 @@ mi_fread(meta_info *mi, FILE *fin)
 
    bzero(mi->filename, sizeof(char) * (lengths[0] + 1));
 
-   for (i = 0; i < MI_NUM_CINFO; i++) {
-      if (lengths[i+1] > 0) {
-         if ((mi->cinfo[i] = calloc(lengths[i+1] + 1, sizeof(char))) == NULL)
-            err(1, "mi_fread: failed to calloc cinfo");
-
-         bzero(mi->cinfo[i], sizeof(char) * (lengths[i+1] + 1));
-      }
-   }
-
    /* read */
    fread(mi->filename, sizeof(char), lengths[0], fin);
    for (i = 0; i < MI_NUM_CINFO; i++) {
-      if (lengths[i+1] > 0)
-         fread(mi->cinfo[i], sizeof(char), lengths[i+1], fin);
+      if (lengths[i+1] > 0) {
+         bzero(buf, lengths[i+1] + 1);
+         fread(buf, sizeof(char), lengths[i+1], fin);
+         mi_cinfo_set(mi, i, buf);
+      }
    }
    fread(&(mi->length),       sizeof(int),      1, fin);
    fread(&(mi->last_updated), sizeof(time_t),   1, fin);
@@ -161,15 +132,24 @@ time2str(int s)
 }
 
 
+/*
+ * TagLib's C bindings keep every string they return in one global list that
+ * is freed by taglib_tag_free_strings(), so the part of mi_extract() that
+ * fetches and copies strings must not run in two threads at once.  Opening
+ * and parsing the files (the expensive part) can.
+ */
+static pthread_mutex_t mi_taglib_strings_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Extract meta-information from the provided file, returning a new
  * meta_info* struct if any information was found, NULL if no information
- * was available.
+ * was available.  This may be called from several threads at once.
  */
 meta_info *
 mi_extract(const char *filename)
 {
-   static char fullname[PATH_MAX];
+   struct stat sb;
+   char fullname[PATH_MAX];
    const TagLib_AudioProperties *properties;
    TagLib_File *file;
    TagLib_Tag  *tag;
@@ -186,12 +166,16 @@ mi_extract(const char *filename)
    if ((mi->filename = strdup(fullname)) == NULL)
       errx(1, "mi_extract: strdup failed for '%s'", fullname);
 
-   /* start extracting fields using TagLib... */
+   /* and which file it is, before it's read */
+   if (stat(mi->filename, &sb) == 0)
+      mi_file_id_set(&mi->fid, &sb);
 
-   taglib_set_strings_unicode(false);
+   /* start extracting fields using TagLib... */
 
    if ((file = taglib_file_new(mi->filename)) == NULL
     || !taglib_file_is_valid(file)) {
+      if (file != NULL)
+         taglib_file_free(file);
       mi_free(mi);
       return NULL;
    }
@@ -200,60 +184,152 @@ mi_extract(const char *filename)
    tag = taglib_file_tag(file);
    properties = taglib_file_audioproperties(file);
 
+   pthread_mutex_lock(&mi_taglib_strings_lock);
+   taglib_set_strings_unicode(false);
+
    /* artist/album/title/genre */
    if ((str = taglib_tag_artist(tag)) != NULL)
-      mi->cinfo[MI_CINFO_ARTIST] = strdup(str);
+      mi->cinfo[MI_CINFO_ARTIST] = strpool_intern(str);
 
    if ((str = taglib_tag_album(tag)) != NULL)
-      mi->cinfo[MI_CINFO_ALBUM] = strdup(str);
+      mi->cinfo[MI_CINFO_ALBUM] = strpool_intern(str);
 
    if ((str = taglib_tag_title(tag)) != NULL)
-      mi->cinfo[MI_CINFO_TITLE] = strdup(str);
+      mi->cinfo[MI_CINFO_TITLE] = strpool_intern(str);
 
    if ((str = taglib_tag_genre(tag)) != NULL)
-      mi->cinfo[MI_CINFO_GENRE] = strdup(str);
+      mi->cinfo[MI_CINFO_GENRE] = strpool_intern(str);
 
    if ((str = taglib_tag_comment(tag)) != NULL)
-      mi->cinfo[MI_CINFO_COMMENT] = strdup(str);
-
-   if (mi->cinfo[MI_CINFO_ARTIST] == NULL
-   ||  mi->cinfo[MI_CINFO_ALBUM] == NULL
-   ||  mi->cinfo[MI_CINFO_TITLE] == NULL
-   ||  mi->cinfo[MI_CINFO_GENRE] == NULL
-   ||  mi->cinfo[MI_CINFO_COMMENT] == NULL)
-      err(1, "mi_extract: strdup for CINFO failed");
-
-   /* track number */
-   if (taglib_tag_track(tag) > 0) {
-      asprintf(&(mi->cinfo[MI_CINFO_TRACK]), "%3i", taglib_tag_track(tag));
-      if (mi->cinfo[MI_CINFO_TRACK] == NULL)
-         err(1, "mi_extract: asprintf failed for CINFO_TRACK");
-   }
+      mi->cinfo[MI_CINFO_COMMENT] = strpool_intern(str);
 
-   /* year */
-   if (taglib_tag_year(tag) > 0) {
-      asprintf(&(mi->cinfo[MI_CINFO_YEAR]), "%i", taglib_tag_year(tag));
-      if (mi->cinfo[MI_CINFO_YEAR] == NULL)
-         err(1, "mi_extract: asprintf failed for CINFO_YEAR");
-   }
-
-   /* playlength in seconds (will be 0 if unavailable) */
+   /* track number, year, and playlength in seconds (0 if unavailable) */
+   mi->track = taglib_tag_track(tag);
+   mi->year = taglib_tag_year(tag);
    mi->length = taglib_audioproperties_length(properties);
-   if (mi->length > 0) {
-      if ((mi->cinfo[MI_CINFO_LENGTH] = strdup(time2str(mi->length))) == NULL)
-         err(1, "mi_extract: strdup failed for CINO_LENGTH");
-   }
 
    /* record the time we extracted this info */
    time(&mi->last_updated);
 
    /* cleanup */
    taglib_tag_free_strings();
+   pthread_mutex_unlock(&mi_taglib_strings_lock);
    taglib_file_free(file);
 
    return mi;
 }
 
+void
+mi_file_id_set(mi_file_id *fid, const struct stat *sb)
+{
+   fid->dev   = sb->st_dev;
+   fid->ino   = sb->st_ino;
+   fid->size  = sb->st_size;
+   fid->mtime = sb->st_mtime;
+}
+
+bool
+mi_file_id_equal(const mi_file_id *a, const mi_file_id *b)
+{
+   return (a->dev == b->dev && a->ino == b->ino && a->size == b->size
+        && a->mtime == b->mtime);
+}
+
+/*
+ * leading number of a numeric field: "  3" or "3/12" for tracks, "1999"
+ * for years, "1:02:03" or "45s" for lengths.  false if there is none.
+ */
+static bool
+mi_parse_number(const char *s, int *value)
+{
+   int v, part;
+
+   while (isspace((unsigned char) *s))
+      s++;
+
+   if (!isdigit((unsigned char) *s))
+      return false;
+
+   v = 0;
+   for (;;) {
+      part = 0;
+      while (isdigit((unsigned char) *s) && part < INT_MAX / 10)
+         part = part * 10 + (*s++ - '0');
+
+      if (v > (INT_MAX - part) / 60)
+         break;
+      v = v * 60 + part;
+
+      if (*s != ':' || !isdigit((unsigned char) s[1]))
+         break;
+      s++;
+   }
+
+   *value = v;
+   return true;
+}
+
+/*
+ * Formatted numeric fields, cached by value.  The field strings of every
+ * row painted go through here, and the same few track numbers, years and
+ * lengths come up again and again.
+ */
+#define MI_CINFO_CACHE_SIZE 512
+static struct mi_cinfo_cached {
+   int  value;    /* 0 = empty */
+   char str[32];
+} mi_cinfo_cache[3][MI_CINFO_CACHE_SIZE];
+
+const char *
+mi_cinfo(const meta_info *mi, int field)
+{
+   int value, which;
+   struct mi_cinfo_cached *c;
+
+   switch (field) {
+   case MI_CINFO_TRACK:  value = mi->track;  which = 0; break;
+   case MI_CINFO_YEAR:   value = mi->year;   which = 1; break;
+   case MI_CINFO_LENGTH: value = mi->length; which = 2; break;
+   default:
+      return mi->cinfo[field];
+   }
+
+   if (value <= 0)
+      return NULL;
+
+   c = &(mi_cinfo_cache[which][value % MI_CINFO_CACHE_SIZE]);
+   if (c->value != value) {
+      c->value = value;
+      if (field == MI_CINFO_LENGTH)
+         strlcpy(c->str, time2str(value), sizeof(c->str));
+      else
+         snprintf(c->str, sizeof(c->str),
+            (field == MI_CINFO_TRACK ? "%3i" : "%i"), value);
+   }
+
+   return c->str;
+}
+
+void
+mi_cinfo_set(meta_info *mi, int field, const char *value)
+{
+   int n;
+
+   if (!MI_CINFO_NUMERIC(field)) {
+      mi->cinfo[field] = strpool_intern(value);
+      return;
+   }
+
+   if (value == NULL || !mi_parse_number(value, &n))
+      n = 0;
+
+   switch (field) {
+   case MI_CINFO_TRACK:  mi->track = n;  break;
+   case MI_CINFO_YEAR:   mi->year = n;   break;
+   case MI_CINFO_LENGTH: mi->length = n; break;
+   }
+}
+
 /*****************************************************************************
  * The sanitation routines
  ****************************************************************************/
@@ -273,10 +349,28 @@ str_sanitize(char *s)
 void
 mi_sanitize(meta_info *mi)
 {
+   const char *s;
+   char *copy;
    int i;
+
    for (i = 0; i < MI_NUM_CINFO; i++) {
-      if (mi->cinfo[i] != NULL)
-         str_sanitize(mi->cinfo[i]);
+      if (mi->cinfo[i] == NULL)
+         continue;
+
+      /* pooled strings are shared, so sanitize a copy if needed */
+      for (s = mi->cinfo[i]; *s != '\0'; s++) {
+         if (!isdigit(*s) && !isalpha(*s) && !ispunct(*s) && *s != ' ')
+            break;
+      }
+      if (*s == '\0')
+         continue;
+
+      if ((copy = strdup(mi->cinfo[i])) == NULL)
+         err(1, "mi_sanitize: strdup failed");
+
+      str_sanitize(copy);
+      mi->cinfo[i] = strpool_intern(copy);
+      free(copy);
    }
 }
 
@@ -333,6 +427,51 @@ mi_query_clear()
    _mi_query.ntokens = 0;
 }
 
+/*
+ * If a token is a comparison of a numeric field, such as "year>=1990",
+ * "track=3" or "length<4:00", return the field and set the operator and
+ * value.  Otherwise return -1.
+ */
+static int
+mi_query_numeric(const char *token, char *op, int *value)
+{
+   size_t len;
+   int    field;
+
+   for (field = 0; field < MI_NUM_CINFO; field++) {
+      len = strlen(MI_CINFO_NAMES[field]);
+      if (MI_CINFO_NUMERIC(field)
+      &&  strncasecmp(token, MI_CINFO_NAMES[field], len) == 0)
+         break;
+   }
+   if (field == MI_NUM_CINFO)
+      return -1;
+
+   token += len;
+   switch (token[0]) {
+   case '=':
+      *op = '=';
+      token++;
+      break;
+   case '<':
+   case '>':
+      *op = token[0];
+      if (token[1] == '=') {
+         *op = (token[0] == '<' ? 'l' : 'g');
+         token++;
+      }
+      token++;
+      break;
+   default:
+      return -1;
+   }
+
+   if (!mi_parse_number(token, value))
+      return -1;
+
+   return field;
+}
+
 /* add a token to the current query description */
 void
 mi_query_add_token(const char *token)
@@ -347,6 +486,10 @@ mi_query_add_token(const char *token)
    } else
       _mi_query.match[_mi_query.ntokens] = true;
 
+   /* a comparison of a numeric field? */
+   _mi_query.field[_mi_query.ntokens] = mi_query_numeric(token,
+      &_mi_query.op[_mi_query.ntokens], &_mi_query.value[_mi_query.ntokens]);
+
    /* copy token */
    if ((_mi_query.tokens[_mi_query.ntokens++] = strdup(token)) == NULL)
       err(1, "mi_query_add_token: strdup failed");
@@ -372,13 +515,36 @@ mi_query_getraw()
 bool
 mi_match(const meta_info *mi)
 {
+   const char *s;
    bool  matches;
-   int   i, j;
+   int   i, j, n;
 
    for (i = 0; i < _mi_query.ntokens; i++) {
 
       matches = false;
 
+      /* numeric comparisons never match unknown (0) values */
+      if (_mi_query.field[i] >= 0) {
+         switch (_mi_query.field[i]) {
+         case MI_CINFO_TRACK:  n = mi->track;  break;
+         case MI_CINFO_YEAR:   n = mi->year;   break;
+         default:              n = mi->length; break;
+         }
+
+         switch (_mi_query.op[i]) {
+         case '=': matches = (n == _mi_query.value[i]); break;
+         case '<': matches = (n <  _mi_query.value[i]); break;
+         case '>': matches = (n >  _mi_query.value[i]); break;
+         case 'l': matches = (n <= _mi_query.value[i]); break;
+         case 'g': matches = (n >= _mi_query.value[i]); break;
+         }
+         matches = matches && n > 0;
+
+         if (matches != (bool) _mi_query.match[i])
+            return false;
+         continue;
+      }
+
       /* does the filename match? */
       if (mi_query_match_filename) {
          if ((strcasestr(mi->filename, _mi_query.tokens[i])) != NULL)
@@ -387,10 +553,10 @@ mi_match(const meta_info *mi)
 
       /* do any of the CINFO fields match? */
       for (j = 0; !matches && j < MI_NUM_CINFO; j++) {
-         if (mi->cinfo[j] == NULL)
+         if ((s = mi_cinfo(mi, j)) == NULL)
             continue;
 
-         if ((strcasestr(mi->cinfo[j], _mi_query.tokens[i])) != NULL)
+         if ((strcasestr(s, _mi_query.tokens[i])) != NULL)
             matches = true;
       }
 
@@ -547,39 +713,225 @@ err:
 }
 
 /*
- * Compare two meta_info structs using the global sort description
- * Note that this function is suitable for passing to qsort(3) and the like.
+ * Sorting is done by building a key for each record once, from the fields of
+ * the global sort description, such that comparing two keys with memcmp(3)
+ * gives the order of the records.  Each field is encoded as:
+ *
+ *    string fields     flag byte, then the case-folded string and a NUL
+ *    numeric fields    flag byte, then the value as 8 bytes big-endian
+ *
+ * The flag puts empty (NULL or 0) fields after all others.  Descending
+ * fields have every byte of their encoding complemented.  The encoding of a
+ * field is never a prefix of a different one, so comparisons never run into
+ * the next field by mistake.
  * TODO investigate way to ignore stuff like a starting "The" or "A" when
  * sorting.  Wait, do I want this?
  */
-int
-mi_compare(const void *A, const void *B)
+#define MI_SORT_KEY_NUMBER  0x01
+#define MI_SORT_KEY_STRING  0x02
+#define MI_SORT_KEY_NULL    0x03
+
+typedef struct {
+   uint64_t       prefix;     /* first 8 bytes of key, for quick compares */
+   unsigned char *key;
+   size_t         len;
+   meta_info     *mi;
+} mi_sort_entry;
+
+/* most bytes a key of mi can take */
+static size_t
+mi_sort_keylen(const meta_info *mi)
 {
-   int field;
-   int ret;
-   int i;
+   size_t len;
+   int    i, field;
+
+   len = 0;
+   for (i = 0; i < _mi_sort.nfields; i++) {
+      field = _mi_sort.order[i];
+      len += 1 + sizeof(uint64_t) + 1;
+      if (!MI_CINFO_NUMERIC(field) && mi->cinfo[field] != NULL)
+         len += strlen(mi->cinfo[field]);
+   }
+
+   return len;
+}
 
-   const meta_info **a2 = (const meta_info**) A;
-   const meta_info **b2 = (const meta_info**) B;
-   const meta_info *a = *a2;
-   const meta_info *b = *b2;
+/* build the key of mi in buf (of at least mi_sort_keylen() bytes) */
+static size_t
+mi_sort_key(const meta_info *mi, unsigned char *buf)
+{
+   unsigned char  *start, *k;
+   const char     *s;
+   uint64_t        v;
+   int             i, j, n, field;
 
+   k = buf;
    for (i = 0; i < _mi_sort.nfields; i++) {
       field = _mi_sort.order[i];
+      start = k;
+
+      if (MI_CINFO_NUMERIC(field)) {
+         n = (field == MI_CINFO_TRACK ? mi->track
+            : field == MI_CINFO_YEAR ? mi->year : mi->length);
+         if (n <= 0)
+            *k++ = MI_SORT_KEY_NULL;
+         else {
+            v = n;
+            *k++ = MI_SORT_KEY_NUMBER;
+            for (j = sizeof(v) - 1; j >= 0; j--)
+               *k++ = (v >> (j * 8)) & 0xff;
+         }
+      } else if ((s = mi->cinfo[field]) == NULL)
+         *k++ = MI_SORT_KEY_NULL;
+      else {
+         *k++ = MI_SORT_KEY_STRING;
+         while (*s != '\0')
+            *k++ = tolower((unsigned char) *s++);
+         *k++ = '\0';
+      }
 
-      if (a->cinfo[field] == NULL && b->cinfo[field] == NULL)
-         return 0;
-      if (a->cinfo[field] != NULL && b->cinfo[field] == NULL)
-         return (_mi_sort.descending[i] ? 1 : -1);
-      if (a->cinfo[field] == NULL && b->cinfo[field] != NULL)
-         return (_mi_sort.descending[i] ? -1 : 1);
+      if (_mi_sort.descending[i]) {
+         for (; start < k; start++)
+            *start = ~*start;
+      }
+   }
+
+   return k - buf;
+}
 
-      ret = strcasecmp(a->cinfo[field], b->cinfo[field]);
-      if (ret != 0)
-         return (_mi_sort.descending[i] ? -1 * ret : ret);
+/*
+ * do a and b have the same value in every sorted field?  cinfo strings are
+ * interned, so this is pointer equality.
+ */
+static bool
+mi_sort_same(const meta_info *a, const meta_info *b)
+{
+   int i, field;
+
+   for (i = 0; i < _mi_sort.nfields; i++) {
+      field = _mi_sort.order[i];
+      if (a->cinfo[field] != b->cinfo[field]
+      ||  (field == MI_CINFO_TRACK  && a->track  != b->track)
+      ||  (field == MI_CINFO_YEAR   && a->year   != b->year)
+      ||  (field == MI_CINFO_LENGTH && a->length != b->length))
+         return false;
    }
 
-   return 0;
+   return true;
+}
+
+static int
+mi_sort_entry_cmp(const mi_sort_entry *a, const mi_sort_entry *b)
+{
+   int ret;
+
+   /* records with identical fields share one key */
+   if (a->key == b->key)
+      return 0;
+
+   if (a->prefix != b->prefix)
+      return (a->prefix < b->prefix ? -1 : 1);
+
+   ret = memcmp(a->key, b->key, MIN(a->len, b->len));
+   if (ret != 0)
+      return ret;
+
+   return (a->len > b->len) - (a->len < b->len);
+}
+
+/* stable bottom-up merge sort of n entries, using tmp as scratch space */
+static void
+mi_sort_entries(mi_sort_entry *e, mi_sort_entry *tmp, int n)
+{
+   mi_sort_entry *from, *to, *swap;
+   int            width, lo, mid, hi, i, j, k;
+
+   from = e;
+   to = tmp;
+   for (width = 1; width < n; width *= 2) {
+      for (lo = 0; lo < n; lo += 2 * width) {
+         mid = MIN(lo + width, n);
+         hi = MIN(lo + 2 * width, n);
+         i = lo;
+         j = mid;
+         k = lo;
+         while (i < mid && j < hi) {
+            if (mi_sort_entry_cmp(&from[j], &from[i]) < 0)
+               to[k++] = from[j++];
+            else
+               to[k++] = from[i++];
+         }
+         while (i < mid)
+            to[k++] = from[i++];
+         while (j < hi)
+            to[k++] = from[j++];
+      }
+
+      swap = from;
+      from = to;
+      to = swap;
+   }
+
+   if (from != e)
+      memcpy(e, from, n * sizeof(mi_sort_entry));
+}
+
+/*
+ * Sort an array of meta_info's using the global sort description.  The sort
+ * is stable, so records that compare equal keep their current order.
+ */
+void
+mi_sort(meta_info **files, int nfiles)
+{
+   mi_sort_entry *entries, *tmp;
+   unsigned char *keys, *k;
+   size_t         total, i;
+   int            n, j;
+
+   if (nfiles < 2)
+      return;
+
+   total = 0;
+   for (n = 0; n < nfiles; n++)
+      total += mi_sort_keylen(files[n]);
+
+   entries = calloc(nfiles, sizeof(mi_sort_entry));
+   tmp = calloc(nfiles, sizeof(mi_sort_entry));
+   keys = malloc(total + 1);
+   if (entries == NULL || tmp == NULL || keys == NULL)
+      err(1, "%s: failed to allocate sort keys", __FUNCTION__);
+
+   k = keys;
+   for (n = 0; n < nfiles; n++) {
+      entries[n].mi = files[n];
+
+      /* neighbours (such as tracks of an album) often sort the same */
+      if (n > 0 && mi_sort_same(files[n], files[n - 1])) {
+         entries[n].key = entries[n - 1].key;
+         entries[n].len = entries[n - 1].len;
+         entries[n].prefix = entries[n - 1].prefix;
+         continue;
+      }
+
+      entries[n].key = k;
+      entries[n].len = mi_sort_key(files[n], k);
+      k += entries[n].len;
+
+      entries[n].prefix = 0;
+      for (i = 0; i < sizeof(uint64_t); i++) {
+         entries[n].prefix <<= 8;
+         if (i < entries[n].len)
+            entries[n].prefix |= entries[n].key[i];
+      }
+   }
+
+   mi_sort_entries(entries, tmp, nfiles);
+   for (j = 0; j < nfiles; j++)
+      files[j] = entries[j].mi;
+
+   free(entries);
+   free(tmp);
+   free(keys);
 }
 
 
@@ -616,6 +968,8 @@ mi_display_init()
    mi_display.align[3] = RIGHT;
    mi_display.align[4] = RIGHT;
    mi_display.align[5] = RIGHT;
+
+   mi_display_invalidate();
 }
 
 /* reset the display to what i like */
@@ -625,6 +979,13 @@ mi_display_reset()
    mi_display_init();
 }
 
+/* note that the display of meta_info's may have changed */
+void
+mi_display_invalidate()
+{
+   mi_display.generation++;
+}
+
 /* return the total width of the current display description */
 int
 mi_display_getwidth()
@@ -763,6 +1124,7 @@ mi_display_set(const char *display, const char **errmsg)
       mi_display.align[idx] = new_display.align[idx];
    }
    mi_display.nfields = new_display.nfields;
+   mi_display_invalidate();
 
    free(copy);
    return 0;
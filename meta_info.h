@@ -17,8 +17,12 @@
 #ifndef META_INFO_H
 #define META_INFO_H
 
+#include <sys/param.h>
+#include <sys/stat.h>
+
 #include <ctype.h>
 #include <limits.h>
+#include <pthread.h>
 #include <err.h>
 #include <errno.h>
 #include <stdbool.h> 
@@ -34,6 +38,7 @@
 
 #include "debug.h"
 #include "enums.h"
+#include "strpool.h"
 
 #include "compat.h"
 
@@ -48,21 +53,53 @@
 #define MI_CINFO_LENGTH  6
 #define MI_CINFO_COMMENT 7
 
+/* references to a meta_info from the playlists holding it (see playlist.h) */
+struct playlist_ref;
+
+/*
+ * what a file was when its info was extracted, to know it again after it's
+ * moved or renamed (see medialib_db_scan_dirs()).  all 0 if unknown.
+ */
+typedef struct {
+   uint64_t    dev;
+   uint64_t    ino;
+   int64_t     size;
+   int64_t     mtime;
+} mi_file_id;
+
 /* struct used to represent all meta information from a given file */
 typedef struct {
    char       *filename;               /* filename of file itself */
-   char       *cinfo[MI_NUM_CINFO];    /* character meta info array */
+   uint32_t    id;                     /* database id (0 = not in db) */
+   const char *cinfo[MI_NUM_CINFO];    /* character meta info (interned) */
+   int         track;                  /* track number (0 = unknown) */
+   int         year;                   /* year (0 = unknown) */
    int         length;                 /* play length in seconds */
    time_t      last_updated;           /* last time info was extracted */
+   mi_file_id  fid;                    /* the file when it was extracted */
    bool        is_url;                 /* if this is a url */
+   bool        is_mapped;              /* strings live in the mmap'd db */
+
+   struct playlist_ref *refs;          /* playlists holding this file */
+   int                  nrefs;
+   int                  refs_capacity;
 } meta_info;
 
 /*
- * XXX Note in the above that the playlength is stored both numerically
- * in the member 'length' and as a character string in the cinfo array
- * in the form "hh:mm:ss"
+ * XXX Note in the above that the track, year, and playlength are stored
+ * only numerically.  Their slots in the cinfo array are always NULL, and
+ * mi_cinfo() formats them when they're needed as strings.  Anything that
+ * reads a field by its MI_CINFO_* number should use mi_cinfo().
+ *
+ * The cinfo strings all come from the string pool (see strpool.h), so they
+ * are shared between records, must never be modified in place, and are not
+ * freed with the record.  To change a field, use mi_cinfo_set().
  */
 
+/* is a field stored as a number rather than a string */
+#define MI_CINFO_NUMERIC(f) \
+   ((f) == MI_CINFO_TRACK || (f) == MI_CINFO_YEAR || (f) == MI_CINFO_LENGTH)
+
 /* array of human-readable names of each CINFO member */
 extern const char *MI_CINFO_NAMES[MI_NUM_CINFO];
 
@@ -70,13 +107,29 @@ extern const char *MI_CINFO_NAMES[MI_NUM_CINFO];
 meta_info *mi_new(void);
 void mi_free(meta_info *info);
 
-/* read/write meta_info structs to a file */
-void mi_fwrite(meta_info *mi, FILE *fout);
+/*
+ * read a meta_info struct stored in the old (version 2.x) database format.
+ * only used to migrate such databases, see medialib_db_load().
+ */
 void mi_fread(meta_info *mi,  FILE *fin);
 
-/* used to extract meta info from a media file */
+/* used to extract meta info from a media file (safe to call from threads) */
 meta_info* mi_extract(const char *filename);
 
+/* set a file id from stat(2), and compare two */
+void mi_file_id_set(mi_file_id *fid, const struct stat *sb);
+bool mi_file_id_equal(const mi_file_id *a, const mi_file_id *b);
+
+/*
+ * get a field as a string (NULL if unknown).  numeric fields are formatted
+ * into a small cache, and the result is only good until the next call.
+ * main thread only.
+ */
+const char *mi_cinfo(const meta_info *mi, int field);
+
+/* set a field from a string (parsed for numeric fields, NULL = unknown) */
+void mi_cinfo_set(meta_info *mi, int field, const char *value);
+
 
 /*****************************************************************************
  * XXX Important Note XXX These functions are used to replace any
@@ -92,7 +145,7 @@ meta_info* mi_extract(const char *filename);
  ****************************************************************************/
 
 void str_sanitize(char *s);
-void mi_sanitize(meta_info *mi);
+void mi_sanitize(meta_info *mi);   /* re-points fields at sanitized copies */
 
 
 /*****************************************************************************
@@ -105,14 +158,23 @@ void mi_sanitize(meta_info *mi);
  * given meta_info against this global query description.
  ****************************************************************************/
 
-/* structure used to describe what to match meta_info's against */
+/*
+ * structure used to describe what to match meta_info's against.  a token
+ * such as "year>=1990" compares a numeric field (track, year, or length)
+ * instead of searching for text; for those, field is the MI_CINFO_* number
+ * of the field, otherwise it is -1.
+ */
 #define MI_MAX_QUERY_TOKENS   255
 typedef struct {
    char *tokens[MI_MAX_QUERY_TOKENS];
    char  match[MI_MAX_QUERY_TOKENS];
+   int   field[MI_MAX_QUERY_TOKENS];
+   char  op[MI_MAX_QUERY_TOKENS];      /* '=', '<', '>', 'l' (<=), 'g' (>=) */
+   int   value[MI_MAX_QUERY_TOKENS];
    int   ntokens;
    char *raw;  /* a copy of the original, un-tokenized query */
 } mi_query_description;
+extern mi_query_description _mi_query;
 
 /* flag to indicate if we should include filename when matching */
 extern bool mi_query_match_filename;
@@ -136,9 +198,9 @@ bool str_match_query(const char *s);
  * sort description that includes the ordering of the CINFO items to sort and
  * which, if any, to sort descending.
  *
- * Once the global sort description has been setup, mi_compare() can be used
- * to compare two meta_info's in a way that works with qsort(3), heapsort(3),
- * or mergesort(3).
+ * Once the global sort description has been setup, mi_sort() sorts an array
+ * of meta_info's by it.  Track, year, and length are compared by their
+ * numeric values, all other fields as case-insensitive strings.
  ****************************************************************************/
 
 /* structure used to describe how to sort meta_info structs */
@@ -153,8 +215,8 @@ void mi_sort_init();
 void mi_sort_clear();
 int  mi_sort_set(const char *str, const char **errmsg);
 
-/* compare two meta_info's using the global sort description */
-int  mi_compare(const void *a, const void *b);
+/* stable sort of an array of meta_info's using the global sort description */
+void mi_sort(meta_info **files, int nfiles);
 
 
 /*****************************************************************************
@@ -169,6 +231,15 @@ typedef struct {
    int       order[MI_NUM_CINFO];
    int       widths[MI_NUM_CINFO];
    Direction align[MI_NUM_CINFO];
+
+   /*
+    * changed whenever what is displayed for any meta_info may have changed,
+    * so anything formatted for display can be cached until it changes.
+    * this happens when the description is changed, and code changing or
+    * freeing a meta_info that may be on screen must call
+    * mi_display_invalidate().
+    */
+   unsigned int generation;
 } mi_display_description;
 extern mi_display_description mi_display;
 
@@ -177,6 +248,9 @@ void  mi_display_init();
 int   mi_display_set(const char *str, const char **errmsg);
 void  mi_display_reset();
 
+/* note that the display of meta_info's may have changed */
+void  mi_display_invalidate();
+
 /* convert current display to a string */
 char *mi_display_tostr();
 
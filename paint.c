@@ -16,11 +16,14 @@
 
 #include "paint.h"
 
+/* shown for the length of files that don't have one (yet) */
+#define PAINT_LENGTH_PENDING  "--:--"
+
 /* globalx */
 _colors colors;
 bool showing_file_info = false;
 
-char *player_get_field2show(const meta_info *mi);
+const char *player_get_field2show(const meta_info *mi);
 char *num2fmt(int n, Direction d);
 
 
@@ -30,7 +33,7 @@ char *num2fmt(int n, Direction d);
  * The field displayed rotates between artist, album, and title, changing
  * every 3 seconds.
  */
-char *
+const char *
 player_get_field2show(const meta_info *mi)
 {
    static time_t last_updated = 0;
@@ -123,7 +126,7 @@ paint_status_bar()
    mvwprintw(ui.player, 0, 0, num2fmt(w, LEFT), " "); /* this fills the bg color */
    mvwprintw(ui.command, 0, 0, num2fmt(w, RIGHT), scratchpad);
    wattroff(ui.command, COLOR_PAIR(colors.status));
-   wrefresh(ui.command);
+   wnoutrefresh(ui.command);
 }
 
 /* paint the player */
@@ -131,11 +134,12 @@ void
 paint_player()
 {
    static char *playmode;
-   static char *finfo;
+   static const char *finfo;
    static int   in_hour;
    static int   in_minute;
    static int   in_second;
    static int   percent, whole;
+   const meta_info *playing;
    int w;
 
    w = getmaxx(stdscr);
@@ -146,10 +150,12 @@ paint_player()
       wattron(ui.player, COLOR_PAIR(colors.player));
       mvwprintw(ui.player, 0, 0, num2fmt(w, LEFT), "vitunes...");
       wattroff(ui.player, COLOR_PAIR(colors.player));
-      wrefresh(ui.player);
+      wnoutrefresh(ui.player);
       return;
    }
 
+   playing = playlist_file(playing_playlist, player_info.qidx);
+
    /* determine time into current selection */
    in_hour   = (int)  roundf(player.position() / 3600);
    in_minute = ((int) roundf(player.position())) % 3600 / 60;
@@ -157,8 +163,8 @@ paint_player()
 
    /* determine percent time into current selection */
    percent = -1;
-   if (playing_playlist->files[player_info.qidx]->length > 0) {
-      whole = playing_playlist->files[player_info.qidx]->length;
+   if (playing->length > 0) {
+      whole = playing->length;
       percent = roundf(100.0 * player.position() / whole);
    }
 
@@ -176,7 +182,7 @@ paint_player()
    }
 
    /* determine info about song to show */
-   finfo = player_get_field2show(playing_playlist->files[player_info.qidx]);
+   finfo = player_get_field2show(playing);
 
    /* draw */
    werase(ui.player);
@@ -190,7 +196,7 @@ paint_player()
       percent,
       finfo);
    wattroff(ui.player, COLOR_PAIR(colors.player));
-   wrefresh(ui.player);
+   wnoutrefresh(ui.player);
 }
 
 /* paint the library window */
@@ -274,31 +280,258 @@ paint_library()
    }
 
    wattroff(ui.library->cwin, COLOR_PAIR(colors.library));
-   wrefresh(ui.library->cwin);
+   wnoutrefresh(ui.library->cwin);
+}
+
+/*
+ * Render cache of the playlist window.  Each entry holds a row of a file, as
+ * formatted for the current display description, window width and
+ * horizontal offset: the text of each column, already aligned and clipped
+ * to its width.  It is direct-mapped by the file's meta_info pointer, and an
+ * entry is only used if everything it was formatted for is unchanged.
+ * mi_display.generation changes whenever the display description or any
+ * meta_info changes.
+ */
+#define PAINT_ROW_CACHE_SIZE  512   /* must be a power of 2 */
+
+typedef struct {
+   int   xoff;    /* where on the row the column starts */
+   int   width;   /* width of the column (and its text) */
+   int   field;   /* cinfo field shown, -1 if it's the filename */
+   int   text;    /* offset of the column's text in the row's text */
+} paint_column;
+
+typedef struct {
+   const meta_info  *mi;            /* NULL = unused */
+   unsigned int      generation;    /* of mi_display when formatted */
+   int               width;
+   int               hoffset;
+   int               ncolumns;
+   paint_column      columns[MI_NUM_CINFO];
+   char             *text;
+   size_t            textsize;
+} paint_row;
+
+static paint_row paint_row_cache[PAINT_ROW_CACHE_SIZE];
+
+/*
+ * What is currently painted on each row of the playlist window, so that
+ * paint_playlist() can skip rows that would come out the same.
+ */
+#define PAINT_ROW_PLAYING    0x01
+#define PAINT_ROW_REVERSE    0x02
+#define PAINT_ROW_INACTIVE   0x04
+
+typedef struct {
+   const meta_info  *mi;            /* NULL for rows past the last file */
+   unsigned int      generation;
+   int               width;
+   int               hoffset;
+   int               attrs;         /* PAINT_ROW_* above */
+} paint_shown;
+
+static paint_shown *playlist_shown = NULL;
+static int          playlist_nshown = 0;
+static WINDOW      *playlist_shown_win = NULL;
+static int          playlist_shown_w = 0;
+
+/* forget what's on the playlist window, so it is repainted in full */
+void
+paint_playlist_invalidate()
+{
+   playlist_shown_win = NULL;
+}
+
+/* a string of at least n spaces */
+static const char *
+paint_blanks(int n)
+{
+   static char *blanks = NULL;
+   static int   nblanks = 0;
+
+   if (n > nblanks) {
+      if ((blanks = realloc(blanks, n + 1)) == NULL)
+         err(1, "%s: realloc failed", __FUNCTION__);
+      memset(blanks, ' ', n);
+      blanks[n] = '\0';
+      nblanks = n;
+   }
+
+   return blanks;
+}
+
+/* copy s into dest as a column of the given width & alignment */
+static void
+paint_format(char *dest, const char *s, int width, Direction align)
+{
+   int len;
+
+   len = strlen(s);
+   if (len > width)
+      len = width;
+
+   if (align == LEFT) {
+      memcpy(dest, s, len);
+      memset(dest + len, ' ', width - len);
+   } else {
+      memset(dest, ' ', width - len);
+      memcpy(dest + width - len, s, len);
+   }
+}
+
+/* get the formatted row of a file, from the cache if possible */
+static const paint_row *
+paint_row_get(const meta_info *mi, int width, int hoffset)
+{
+   paint_column *c;
+   paint_row    *r;
+   bool          hasinfo;
+   const char   *str;
+   size_t        need;
+   int           col, colwidth, xoff, hoff, strhoff, len, text;
+
+   r = &paint_row_cache[((uintptr_t) mi / sizeof(void*))
+      & (PAINT_ROW_CACHE_SIZE - 1)];
+
+   if (r->mi == mi && r->generation == mi_display.generation
+   &&  r->width == width && r->hoffset == hoffset)
+      return r;
+
+   need = (size_t) width * MI_NUM_CINFO + 1;
+   if (r->textsize < need) {
+      if ((r->text = realloc(r->text, need)) == NULL)
+         err(1, "%s: realloc failed", __FUNCTION__);
+      r->textsize = need;
+   }
+
+   r->mi = mi;
+   r->generation = mi_display.generation;
+   r->width = width;
+   r->hoffset = hoffset;
+   r->ncolumns = 0;
+
+   /* does the file have any meta-info? */
+   hasinfo = false;
+   for (col = 0; col < mi_display.nfields; col++) {
+      if (mi_cinfo(mi, mi_display.order[col]) != NULL)
+         hasinfo = true;
+   }
+
+   /* if there's no meta info, just show filename */
+   if (!hasinfo) {
+      c = &(r->columns[r->ncolumns++]);
+      c->xoff = 0;
+      c->width = width;
+      c->field = -1;
+      c->text = 0;
+      paint_format(r->text, mi->filename, width, LEFT);
+      return r;
+   }
+
+   /* loop through all fields of file and format each ... */
+   xoff = 0;
+   hoff = hoffset;
+   text = 0;
+   for (col = 0; col < mi_display.nfields; col++) {
+
+      /* is horizontal offset big enough to skip this field? */
+      if (hoff >= mi_display.widths[col]) {
+         hoff -= mi_display.widths[col];
+         continue;
+      }
+
+      /* field shown off the screen? */
+      if (xoff >= width)
+         continue;
+
+      /* get string to show (str) */
+      str = mi_cinfo(mi, mi_display.order[col]);
+
+      /* a file's length is unknown until found with -e update -p */
+      if (str == NULL && mi_display.order[col] == MI_CINFO_LENGTH
+      &&  !mi->is_url)
+         str = PAINT_LENGTH_PENDING;
+
+      /* determine horizontal offset (strhoff) to apply to str */
+      strhoff = 0;
+      if (str != NULL) {
+         len = strlen(str);
+         if (mi_display.align[col] == LEFT) {
+            if (hoff > len)
+               strhoff = len;
+            else
+               strhoff = hoff;
+         } else {
+            if (len > mi_display.widths[col])
+               strhoff = hoff;
+            else if (hoff < mi_display.widths[col] - len)
+               strhoff = 0;
+            else
+               strhoff = hoff - (mi_display.widths[col] - len);
+
+            if (strhoff > len)
+               strhoff = len;
+         }
+      }
+
+      /* determine width of this field */
+      colwidth = mi_display.widths[col] - hoff;
+      if (xoff + colwidth > width)
+         colwidth = width - xoff;
+
+      c = &(r->columns[r->ncolumns++]);
+      c->xoff = xoff;
+      c->width = colwidth;
+      c->field = mi_display.order[col];
+      c->text = text;
+      paint_format(r->text + text, (str == NULL ? " " : str + strhoff),
+         colwidth, mi_display.align[col]);
+
+      text += colwidth;
+      xoff += 1 + colwidth; /* +1 for space between columns */
+      hoff = 0;
+   }
+
+   return r;
 }
 
 /* paint the playlist window */
 void
 paint_playlist()
 {
-   playlist   *plist;
-   bool        hasinfo;
-   bool        visual;
-   char       *str;
-   int         findex, row, col, colwidth;
-   int         xoff, hoff, strhoff;
-   int         cattr;
-
+   const paint_row    *r;
+   const paint_column *c;
+   const meta_info    *mi;
+   paint_shown        *shown;
+   playlist           *plist;
+   bool                visual, playing;
+   int                 findex, row, col, attrs, cattr;
 
    showing_file_info = false;
    plist = viewing_playlist;
 
-   werase(ui.playlist->cwin);
+   /* is what's painted on the window still known? */
+   if (playlist_shown_win != ui.playlist->cwin
+   ||  playlist_shown_w != ui.playlist->w
+   ||  playlist_nshown != ui.playlist->h) {
+      playlist_shown = realloc(playlist_shown,
+         (ui.playlist->h + 1) * sizeof(paint_shown));
+      if (playlist_shown == NULL)
+         err(1, "%s: realloc failed", __FUNCTION__);
+
+      werase(ui.playlist->cwin);
+      playlist_shown_win = ui.playlist->cwin;
+      playlist_shown_w = ui.playlist->w;
+      playlist_nshown = ui.playlist->h;
+      for (row = 0; row < playlist_nshown; row++)
+         playlist_shown[row].attrs = -1;
+   }
 
    for (row = 0; row < ui.playlist->h; row++) {
 
       /* get index of file to show */
       findex = row + ui.playlist->voffset;
+      mi = (findex < plist->nfiles ? playlist_file(plist, findex) : NULL);
 
       /* determine if visual mode row */
       visual = false;
@@ -309,127 +542,92 @@ paint_playlist()
             visual = true;
       }
 
+      playing = (plist == playing_playlist && findex == player_info.qidx);
+
+      attrs = 0;
+      if (playing)
+         attrs |= PAINT_ROW_PLAYING;
+      if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual)
+         attrs |= PAINT_ROW_REVERSE;
+      if (row == ui.playlist->crow && ui.active != ui.playlist)
+         attrs |= PAINT_ROW_INACTIVE;
+
+      /* skip rows that are painted already */
+      shown = &playlist_shown[row];
+      if (shown->attrs == attrs && shown->mi == mi
+      &&  (mi == NULL || (shown->generation == mi_display.generation
+                       && shown->width == ui.playlist->w
+                       && shown->hoffset == ui.playlist->hoffset)))
+         continue;
+
+      shown->mi = mi;
+      shown->attrs = attrs;
+      shown->generation = mi_display.generation;
+      shown->width = ui.playlist->w;
+      shown->hoffset = ui.playlist->hoffset;
+
+      r = (mi == NULL ? NULL : paint_row_get(mi, ui.playlist->w,
+         ui.playlist->hoffset));
+
       /* apply row attributes */
-       wattron(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
+      wattron(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
 
-      if (plist == playing_playlist && findex == player_info.qidx)
+      if (attrs & PAINT_ROW_PLAYING)
          wattron(ui.playlist->cwin, COLOR_PAIR(colors.playing_playlist));
 
-      if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual)
+      if (attrs & PAINT_ROW_REVERSE)
          wattron(ui.playlist->cwin, A_REVERSE);
 
-      if (row == ui.playlist->crow && ui.active != ui.playlist)
+      if (attrs & PAINT_ROW_INACTIVE)
          wattron(ui.playlist->cwin, COLOR_PAIR(colors.current_inactive));
 
-      if (findex >= plist->nfiles)
-         wattron(ui.playlist->cwin, COLOR_PAIR(colors.tildas_playlist));
-
       /* draw the row */
-      if (findex >= plist->nfiles)
-         mvwprintw(ui.playlist->cwin, row, 0, "~");
-      else {
+      if (r == NULL) {
+         wattron(ui.playlist->cwin, COLOR_PAIR(colors.tildas_playlist));
+         wmove(ui.playlist->cwin, row, 0);
+         wclrtoeol(ui.playlist->cwin);
+         mvwaddstr(ui.playlist->cwin, row, 0, "~");
+         wattroff(ui.playlist->cwin, COLOR_PAIR(colors.tildas_playlist));
+      } else {
          /* this acheives the A_REVERSE attribute spanning the entire row */
-         mvwprintw(ui.playlist->cwin, row, 0,
-            num2fmt(ui.playlist->w, LEFT), " ");
-
-         /* does the file have any meta-info? */
-         hasinfo = false;
-         for (col = 0; col < mi_display.nfields; col++) {
-            if (plist->files[findex]->cinfo[mi_display.order[col]] != NULL)
-               hasinfo = true;
-         }
+         mvwaddnstr(ui.playlist->cwin, row, 0,
+            paint_blanks(ui.playlist->w), ui.playlist->w);
 
-         /* if there's no meta info, just show filename */
-         if (!hasinfo) {
-            mvwprintw(ui.playlist->cwin, row, 0, num2fmt(ui.playlist->w, LEFT),
-               plist->files[findex]->filename);
-         } else {
+         for (col = 0; col < r->ncolumns; col++) {
+            c = &(r->columns[col]);
 
-            /* loop through all fields of file and display each ... */
-            xoff = 0;
-            hoff = ui.playlist->hoffset;
-            for (col = 0; col < mi_display.nfields; col++) {
-
-               /* is horizontal offset big enough to skip this field? */
-               if (hoff >= mi_display.widths[col]) {
-                  hoff -= mi_display.widths[col];
-                  continue;
-               }
-
-               /* field shown off the screen? */
-               if (xoff >= ui.playlist->w)
-                  continue;
+            /* apply column attribute (only if file is NOT playing) */
+            cattr = 0;
+            if (!playing && c->field != -1 && colors.cinfos_set[c->field]) {
+               cattr = COLOR_PAIR(colors.cinfos[c->field]);
+               wattron(ui.playlist->cwin, cattr);
+            }
 
-               /* get string to show (str) */
-               str = plist->files[findex]->cinfo[mi_display.order[col]];
+            mvwaddnstr(ui.playlist->cwin, row, c->xoff, r->text + c->text,
+               c->width);
 
-               /* determine horizontal offset (strhoff) to apply to str */
-               strhoff = 0;
-               if (str != NULL) {
-                  if (mi_display.align[col] == LEFT) {
-                     if (hoff > (int)strlen(str))
-                        strhoff = strlen(str);
-                     else
-                        strhoff = hoff;
-                  } else {
-                     if ((int)strlen(str) > mi_display.widths[col])
-                        strhoff = hoff;
-                     else if (hoff < mi_display.widths[col] - (int)strlen(str))
-                        strhoff = 0;
-                     else
-                        strhoff = hoff - (mi_display.widths[col] - strlen(str));
-
-                     if (strhoff > (int)strlen(str))
-                        strhoff = strlen(str);
-                  }
-               }
-
-               /* apply column attribute (only if file is NOT playing) */
-               cattr = COLOR_PAIR(colors.cinfos[mi_display.order[col]]);
-               if ((plist != playing_playlist || findex != player_info.qidx)
-               && colors.cinfos_set[mi_display.order[col]])
-                  wattron(ui.playlist->cwin, cattr);
-
-               /* determine width of this field */
-               colwidth = mi_display.widths[col] - hoff;
-               if (xoff + colwidth > ui.playlist->w)
-                  colwidth = ui.playlist->w - xoff;
-
-               /* print the column */
-               mvwprintw(ui.playlist->cwin, row, xoff,
-                  num2fmt(colwidth, mi_display.align[col]),
-                  (str == NULL ? " " : str + strhoff));
-
-               /* un-apply column attribute */
-               if ((plist != playing_playlist || findex != player_info.qidx)
-               && colors.cinfos_set[mi_display.order[col]]) {
-                  wattroff(ui.playlist->cwin, cattr);
-                  wattron(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
-               }
-
-               xoff += 1 + colwidth; /* +1 for space between columns */
-               hoff = 0;
+            /* un-apply column attribute */
+            if (cattr != 0) {
+               wattroff(ui.playlist->cwin, cattr);
+               wattron(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
             }
          }
       }
 
       /* un-apply row attributes */
-      if (findex >= plist->nfiles)
-         wattroff(ui.playlist->cwin, COLOR_PAIR(colors.tildas_playlist));
-
-      if ((row == ui.playlist->crow && ui.active == ui.playlist) || visual)
+      if (attrs & PAINT_ROW_REVERSE)
          wattroff(ui.playlist->cwin, A_REVERSE);
 
-      if (row == ui.playlist->crow && ui.active != ui.playlist)
+      if (attrs & PAINT_ROW_INACTIVE)
          wattroff(ui.playlist->cwin, COLOR_PAIR(colors.current_inactive));
 
-      if (plist == playing_playlist && findex == player_info.qidx)
+      if (attrs & PAINT_ROW_PLAYING)
          wattroff(ui.playlist->cwin, COLOR_PAIR(colors.playing_playlist));
 
       wattroff(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
    }
 
-   wrefresh(ui.playlist->cwin);
+   wnoutrefresh(ui.playlist->cwin);
 }
 
 /* paint borders between windows */
@@ -446,7 +644,7 @@ paint_borders()
       mvaddch(1, ui.lwidth, ACS_TTEE);
    }
    wattroff(stdscr, COLOR_PAIR(colors.bars));
-   refresh();
+   wnoutrefresh(stdscr);
 }
 
 /* paint individual file info in playlist window */
@@ -454,12 +652,14 @@ void
 paint_playlist_file_info(const meta_info *m)
 {
    struct tm *ltime;
+   playlist *p;
    char stime[255];
-   int row, nrows, i;
-   int w;
+   int row, nrows, i, j;
+   int w, h, count, nplaylists, nshown;
 
    w = getmaxx(ui.playlist->cwin);
    werase(ui.playlist->cwin);
+   paint_playlist_invalidate();
    wattron(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
 
    /* figure out number of rows filename will take */
@@ -479,7 +679,7 @@ paint_playlist_file_info(const meta_info *m)
    mvwprintw(ui.playlist->cwin, row++, 0, "Meta-Information:");
    for (i = 0; i < MI_NUM_CINFO; i++) {
       mvwprintw(ui.playlist->cwin, row++, 0, "%10s: \"%s\"",
-         MI_CINFO_NAMES[i], m->cinfo[i]);
+         MI_CINFO_NAMES[i], mi_cinfo(m, i));
    }
 
    row += 1;
@@ -493,22 +693,91 @@ paint_playlist_file_info(const meta_info *m)
 
    ltime = localtime(&(m->last_updated));
    strftime(stime, sizeof(stime), "%d %B %Y at %H:%M:%S", ltime);
-   mvwprintw(ui.playlist->cwin, row, 0, "%15s: %s", "Last Updated", stime);
+   mvwprintw(ui.playlist->cwin, row++, 0, "%15s: %s", "Last Updated", stime);
+
+   row += 1;
+
+   /* paint the playlists holding the file (each once, from its refs) */
+   mvwprintw(ui.playlist->cwin, row++, 0, "Playlists:");
+   h = getmaxy(ui.playlist->cwin);
+   nshown = nplaylists = 0;
+   for (i = 0; i < m->nrefs; i++) {
+      p = m->refs[i].p;
+      if (p == mdb.filter_results)
+         continue;
+
+      /* list each playlist once, at its first ref */
+      for (j = 0; j < i && m->refs[j].p != p; j++)
+         ;
+      if (j < i)
+         continue;
+
+      count = 0;
+      for (j = i; j < m->nrefs; j++) {
+         if (m->refs[j].p == p)
+            count++;
+      }
+
+      /* keep the last row for the "more" line */
+      nplaylists++;
+      if (row >= h - 1)
+         continue;
+
+      if (count > 1)
+         mvwprintw(ui.playlist->cwin, row++, 0, "   %s (%d times)", p->name,
+            count);
+      else
+         mvwprintw(ui.playlist->cwin, row++, 0, "   %s", p->name);
+      nshown++;
+   }
+
+   if (nplaylists == 0)
+      mvwprintw(ui.playlist->cwin, row, 0, "   (none)");
+   else if (nshown < nplaylists)
+      mvwprintw(ui.playlist->cwin, row, 0, "   ... and %d more",
+         nplaylists - nshown);
 
    wattroff(ui.playlist->cwin, COLOR_PAIR(colors.playlist));
-   wrefresh(ui.playlist->cwin);
+   wnoutrefresh(ui.playlist->cwin);
    showing_file_info = true;
 }
 
-/* paint all windows */
+/* regions marked by paint_damage() and not yet repainted */
+static int paint_damaged = 0;
+
+/* mark regions of the screen as needing a repaint at the next flush */
+void
+paint_damage(int regions)
+{
+   paint_damaged |= regions;
+}
+
+/*
+ * Repaint every damaged region and push the result to the terminal with a
+ * single doupdate(3).  Windows painted directly since the last flush (such
+ * as file info) are included in the same update.  The borders live in
+ * stdscr, which covers the whole screen, so they go out first.
+ */
+void
+paint_flush()
+{
+   int regions = paint_damaged;
+
+   paint_damaged = 0;
+   if (regions & PAINT_BORDERS)  paint_borders();
+   if (regions & PAINT_PLAYER)   paint_player();
+   if (regions & PAINT_STATUS)   paint_status_bar();
+   if (regions & PAINT_LIBRARY)  paint_library();
+   if (regions & PAINT_PLAYLIST) paint_playlist();
+   doupdate();
+}
+
+/* repaint all windows from scratch at the next flush */
 void
 paint_all()
 {
-   paint_borders();
-   paint_player();
-   paint_status_bar();
-   paint_library();
-   paint_playlist();
+   paint_playlist_invalidate();
+   paint_damage(PAINT_ALL);
 }
 
 /*
@@ -531,6 +800,7 @@ paint_error(char *fmt, ...)
    beep();
    wattroff(ui.command, COLOR_PAIR(colors.errors));
    wrefresh(ui.command);
+   paint_damaged &= ~PAINT_STATUS;   /* the message replaces the status bar */
 }
 
 /*
@@ -552,6 +822,7 @@ paint_message(char *fmt, ...)
 
    wattroff(ui.command, COLOR_PAIR(colors.messages));
    wrefresh(ui.command);
+   paint_damaged &= ~PAINT_STATUS;   /* the message replaces the status bar */
 }
 
 /*
@@ -66,11 +66,28 @@ typedef struct {
 } _colors;
 extern _colors colors;
 
+/*
+ * Screen regions that can be marked as damaged.  Handlers mark what they
+ * changed with paint_damage() and the main loop repaints all damaged
+ * regions at once with paint_flush(), so a burst of changes results in a
+ * single terminal update.
+ */
+#define PAINT_BORDERS   0x01
+#define PAINT_PLAYER    0x02
+#define PAINT_STATUS    0x04
+#define PAINT_LIBRARY   0x08
+#define PAINT_PLAYLIST  0x10
+#define PAINT_ALL       0x1f
+
+void paint_damage(int regions);
+void paint_flush();
+
 /* routines for painting each window */
 void paint_status_bar();
 void paint_player();
 void paint_library();
 void paint_playlist();
+void paint_playlist_invalidate();
 void paint_borders();
 void paint_all();
 
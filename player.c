@@ -21,6 +21,9 @@ player_backend_t player;
 player_info_t player_info;
 
 
+/* when the next position query is due (see player_monitor) */
+static struct timespec poll_next;
+
 /* callbacks */
 static void callback_playnext() { player_skip_song(1); }
 
@@ -65,10 +68,13 @@ const player_backend_t PlayerBackends[] = {
       mplayer_set_callback_notice,
       mplayer_set_callback_error,
       mplayer_set_callback_fatal,
-      mplayer_monitor
+      mplayer_monitor,
+      mplayer_poll,
+      mplayer_fd
    },  
    { 0, "", false, NULL, NULL, NULL, NULL,
-      NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+      NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+      NULL, NULL }
 };
 const size_t PlayerBackendsSize = sizeof(PlayerBackends) / sizeof(player_backend_t);
 
@@ -134,7 +140,7 @@ player_play()
    if (player_info.qidx < 0 || player_info.qidx > player_info.queue->nfiles)
       errx(1, "player_play: qidx %i out-of-range", player_info.qidx);
 
-   player.play(player_info.queue->files[player_info.qidx]->filename);
+   player.play(playlist_file(player_info.queue, player_info.qidx)->filename);
 
 }
 
@@ -206,9 +212,55 @@ player_volume_step(float percent)
    player.volume_step(percent);
 }
 
+int
+player_fd()
+{
+   if (player.fd == NULL)
+      return -1;
+
+   return player.fd();
+}
+
+int
+player_poll_timeout()
+{
+   struct timespec now;
+   long ms;
+
+   if (!player.playing() || player.paused())
+      return -1;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   ms = (poll_next.tv_sec - now.tv_sec) * 1000
+      + (poll_next.tv_nsec - now.tv_nsec) / 1000000;
+
+   if (ms < 0)
+      return 0;
+   if (ms > PLAYER_POLL_INTERVAL)
+      return PLAYER_POLL_INTERVAL;
+   return ms;
+}
+
 void
 player_monitor(void)
 {
+   struct timespec now;
+
+   /* handle whatever the player has said so far */
    player.monitor();
+
+   /* and ask for the position again if it's time */
+   if (player_poll_timeout() != 0)
+      return;
+
+   player.poll();
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   poll_next.tv_sec  = now.tv_sec + PLAYER_POLL_INTERVAL / 1000;
+   poll_next.tv_nsec = now.tv_nsec + (PLAYER_POLL_INTERVAL % 1000) * 1000000;
+   if (poll_next.tv_nsec >= 1000000000) {
+      poll_next.tv_sec++;
+      poll_next.tv_nsec -= 1000000000;
+   }
 }
 
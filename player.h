@@ -54,7 +54,18 @@ void player_seek(int seconds);
 void player_skip_song(int num);
 void player_volume_step(float percent);
 
-/* This is called periodically to monitor the backend player */
+/*
+ * Monitoring the backend player.  player_fd() is the descriptor the backend
+ * writes its answers to (-1 if none), which the main loop waits on along
+ * with the keyboard.  player_monitor() consumes those answers and, while a
+ * song is playing, queries the position every PLAYER_POLL_INTERVAL ms.
+ * player_poll_timeout() is the number of ms until the next query is due, or
+ * -1 if the player is idle and nothing needs polling.
+ */
+#define PLAYER_POLL_INTERVAL  500
+
+int  player_fd();
+int  player_poll_timeout();
 void player_monitor();
 
 
@@ -98,8 +109,10 @@ typedef struct {
    void (*set_callback_error)(void (*f)(char *, ...));
    void (*set_callback_fatal)(void (*f)(char *, ...));
 
-   /* monitor function */
+   /* monitor functions */
    void (*monitor)(void);
+   void (*poll)(void);
+   int  (*fd)(void);
 } player_backend_t;
 extern player_backend_t player;
 
@@ -25,6 +25,25 @@ void (*mplayer_callback_error)(char *, ...) = NULL;
 void (*mplayer_callback_fatal)(char *, ...) = NULL;
 
 
+/*
+ * The properties asked for with get_property.  mplayer answers each query
+ * once (with ANS_<property>=, or ANS_ERROR= if it's unavailable), in the
+ * order they were sent, so the queries not yet answered are kept in that
+ * order to know what each answer, and in particular each failure, is for.
+ */
+typedef enum {
+   MPLAYER_QUERY_TIME_POS,
+   MPLAYER_QUERY_VOLUME
+} mplayer_query_kind;
+
+typedef struct {
+   mplayer_query_kind   kind;
+   bool                 stale;   /* sent before the current song was loaded */
+} mplayer_query;
+
+/* never more than a few are outstanding unless mplayer stops answering */
+#define MPLAYER_QUERIES_MAX  64
+
 /* record keeping */
 static struct {
    /* exported to player interface */
@@ -37,9 +56,33 @@ static struct {
    pid_t    pid;
    int      pipe_read;
    int      pipe_write;
+   bool     pipe_eof;
    const char *current_song;
+
+   /* queries sent but not answered, a ring from the oldest (head) on */
+   mplayer_query  queries[MPLAYER_QUERIES_MAX];
+   int            qhead;
+   int            qcount;
 } mplayer_state;
 
+/*
+ * Output from the child is read into this buffer and parsed a line at a
+ * time.  Whatever follows the last newline is kept for the next read.
+ */
+#define MPLAYER_LINE_MAX 1024
+static struct {
+   char     buf[MPLAYER_LINE_MAX];
+   size_t   len;
+} mplayer_reader;
+
+/* the events found in slave-mode output that vitunes cares about */
+typedef enum {
+   MPLAYER_EVENT_NONE,
+   MPLAYER_EVENT_POSITION,    /* ANS_time_pos=<seconds> */
+   MPLAYER_EVENT_VOLUME,      /* ANS_volume=<percent> */
+   MPLAYER_EVENT_UNAVAILABLE  /* ANS_ERROR=PROPERTY_UNAVAILABLE */
+} mplayer_event;
+
 bool restarting = false;
 
 
@@ -52,6 +95,37 @@ mplayer_send_cmd(const char *cmd)
    write(mplayer_state.pipe_write, cmd, strlen(cmd));
 }
 
+/* note a query sent.  if mplayer has stopped answering, forget the oldest */
+static void
+mplayer_query_push(mplayer_query_kind kind)
+{
+   mplayer_query *q;
+
+   if (mplayer_state.qcount == MPLAYER_QUERIES_MAX) {
+      mplayer_state.qhead = (mplayer_state.qhead + 1) % MPLAYER_QUERIES_MAX;
+      mplayer_state.qcount--;
+   }
+
+   q = &(mplayer_state.queries[(mplayer_state.qhead + mplayer_state.qcount)
+      % MPLAYER_QUERIES_MAX]);
+   q->kind = kind;
+   q->stale = false;
+   mplayer_state.qcount++;
+}
+
+/* take the oldest query not yet answered, false if there are none */
+static bool
+mplayer_query_pop(mplayer_query *q)
+{
+   if (mplayer_state.qcount == 0)
+      return false;
+
+   *q = mplayer_state.queries[mplayer_state.qhead];
+   mplayer_state.qhead = (mplayer_state.qhead + 1) % MPLAYER_QUERIES_MAX;
+   mplayer_state.qcount--;
+   return true;
+}
+
 void
 mplayer_start()
 {
@@ -96,6 +170,10 @@ mplayer_start()
    /* setup player pipes */
    mplayer_state.pipe_read  = pread[0];
    mplayer_state.pipe_write = pwrite[1];
+   mplayer_state.pipe_eof   = false;
+   mplayer_state.qhead      = 0;
+   mplayer_state.qcount     = 0;
+   mplayer_reader.len = 0;
 
    /* setup read pipe to media player as non-blocking */
    if ((flags = fcntl(mplayer_state.pipe_read, F_GETFL, 0)) == -1)
@@ -179,6 +257,7 @@ mplayer_play(const char *file)
 {
    static const char *cmd_fmt = "\nloadfile \"%s\" 0\nget_property time_pos\n";
    char *cmd;
+   int   i;
 
    asprintf(&cmd, cmd_fmt, file);
    if (cmd == NULL)
@@ -187,6 +266,12 @@ mplayer_play(const char *file)
    mplayer_send_cmd(cmd);
    free(cmd);
 
+   /* answers to queries about the previous song no longer matter */
+   for (i = 0; i < mplayer_state.qcount; i++)
+      mplayer_state.queries[(mplayer_state.qhead + i) % MPLAYER_QUERIES_MAX]
+         .stale = true;
+   mplayer_query_push(MPLAYER_QUERY_TIME_POS);
+
    mplayer_state.position = 0;
    mplayer_state.playing  = true;
    mplayer_state.paused   = false;
@@ -231,6 +316,7 @@ mplayer_seek(int seconds)
 
    mplayer_send_cmd(cmd);
    free(cmd);
+   mplayer_query_push(MPLAYER_QUERY_TIME_POS);
 
    if (mplayer_state.paused)
       mplayer_state.paused = false;
@@ -296,6 +382,7 @@ mplayer_volume_query()
       return;
 
    mplayer_send_cmd(cmd);
+   mplayer_query_push(MPLAYER_QUERY_VOLUME);
 }
 
 /* query functions */
@@ -331,65 +418,237 @@ mplayer_set_callback_fatal(void (*f)(char *, ...))
 
 
 /*****************************************************************************
- * Player monitor function, called repeatedly via the signal handler in the
- * vitunes main loop.
+ * Player monitor functions.
  *
- * This communicates with the child process periodically to accomplish the
- * following:
- *    1. If the player is currently playing a song, determine the position
- *       (in seconds) into the playback
- *    2. When the player finishes playing a song, it starts playing the next
- *       song, according to the current playmode.
+ * The read end of the pipe from the child process is watched by the vitunes
+ * main loop, and mplayer_monitor() is called whenever the loop wakes up to
+ * consume the child's answers.  Each complete line is parsed once into an
+ * event:
+ *    1. If the player is currently playing a song, the answer to a position
+ *       query gives the position (in seconds) into the playback
+ *    2. When the player finishes playing a song, the position query fails,
+ *       and the next song is started according to the current playmode.
+ *
+ * mplayer says nothing on its own when a song ends, so while a song is
+ * playing the main loop calls mplayer_poll() periodically to ask for the
+ * position.  Nothing is sent while idle or paused.
  ****************************************************************************/
+
+/* parse one line of slave-mode output */
+static mplayer_event
+mplayer_parse_line(const char *line, float *value)
+{
+   static const char *answer_pos  = "ANS_time_pos=";
+   static const char *answer_vol  = "ANS_volume=";
+   static const char *answer_fail = "ANS_ERROR=PROPERTY_UNAVAILABLE";
+   const char *s;
+   char *end;
+
+   if (strncmp(line, answer_fail, strlen(answer_fail)) == 0)
+      return MPLAYER_EVENT_UNAVAILABLE;
+
+   if (strncmp(line, answer_pos, strlen(answer_pos)) == 0) {
+      s = line + strlen(answer_pos);
+      *value = strtof(s, &end);
+      return (end == s ? MPLAYER_EVENT_NONE : MPLAYER_EVENT_POSITION);
+   }
+
+   if (strncmp(line, answer_vol, strlen(answer_vol)) == 0) {
+      s = line + strlen(answer_vol);
+      *value = strtof(s, &end);
+      return (end == s ? MPLAYER_EVENT_NONE : MPLAYER_EVENT_VOLUME);
+   }
+
+   return MPLAYER_EVENT_NONE;
+}
+
+/*
+ * the query an answer is for: the oldest one, as long as that asked for the
+ * same property.  those before the first of the same kind were answered
+ * with something not understood, so they are dropped.
+ */
+static bool
+mplayer_query_answered(mplayer_query_kind kind, mplayer_query *q)
+{
+   while (mplayer_query_pop(q)) {
+      if (q->kind == kind)
+         return true;
+   }
+   return false;
+}
+
+/* act on one event from the child */
+static void
+mplayer_dispatch(mplayer_event event, float value)
+{
+   mplayer_query q;
+
+   switch (event) {
+   case MPLAYER_EVENT_VOLUME:
+      if (mplayer_query_answered(MPLAYER_QUERY_VOLUME, &q))
+         mplayer_state.volume = value;
+      break;
+
+   case MPLAYER_EVENT_POSITION:
+      if (!mplayer_query_answered(MPLAYER_QUERY_TIME_POS, &q) || q.stale)
+         break;
+
+      if (mplayer_state.playing && !mplayer_state.paused)
+         mplayer_state.position = value;
+      break;
+
+   case MPLAYER_EVENT_UNAVAILABLE:
+      /* only a failed time_pos query means the song has ended */
+      if (!mplayer_query_pop(&q) || q.kind != MPLAYER_QUERY_TIME_POS
+      ||  q.stale)
+         break;
+
+      if (mplayer_state.playing && !mplayer_state.paused
+      &&  mplayer_callback_playnext != NULL)
+         mplayer_callback_playnext();  /* reached end of playback */
+      break;
+
+   case MPLAYER_EVENT_NONE:
+      break;
+   }
+}
+
 void
 mplayer_monitor()
 {
-   static const char *query_cmd   = "\nget_property time_pos\n";
-   static const char *answer_fail = "ANS_ERROR=PROPERTY_UNAVAILABLE";
-   static const char *answer_good = "ANS_time_pos";
-   static char response[1000];  /* mplayer can be noisy */
-   char *s;
-   int   nbytes;
+   mplayer_event event;
+   ssize_t nbytes;
+   char   *line, *nl;
+   float   value;
 
-   /* in this case, nothing to monitor */
-   if (!mplayer_state.playing || mplayer_state.paused)
+   if (mplayer_state.pipe_eof)
       return;
 
-   /* read any output from the player */
-   bzero(response, sizeof(response));
-   nbytes = read(mplayer_state.pipe_read, &response, sizeof(response));
+   /* append any output from the player after the partial line kept */
+   nbytes = read(mplayer_state.pipe_read, mplayer_reader.buf + mplayer_reader.len,
+      sizeof(mplayer_reader.buf) - mplayer_reader.len - 1);
 
-   if (nbytes == -1 && errno == EAGAIN)
+   if (nbytes == -1)
       return;
 
-   response[nbytes + 1] = '\0';
-
-   /* case: reached end of playback for a given file */
-   if (strstr(response, answer_fail) != NULL) {
-      if (mplayer_callback_playnext != NULL) mplayer_callback_playnext();
+   /* the child closed its end; SIGCHLD handling takes it from here */
+   if (nbytes == 0) {
+      mplayer_state.pipe_eof = true;
       return;
    }
 
-   /* case: continue in playing current file.  update position */
-   if ((s = strstr(response, answer_good)) != NULL) {
-      while (strstr(s + 1, answer_good) != NULL)
-         s = strstr(s + 1, answer_good);
-
-      if (sscanf(s, "ANS_time_pos=%f", &mplayer_state.position) != 1)
-         errx(1, "player_monitor: player child is misbehaving.");
+   mplayer_reader.len += nbytes;
+   mplayer_reader.buf[mplayer_reader.len] = '\0';
 
+   /* parse and dispatch each complete line */
+   line = mplayer_reader.buf;
+   while ((nl = strchr(line, '\n')) != NULL) {
+      *nl = '\0';
+      event = mplayer_parse_line(line, &value);
+      mplayer_dispatch(event, value);
+      line = nl + 1;
    }
 
+   /* keep the partial line.  one that fills the buffer is just noise. */
+   mplayer_reader.len -= line - mplayer_reader.buf;
+   if (mplayer_reader.len == sizeof(mplayer_reader.buf) - 1)
+      mplayer_reader.len = 0;
+
+   memmove(mplayer_reader.buf, line, mplayer_reader.len);
+}
+
+void
+mplayer_poll()
+{
+   static const char *query_cmd = "\nget_property time_pos\n";
+
+   if (!mplayer_state.playing || mplayer_state.paused)
+      return;
+
    mplayer_send_cmd(query_cmd);
+   mplayer_query_push(MPLAYER_QUERY_TIME_POS);
+}
 
-   /* check for recent volume */
-   static const char *volume_good  = "ANS_volume";
-   if ((s = strstr(response, volume_good)) != NULL) {
-      while (strstr(s + 1, volume_good) != NULL)
-         s = strstr(s + 1, volume_good);
+int
+mplayer_fd()
+{
+   return (mplayer_state.pipe_eof ? -1 : mplayer_state.pipe_read);
+}
 
-      if (sscanf(s, "ANS_volume=%f", &mplayer_state.volume) != 1)
-         errx(1, "player_monitor: player child is misbehaving.");
+int
+mplayer_length(const char *file)
+{
+   char   *args[sizeof(MPLAYER_PROBE_ARGS) / sizeof(char*) + 1];
+   char    line[MPLAYER_LINE_MAX];
+   char   *end;
+   double  length;
+   FILE   *fin;
+   pid_t   pid;
+   size_t  i, nargs;
+   int     fds[2];
+   int     devnull, status;
+
+   /* the filename goes where the NULL was */
+   nargs = sizeof(MPLAYER_PROBE_ARGS) / sizeof(char*);
+   for (i = 0; i < nargs - 1; i++)
+      args[i] = MPLAYER_PROBE_ARGS[i];
+   args[i++] = (char *) file;
+   args[i] = NULL;
+
+   /*
+    * close-on-exec, so children of other threads don't hold this open.
+    * (another thread could fork between pipe() and fcntl(), but then the
+    * worst is a wait for that child to exit.)
+    */
+   if (pipe(fds) == -1)
+      return -1;
+   if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) == -1
+   ||  fcntl(fds[1], F_SETFD, FD_CLOEXEC) == -1) {
+      close(fds[0]);
+      close(fds[1]);
+      return -1;
    }
-}
 
+   switch (pid = fork()) {
+   case -1:
+      close(fds[0]);
+      close(fds[1]);
+      return -1;
+
+   case 0:  /* child process: only async-signal-safe calls until exec */
+      if ((devnull = open("/dev/null", O_RDWR)) == -1
+      ||  dup2(devnull, 0) == -1 || dup2(fds[1], 1) == -1
+      ||  dup2(devnull, 2) == -1)
+         _exit(1);
+
+      execvp(MPLAYER_PATH, args);
+      _exit(1);
+   }
+
+   /* Back to the parent... */
+   close(fds[1]);
+   if ((fin = fdopen(fds[0], "r")) == NULL) {
+      close(fds[0]);
+      waitpid(pid, &status, 0);
+      return -1;
+   }
+
+   /* read everything, so mplayer never blocks writing */
+   length = -1;
+   while (fgets(line, sizeof(line), fin) != NULL) {
+      if (strncmp(line, "ID_LENGTH=", 10) == 0) {
+         length = strtod(line + 10, &end);
+         if (end == line + 10)
+            length = -1;
+      }
+   }
+
+   fclose(fin);
+   while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+      continue;
+
+   if (length <= 0)
+      return -1;
+
+   return (int) (length + 0.5);
+}
@@ -57,5 +57,14 @@ void  mplayer_set_callback_error(void (*f)(char *, ...));
 void  mplayer_set_callback_fatal(void (*f)(char *, ...));
 
 void mplayer_monitor();
+void mplayer_poll();
+int  mplayer_fd();
+
+/*
+ * the play-length of a file in seconds, as reported by running mplayer on
+ * it with -identify (without playing it), or -1 if that didn't work.  this
+ * is independent of the playing mplayer, and may be called from any thread.
+ */
+int  mplayer_length(const char *file);
 
 #endif
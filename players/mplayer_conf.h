@@ -25,4 +25,10 @@ char *MPLAYER_ARGS[] = { "mplayer",
    NULL
 };
 
+/* for mplayer_length(), which runs this with the filename appended */
+char *MPLAYER_PROBE_ARGS[] = { "mplayer",
+   "-identify", "-frames", "0", "-vo", "null", "-ao", "null", "-quiet",
+   NULL
+};
+
 #endif
@@ -16,20 +16,176 @@
 
 #include "playlist.h"
 
-int history_size = DEFAULT_HISTORY_SIZE;
+int    history_size   = DEFAULT_HISTORY_SIZE;
+size_t history_budget = DEFAULT_HISTORY_BUDGET;
 
-void
-playlist_increase_capacity(playlist *p)
+static void playlist_history_record(playlist *p, short type, meta_info **f,
+   int loc, int size, playlist_slice *s);
+
+/*
+ * Give a playlist sharing its files a copy of its own, before changing it.
+ * If nothing else holds the slice and the files are all of it, the playlist
+ * simply takes them back.
+ */
+static void
+playlist_unshare(playlist *p)
+{
+   meta_info **files;
+   int         capacity;
+
+   if (p->shared == NULL)
+      return;
+
+   if (p->shared->refs == 1 && p->files == p->shared->files) {
+      free(p->shared);
+      p->shared = NULL;
+      return;
+   }
+
+   capacity = MAX(p->nfiles, PLAYLIST_CHUNK_SIZE);
+   if ((files = malloc(capacity * sizeof(meta_info*))) == NULL)
+      err(1, "%s: malloc(3) failed", __FUNCTION__);
+
+   memcpy(files, p->files, p->nfiles * sizeof(meta_info*));
+   playlist_slice_unref(p->shared);
+   p->shared = NULL;
+   p->files = files;
+   p->capacity = capacity;
+   p->gap = p->nfiles;
+}
+
+/*
+ * Make room for at least n files.  The capacity at least doubles each time,
+ * so adding n files one at a time costs O(n) copying in all.  The files
+ * after the gap are moved to the end of the new space, growing the gap.
+ */
+static void
+playlist_reserve(playlist *p, int n)
 {
    meta_info **new_files;
-   size_t      nbytes;
+   int         capacity, tail;
 
-   p->capacity += PLAYLIST_CHUNK_SIZE;
-   nbytes = p->capacity * sizeof(meta_info*);
-   if ((new_files = realloc(p->files, nbytes)) == NULL)
+   playlist_unshare(p);
+   if (n <= p->capacity)
+      return;
+
+   capacity = MAX(p->capacity * 2, PLAYLIST_CHUNK_SIZE);
+   if (capacity < n)
+      capacity = n;
+
+   new_files = realloc(p->files, capacity * sizeof(meta_info*));
+   if (new_files == NULL)
       err(1, "%s: failed to realloc(3) files", __FUNCTION__);
 
+   tail = p->nfiles - p->gap;
+   memmove(new_files + capacity - tail, new_files + p->capacity - tail,
+      tail * sizeof(meta_info*));
+
    p->files = new_files;
+   p->capacity = capacity;
+}
+
+/*
+ * Move the gap to the given position, which costs the number of files
+ * between the old and new positions.
+ */
+static void
+playlist_move_gap(playlist *p, int pos)
+{
+   int gaplen;
+
+   playlist_unshare(p);
+   gaplen = p->capacity - p->nfiles;
+   if (pos < p->gap)
+      memmove(p->files + pos + gaplen, p->files + pos,
+         (p->gap - pos) * sizeof(meta_info*));
+   else if (pos > p->gap)
+      memmove(p->files + p->gap, p->files + p->gap + gaplen,
+         (pos - p->gap) * sizeof(meta_info*));
+
+   p->gap = pos;
+}
+
+/*
+ * Return all of the files of a playlist as a plain array, by moving the gap
+ * to the end.  The array may be reordered in place (to sort it, say) but is
+ * only good until the playlist is next changed.
+ */
+meta_info **
+playlist_files(playlist *p)
+{
+   playlist_move_gap(p, p->nfiles);
+   return p->files;
+}
+
+/* add a ref to p at the given position to a file */
+static void
+playlist_ref_add(meta_info *mi, playlist *p, int pos)
+{
+   playlist_ref *refs;
+   int           capacity;
+
+   if (mi->nrefs == mi->refs_capacity) {
+      capacity = (mi->refs_capacity == 0 ? 4 : mi->refs_capacity * 2);
+      if ((refs = realloc(mi->refs, capacity * sizeof(playlist_ref))) == NULL)
+         err(1, "%s: realloc(3) failed", __FUNCTION__);
+
+      mi->refs = refs;
+      mi->refs_capacity = capacity;
+   }
+
+   mi->refs[mi->nrefs].p = p;
+   mi->refs[mi->nrefs].hint = pos;
+   mi->nrefs++;
+}
+
+/*
+ * Remove a ref to p from a file.  If the file is in p more than once, the
+ * one whose hint is closest to pos goes, which keeps the other hints good.
+ */
+static void
+playlist_ref_remove(meta_info *mi, const playlist *p, int pos)
+{
+   int i, best;
+
+   best = -1;
+   for (i = 0; i < mi->nrefs; i++) {
+      if (mi->refs[i].p == p && (best == -1
+      ||  abs(mi->refs[i].hint - pos) < abs(mi->refs[best].hint - pos)))
+         best = i;
+   }
+
+   if (best == -1)
+      errx(1, "%s: no ref to '%s'", __FUNCTION__, mi->filename);
+
+   mi->refs[best] = mi->refs[--mi->nrefs];
+   if (mi->nrefs == 0) {
+      free(mi->refs);
+      mi->refs = NULL;
+      mi->refs_capacity = 0;
+   }
+}
+
+/*
+ * Find the position of a file in a playlist, searching outwards from a hint.
+ * Returns -1 if it's not there.
+ */
+static int
+playlist_find_near(const playlist *p, const meta_info *mi, int hint)
+{
+   int d;
+
+   if (hint < 0) hint = 0;
+   if (hint >= p->nfiles) hint = p->nfiles - 1;
+
+   for (d = 0; hint - d >= 0 || hint + d < p->nfiles; d++) {
+      if (hint - d >= 0 && playlist_file(p, hint - d) == mi)
+         return hint - d;
+      if (hint + d < p->nfiles && playlist_file(p, hint + d) == mi)
+         return hint + d;
+   }
+
+   return -1;
 }
 
 /*
@@ -51,9 +207,20 @@ playlist_new(void)
    p->filename = NULL;
    p->name     = NULL;
    p->nfiles   = 0;
-   p->history  = playlist_history_new();
+   p->gap      = 0;
+   p->shared   = NULL;
+   p->history  = NULL;
+   p->hist_first   = 0;
+   p->hist_count   = 0;
    p->hist_present = -1;
+   p->hist_open    = false;
+   p->hist_prev    = NULL;
+   p->hist_next    = NULL;
    p->needs_saving = false;
+   p->index    = NULL;
+   p->tokens   = NULL;
+   p->refs     = false;
+   p->loaded   = true;
 
    return p;
 }
@@ -62,9 +229,13 @@ playlist_new(void)
 void
 playlist_free(playlist *p)
 {
+   playlist_refs_track(p, false);
    if (p->filename != NULL) free(p->filename);
    if (p->name != NULL) free(p->name);
-   if (p->files != NULL) free(p->files);
+   if (p->shared != NULL)
+      playlist_slice_unref(p->shared);
+   else
+      free(p->files);
    playlist_history_free(p);
    free(p);
 }
@@ -72,18 +243,18 @@ playlist_free(playlist *p)
 /*
  * Duplicate an existing playlist, returning a pointer to the newly allocated
  * playlist.  The filename and name of the new playlist must be specified.
+ * The two share the files until either is changed.
  */
 playlist *
-playlist_dup(const playlist *original, const char *filename,
+playlist_dup(playlist *original, const char *filename,
    const char *name)
 {
+   playlist_slice *s;
    playlist *newplist;
-   int i;
+   meta_info **f;
 
    /* create new playlist and copy simple members */
    newplist           = playlist_new();
-   newplist->nfiles   = original->nfiles;
-   newplist->capacity = original->nfiles;
 
    if (name != NULL) {
       if ((newplist->name = strdup(name)) == NULL)
@@ -94,13 +265,12 @@ playlist_dup(const playlist *original, const char *filename,
          err(1, "playlist_dup: strdup filename failed");
    }
 
-   /* copy all of the files */
-   newplist->files = calloc(original->nfiles, sizeof(meta_info*));
-   if (newplist->files == NULL)
-      err(1, "playlist_dup: failed to allocate files");
-
-   for (i = 0; i < original->nfiles; i++)
-      newplist->files[i] = original->files[i];
+   /* share all of the files */
+   if (original->nfiles > 0) {
+      s = playlist_files_share(original, 0, original->nfiles, &f);
+      playlist_files_add_slice(newplist, s, f, 0, original->nfiles, false);
+      playlist_slice_unref(s);
+   }
 
    return newplist;
 }
@@ -108,37 +278,73 @@ playlist_dup(const playlist *original, const char *filename,
 /*
  * Add files to a playlist at the index specified by start.  Note that if
  * start is the length of the files array the files are appended to the end.
+ * The files go into the gap, moved to start first, so this costs the number
+ * of files added plus the distance from the last add/remove.  If the files
+ * are in a slice (s is set) and the playlist is empty, it shares them.
  */
-void
-playlist_files_add(playlist *p, meta_info **f, int start, int size, bool record)
+static void
+playlist_files_insert(playlist *p, playlist_slice *s, meta_info **f,
+   int start, int size, bool record)
 {
-   playlist_changeset *changes;
    int i;
 
    if (start < 0 || start > p->nfiles)
       errx(1, "playlist_file_add: index %d out of range", start);
 
-   while (p->capacity <= p->nfiles + size)
-      playlist_increase_capacity(p);
+   if (s != NULL && p->nfiles == 0 && p->shared == NULL && size > 0) {
+      free(p->files);
+      p->files = f;
+      p->capacity = size;
+      p->gap = size;
+      p->shared = playlist_slice_ref(s);
+   } else {
+      playlist_reserve(p, p->nfiles + size);
+      playlist_move_gap(p, start);
+
+      /* add the files */
+      for (i = 0; i < size; i++)
+         p->files[start + i] = f[i];
+
+      p->gap += size;
+   }
 
-   /* push everything after start back size places */
-   for (i = p->nfiles + size; i > start; i--)
-      p->files[i] = p->files[i - size];
+   p->nfiles += size;
 
-   /* add the files */
-   for (i = 0; i < size; i++)
-      p->files[start + i] = f[i];
+   if (p->index != NULL) {
+      for (i = 0; i < size; i++)
+         libindex_add(p->index, f[i], start + i);
+   }
 
-   p->nfiles += size;
+   if (p->tokens != NULL) {
+      for (i = 0; i < size; i++)
+         tokindex_add(p->tokens, f[i]);
+   }
+
+   if (p->refs) {
+      for (i = 0; i < size; i++)
+         playlist_ref_add(f[i], p, start + i);
+   }
 
    /* update the history for this playlist */
    if (record) {
-      changes = changeset_create(CHANGE_ADD, size, f, start);
-      playlist_history_push(p, changes);
+      playlist_history_record(p, CHANGE_ADD, f, start, size, s);
       p->needs_saving = true;
    }
 }
 
+void
+playlist_files_add(playlist *p, meta_info **f, int start, int size, bool record)
+{
+   playlist_files_insert(p, NULL, f, start, size, record);
+}
+
+void
+playlist_files_add_slice(playlist *p, playlist_slice *s, meta_info **f,
+   int start, int size, bool record)
+{
+   playlist_files_insert(p, s, f, start, size, record);
+}
+
 /* Append a file to the end of a playlist */
 void
 playlist_files_append(playlist *p, meta_info **f, int size, bool record)
@@ -146,131 +352,625 @@ playlist_files_append(playlist *p, meta_info **f, int size, bool record)
    return playlist_files_add(p, f, p->nfiles, size, record);
 }
 
-/* Remove a file at a given index from a playlist. */
-void
-playlist_files_remove(playlist *p, int start, int size, bool record)
+/*
+ * Remove files from a playlist, starting at a given index.  The gap is moved
+ * to start, and the files removed (which then follow it) join it.  If s is
+ * set it holds a copy of the files removed, which the history can share.
+ */
+static void
+playlist_files_delete(playlist *p, int start, int size, bool record,
+   playlist_slice *s)
 {
-   playlist_changeset *changes;
+   meta_info **f;
    int i;
 
-   if (start < 0 || start >= p->nfiles)
+   if (start < 0 || start >= p->nfiles || size > p->nfiles - start)
       errx(1, "playlist_remove_file: index %d out of range", start);
 
+   playlist_move_gap(p, start);
+   f = p->files + start + p->capacity - p->nfiles;
+
    if (record) {
-      changes = changeset_create(CHANGE_REMOVE, size, &(p->files[start]), start);
-      playlist_history_push(p, changes);
+      playlist_history_record(p, CHANGE_REMOVE, s != NULL ? s->files : f,
+         start, size, s);
       p->needs_saving = true;
    }
 
-   for (i = start; i < p->nfiles; i++)
-      p->files[i] = p->files[i + size];
+   if (p->index != NULL) {
+      for (i = 0; i < size; i++)
+         libindex_remove(p->index, f[i]);
+   }
+
+   if (p->tokens != NULL) {
+      for (i = 0; i < size; i++)
+         tokindex_remove(p->tokens, f[i]);
+   }
+
+   if (p->refs) {
+      for (i = 0; i < size; i++)
+         playlist_ref_remove(f[i], p, start + i);
+   }
 
    p->nfiles -= size;
+}
 
+void
+playlist_files_remove(playlist *p, int start, int size, bool record)
+{
+   playlist_files_delete(p, start, size, record, NULL);
+}
+
+/* copy files [start, start + size) of a playlist to a new slice */
+static playlist_slice *
+playlist_slice_copy(const playlist *p, int start, int size)
+{
+   playlist_slice *s;
+   int i;
+
+   s = playlist_slice_new(NULL, size);
+   for (i = 0; i < size; i++)
+      s->files[i] = playlist_file(p, start + i);
+
+   return s;
+}
+
+playlist_slice *
+playlist_files_cut(playlist *p, int start, int size, bool record)
+{
+   playlist_slice *s;
+
+   if (start < 0 || start >= p->nfiles || size > p->nfiles - start)
+      errx(1, "playlist_files_cut: index %d out of range", start);
+
+   s = playlist_slice_copy(p, start, size);
+   playlist_files_delete(p, start, size, record, s);
+   return s;
+}
+
+playlist_slice *
+playlist_files_share(playlist *p, int start, int size, meta_info ***f)
+{
+   playlist_slice *s;
+
+   if (start < 0 || size < 0 || size > p->nfiles - start)
+      errx(1, "playlist_files_share: index %d out of range", start);
+
+   if (p->shared == NULL && size * 2 < p->nfiles) {
+      s = playlist_slice_copy(p, start, size);
+      *f = s->files;
+      return s;
+   }
+
+   /* the playlist's files become a slice, held by it */
+   if (p->shared == NULL) {
+      playlist_move_gap(p, p->nfiles);
+      if ((p->shared = malloc(sizeof(playlist_slice))) == NULL)
+         err(1, "%s: malloc(3) failed", __FUNCTION__);
+
+      p->shared->files = p->files;
+      p->shared->nfiles = p->nfiles;
+      p->shared->refs = 1;
+   }
+
+   *f = p->files + start;
+   return playlist_slice_ref(p->shared);
 }
 
 /* Replaces the file at a given index in a playlist with a new file */
 void
 playlist_file_replace(playlist *p, int index, meta_info *newEntry)
 {
+   meta_info *old;
+
    if (index < 0 || index >= p->nfiles)
       errx(1, "playlist_file_replace: index %d out of range", index);
 
-   p->files[index] = newEntry;
+   playlist_unshare(p);
+   old = playlist_file(p, index);
+   if (p->index != NULL) {
+      libindex_remove(p->index, old);
+      libindex_add(p->index, newEntry, index);
+   }
+
+   if (p->tokens != NULL) {
+      tokindex_remove(p->tokens, old);
+      tokindex_add(p->tokens, newEntry);
+   }
+
+   if (p->refs) {
+      playlist_ref_remove(old, p, index);
+      playlist_ref_add(newEntry, p, index);
+   }
+
+   playlist_file(p, index) = newEntry;
+}
+
+/*
+ * Find a file in a playlist by filename.  With an index, the record is found
+ * in O(1) and its position by searching outwards from its position hint,
+ * which is usually exact or off by a few (the number of inserts/removals
+ * that happened before it since it was added).  Without one, this is a
+ * linear search.
+ */
+int
+playlist_find(playlist *p, const char *filename)
+{
+   meta_info *mi;
+   int        hint, d;
+
+   if (p->index == NULL) {
+      for (d = 0; d < p->nfiles; d++) {
+         if (strcmp(playlist_file(p, d)->filename, filename) == 0)
+            return d;
+      }
+      return -1;
+   }
+
+   if ((mi = libindex_get(p->index, filename, &hint)) == NULL)
+      return -1;
+
+   if ((d = playlist_find_near(p, mi, hint)) == -1)
+      errx(1, "%s: index out of sync for '%s'", __FUNCTION__, filename);
+
+   libindex_set_hint(p->index, mi, d);
+   return d;
+}
+
+/*
+ * Start keeping the refs of a playlist's files (adding refs for the files
+ * it already has), or stop and remove them.
+ */
+void
+playlist_refs_track(playlist *p, bool track)
+{
+   int i;
+
+   if (p->refs == track)
+      return;
+
+   for (i = 0; i < p->nfiles; i++) {
+      if (track)
+         playlist_ref_add(playlist_file(p, i), p, i);
+      else
+         playlist_ref_remove(playlist_file(p, i), p, i);
+   }
+
+   p->refs = track;
+}
+
+/*
+ * Replace a file with another everywhere it's referenced.  Each ref's
+ * position is found from its hint (and the hint of the new ref is then
+ * exact), so this costs about the number of refs, not the total size of the
+ * playlists.  Playlists changed are marked as needing saving only if the
+ * new file has a different filename.
+ */
+int
+playlist_refs_patch(meta_info *old, meta_info *new)
+{
+   playlist_ref  ref;
+   int           pos, n;
+
+   if (old == new)
+      return 0;
+
+   /* each replace removes a ref of old, so this always takes the last */
+   for (n = 0; old->nrefs > 0; n++) {
+      ref = old->refs[old->nrefs - 1];
+      if ((pos = playlist_find_near(ref.p, old, ref.hint)) == -1)
+         errx(1, "%s: ref out of sync for '%s'", __FUNCTION__, old->filename);
+
+      playlist_file_replace(ref.p, pos, new);
+      if (strcmp(old->filename, new->filename) != 0)
+         ref.p->needs_saving = true;
+   }
+
+   return n;
+}
+
+/* name of the ids file of a playlist */
+static char *
+playlist_ids_name(const char *filename)
+{
+   char *ids_file;
+
+   if (asprintf(&ids_file, "%s.ids", filename) == -1)
+      errx(1, "%s: asprintf failed", __FUNCTION__);
+
+   return ids_file;
+}
+
+/*
+ * Fill the (empty) contents of a playlist from its ids file, returning false
+ * (and leaving them empty) if there is no usable one.  See playlist.h.
+ */
+static bool
+playlist_read_ids(playlist_contents *c, const libindex *db)
+{
+   playlist_ids_header   hdr;
+   struct stat           sb;
+   meta_info           **files;
+   uint32_t              id, i;
+   FILE                 *fin;
+   char                 *ids_file, *data;
+   size_t                len, off;
+   bool                  ok;
+
+   if (db->stamp == 0)
+      return false;
+
+   ids_file = playlist_ids_name(c->filename);
+   fin = fopen(ids_file, "r");
+   free(ids_file);
+   if (fin == NULL)
+      return false;
+
+   /* read all of it, to check the checksum */
+   data = NULL;
+   ok = (fstat(fileno(fin), &sb) == 0
+      && (data = malloc(sb.st_size + 1)) != NULL
+      && fread(data, 1, sb.st_size, fin) == (size_t) sb.st_size
+      && savefile_verify(data, sb.st_size, &len));
+   fclose(fin);
+
+   off = sizeof(PLAYLIST_IDS_MAGIC);
+   memset(&hdr, 0, sizeof(hdr));
+   if (ok && len >= off + sizeof(hdr)
+   &&  memcmp(data, PLAYLIST_IDS_MAGIC, sizeof(PLAYLIST_IDS_MAGIC)) == 0) {
+      memcpy(&hdr, data + off, sizeof(hdr));
+      off += hdr.header_size;
+   } else
+      ok = false;
+
+   if (ok && (hdr.header_size < sizeof(hdr)
+   ||  off + (uint64_t) hdr.nfiles * sizeof(uint32_t) > len))
+      ok = false;
+
+   /* ids of another database, or the playlist file was changed since */
+   if (ok && (hdr.db_stamp != db->stamp
+   ||  stat(c->filename, &sb) == -1
+   ||  hdr.text_ino != (uint64_t) sb.st_ino
+   ||  hdr.text_size != (int64_t) sb.st_size
+   ||  hdr.text_mtime != (int64_t) sb.st_mtime))
+      ok = false;
+
+   if (!ok) {
+      free(data);
+      return false;
+   }
+
+   if ((files = calloc(hdr.nfiles + 1, sizeof(meta_info*))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   for (i = 0; ok && i < hdr.nfiles; i++) {
+      memcpy(&id, data + off + i * sizeof(uint32_t), sizeof(uint32_t));
+      if ((files[i] = libindex_get_id(db, id)) == NULL)
+         ok = false;
+   }
+
+   if (ok) {
+      c->files    = files;
+      c->nfiles   = hdr.nfiles;
+      c->capacity = hdr.nfiles + 1;
+   } else
+      free(files);
+
+   free(data);
+   return ok;
+}
+
+/*
+ * Write the ids file of a playlist, or remove it if the playlist can't have
+ * one.  Since the ids file is only a faster way to load the playlist, failing
+ * to write it is not an error: it's removed and the playlist file is used.
+ */
+static void
+playlist_save_ids(const playlist *p, const libindex *db)
+{
+   playlist_ids_header   hdr;
+   struct stat           sb;
+   meta_info            *mi;
+   savefile             *fout;
+   char                 *ids_file;
+   bool                  ok;
+   int                   i;
+
+   ids_file = playlist_ids_name(p->filename);
+
+   ok = (db != NULL && db->stamp != 0 && stat(p->filename, &sb) == 0);
+   for (i = 0; ok && i < p->nfiles; i++) {
+      mi = playlist_file(p, i);
+      if (mi->id == 0 || libindex_get_id(db, mi->id) != mi)
+         ok = false;
+   }
+
+   if (ok && (fout = savefile_open(ids_file)) != NULL) {
+      memset(&hdr, 0, sizeof(hdr));
+      hdr.header_size = sizeof(hdr);
+      hdr.nfiles      = p->nfiles;
+      hdr.db_stamp    = db->stamp;
+      hdr.text_ino    = sb.st_ino;
+      hdr.text_size   = sb.st_size;
+      hdr.text_mtime  = sb.st_mtime;
+
+      savefile_write(fout, PLAYLIST_IDS_MAGIC, sizeof(PLAYLIST_IDS_MAGIC));
+      savefile_write(fout, &hdr, sizeof(hdr));
+      for (i = 0; i < p->nfiles; i++)
+         savefile_write(fout, &playlist_file(p, i)->id, sizeof(uint32_t));
+
+      if (savefile_close(fout, true) == 0) {
+         free(ids_file);
+         return;
+      }
+   }
+
+   if (unlink(ids_file) == -1 && errno != ENOENT)
+      err(1, "%s: failed to remove '%s'", __FUNCTION__, ids_file);
+
+   free(ids_file);
 }
 
-/* Used with bsearch to find playlist entry by filename. */
-static int cmp_fn_mi(const void *ai, const void *bi)
+/* allocate the (empty) contents of the playlist in a file, for reading */
+playlist_contents *
+playlist_contents_new(const char *filename)
 {
-   const char  *a = (const char *) ai;
-   const meta_info **b2 = (const meta_info **) bi;
-   const meta_info *b = (const meta_info *) *b2;
+   playlist_contents *c;
+
+   if ((c = calloc(1, sizeof(playlist_contents))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
 
-   return strcmp(a, b->filename);
+   if ((c->filename = strdup(filename)) == NULL)
+      err(1, "%s: strdup(3) failed", __FUNCTION__);
+
+   return c;
+}
+
+/* add a file (NULL if not in the database) to the contents of a playlist */
+static void
+playlist_contents_add(playlist_contents *c, meta_info *mi, const char *entry)
+{
+   meta_info **files;
+   char      **missing;
+   int         capacity;
+
+   if (c->nfiles == c->capacity) {
+      capacity = (c->capacity == 0 ? PLAYLIST_CHUNK_SIZE : c->capacity * 2);
+      if ((files = realloc(c->files, capacity * sizeof(meta_info*))) == NULL)
+         err(1, "%s: realloc(3) failed", __FUNCTION__);
+
+      c->files = files;
+      c->capacity = capacity;
+   }
+
+   c->files[c->nfiles++] = mi;
+   if (mi != NULL)
+      return;
+
+   if (c->nmissing == c->missing_capacity) {
+      capacity = (c->missing_capacity == 0 ? 8 : c->missing_capacity * 2);
+      if ((missing = realloc(c->missing, capacity * sizeof(char*))) == NULL)
+         err(1, "%s: realloc(3) failed", __FUNCTION__);
+
+      c->missing = missing;
+      c->missing_capacity = capacity;
+   }
+
+   if ((c->missing[c->nmissing++] = strdup(entry)) == NULL)
+      err(1, "%s: strdup(3) failed", __FUNCTION__);
 }
 
 /*
- * Loads a playlist from the provided filename.  The files within the playlist
- * are compared against the given meta-information-database to see if they
- * exist there.  If they do, the corresponding entry in the playlist structure
- * built is simply a pointer to the existing entry.  Otherwise, that file's
- * meta information is set to NULL and the file is copied (allocated) in the
- * playlist structure.
+ * Reads the contents of a playlist file.  The files within the playlist are
+ * looked up in the given index of the meta-information-database, by id if
+ * the playlist's ids file can be used and by filename otherwise.  Files not
+ * found there are NULL in the contents, with their filenames kept aside for
+ * playlist_build().
  *
- * A newly allocated playlist is returned.
+ * This is safe to run on a worker thread, as long as the index isn't
+ * changed meanwhile: errors are recorded in the contents, not reported.
  */
-playlist *
-playlist_load(const char *filename, meta_info **db, int ndb)
+void
+playlist_read(playlist_contents *c, const libindex *db)
 {
-   meta_info *mi, **mit;
    FILE *fin;
-   char *period;
    char  entry[PATH_MAX + 1];
 
    /* open file */
-   if ((fin = fopen(filename, "r")) == NULL)
-      err(1, "playlist_load: failed to open playlist '%s'", filename);
+   if ((fin = fopen(c->filename, "r")) == NULL) {
+      c->error = errno;
+      return;
+   }
+
+   if (playlist_read_ids(c, db)) {
+      fclose(fin);
+      return;
+   }
+
+   /* read each line from the file and look it up in the meta info. db */
+   while (fgets(entry, PATH_MAX, fin) != NULL) {
+      /* sanitize */
+      entry[strcspn(entry, "\n")] = '\0';
+
+      playlist_contents_add(c, libindex_get(db, entry, NULL), entry);
+   }
+
+   fclose(fin);
+}
 
-   /* create playlist and setup */
-   playlist *p = playlist_new();
-   p->filename = strdup(filename);
-   p->name     = strdup(basename((char *)filename));
-   if (p->filename == NULL || p->name == NULL)
-      err(1, "playlist_load: failed to allocate info for playlist '%s'", filename);
+/*
+ * Create a playlist for the given file (which it takes), named after the
+ * file without its '.playlist' extension.
+ */
+static playlist *
+playlist_named(char *filename)
+{
+   playlist *p;
+   char     *period;
+
+   p = playlist_new();
+   p->filename = filename;
+   p->name     = strdup(basename(filename));
+   if (p->name == NULL)
+      err(1, "playlist_load: failed to allocate info for playlist '%s'",
+         filename);
 
    /* hack to remove '.playlist' from name */
    period  = strrchr(p->name, '.');
    *period = '\0';
 
-   /* read each line from the file and copy into playlist object */
-   while (fgets(entry, PATH_MAX, fin) != NULL) {
-      /* sanitize */
-      entry[strcspn(entry, "\n")] = '\0';
+   return p;
+}
+
+/*
+ * Create an empty meta-info object, with just the filename, for each file
+ * in the contents that does NOT exist in the DB, warning about them if asked.
+ */
+static void
+playlist_contents_missing(playlist_contents *c, const char *name, bool warn)
+{
+   meta_info *mi;
+   int        i, m;
+
+   for (i = 0, m = 0; i < c->nfiles; i++) {
+      if (c->files[i] != NULL)
+         continue;
 
-      /* check if file exists in the meta info. db */
-      mit = bsearch(entry, db, ndb, sizeof(meta_info *), cmp_fn_mi);
-      mi = *mit;
-
-      if (mi != NULL)   /* file DOES exist in DB */
-         playlist_files_append(p, &mi, 1, false);
-      else {            /* file does NOT exist in DB */
-         /* create empty meta-info object with just the file name */
-         mi = mi_new();
-         mi->filename = strdup(entry);
-         if (mi->filename == NULL)
-            err(1, "playlist_load: failed to strdup filename");
-
-         /* add new record to the db and link it to the playlist */
-         playlist_files_append(p, &mi, 1, false);
+      mi = mi_new();
+      mi->filename = c->missing[m++];
+      c->files[i] = mi;
+      if (warn)
          warnx("playlist \"%s\", file \"%s\" is NOT in media database (added for now)",
-            p->name, entry);
-      }
+            name, mi->filename);
    }
+}
 
-   fclose(fin);
+/*
+ * Builds the playlist read by playlist_read(), on the main thread.  For each
+ * file that does not exist in the database, a record is created containing
+ * only its filename, and a warning is given.  The contents are free()'d.
+ *
+ * A newly allocated playlist is returned.
+ */
+playlist *
+playlist_build(playlist_contents *c)
+{
+   playlist  *p;
+
+   if (c->error != 0) {
+      errno = c->error;
+      err(1, "playlist_load: failed to open playlist '%s'", c->filename);
+   }
+
+   p = playlist_named(c->filename);
+   playlist_contents_missing(c, p->name, true);
+
+   /* the array read becomes the playlist's files, with the gap at its end */
+   if (c->files != NULL) {
+      free(p->files);
+      p->files    = c->files;
+      p->capacity = c->capacity;
+      p->nfiles   = c->nfiles;
+      p->gap      = c->nfiles;
+   }
+
+   free(c->missing);
+   free(c);
+   return p;
+}
+
+/* create a playlist for the given file without reading it (see playlist.h) */
+playlist *
+playlist_lazy(const char *filename)
+{
+   playlist *p;
+   char     *fname;
+
+   if ((fname = strdup(filename)) == NULL)
+      err(1, "%s: strdup(3) failed", __FUNCTION__);
+
+   p = playlist_named(fname);
+   p->loaded = false;
    return p;
 }
 
 /*
- * Save a playlist to file.  The filename used is whatever is in the
- * playlist.
+ * Read the file of a playlist created by playlist_lazy(), if that hasn't
+ * been done yet.  The files are added as any others, so the playlist keeps
+ * their refs if it's tracking them.  If the file can't be read the playlist
+ * is left empty, and -1 is returned with errno set.
+ */
+int
+playlist_resolve(playlist *p, const libindex *db)
+{
+   playlist_contents *c;
+   int                error;
+
+   if (p->loaded)
+      return 0;
+
+   p->loaded = true;
+
+   c = playlist_contents_new(p->filename);
+   playlist_read(c, db);
+   playlist_contents_missing(c, p->name, false);
+   playlist_files_append(p, c->files, c->nfiles, false);
+
+   error = c->error;
+   free(c->files);
+   free(c->missing);
+   free(c->filename);
+   free(c);
+
+   if (error != 0) {
+      errno = error;
+      return -1;
+   }
+
+   return 0;
+}
+
+/*
+ * Loads a playlist from the provided filename, using playlist_read() and
+ * playlist_build() above.  A newly allocated playlist is returned.
+ */
+playlist *
+playlist_load(const char *filename, const libindex *db)
+{
+   playlist_contents *c;
+
+   c = playlist_contents_new(filename);
+   playlist_read(c, db);
+   return playlist_build(c);
+}
+
+/*
+ * Save a playlist to file, along with its ids file for the given database
+ * index.  The filename used is whatever is in the playlist.  The playlist
+ * file is written as a savefile, without a checksum since it's plain text.
  */
 void
-playlist_save(const playlist *p)
+playlist_save(const playlist *p, const libindex *db)
 {
-   FILE *fout;
-   int   i;
+   savefile *fout;
+   int       i;
+
+   /* it would be saved empty */
+   if (!p->loaded)
+      errx(1, "playlist_save: playlist \"%s\" not loaded", p->filename);
 
-   if ((fout = fopen(p->filename, "w")) == NULL)
+   if ((fout = savefile_open(p->filename)) == NULL)
       err(1, "playlist_save: failed to open playlist \"%s\"", p->filename);
 
    /* write each song to file */
    for (i = 0; i < p->nfiles; i++) {
-      if (fprintf(fout, "%s\n", p->files[i]->filename) == -1)
-         err(1, "playlist_save: failed to record playlist \"%s\"", p->filename);
+      savefile_puts(fout, playlist_file(p, i)->filename);
+      savefile_write(fout, "\n", 1);
    }
 
-   fclose(fout);
+   if (savefile_close(fout, false) == -1)
+      err(1, "playlist_save: failed to record playlist \"%s\"", p->filename);
+
+   playlist_save_ids(p, db);
 }
 
 /*
@@ -280,10 +980,19 @@ playlist_save(const playlist *p)
 void
 playlist_delete(playlist *p)
 {
+   char *ids_file;
+
    /* delete file if the playlist is stored in a file */
    if (p->filename != NULL && unlink(p->filename) != 0)
       err(1, "playlist_delete: failed to delete playlist \"%s\"", p->filename);
 
+   if (p->filename != NULL) {
+      ids_file = playlist_ids_name(p->filename);
+      if (unlink(ids_file) == -1 && errno != ENOENT)
+         err(1, "playlist_delete: failed to delete \"%s\"", ids_file);
+      free(ids_file);
+   }
+
    /* destroy/free() all memory */
    playlist_free(p);
 }
@@ -301,26 +1010,56 @@ playlist_delete(playlist *p)
  * (m = true) or if records not matching should be returned (m=false)
  */
 playlist *
-playlist_filter(const playlist *p, bool m)
+playlist_filter(playlist *p, bool m)
 {
-   playlist *results;
-   int       i;
+   playlist  *results;
+   meta_info *mi;
+   int        i;
 
    if (!mi_query_isset())
       return NULL;
    
+   playlist_match_prepare(p);
    results = playlist_new();
    for (i = 0; i < p->nfiles; i++) {
-      if (mi_match(p->files[i])) {
-         if (m)  playlist_files_append(results, &(p->files[i]), 1, false);
+      mi = playlist_file(p, i);
+      if (playlist_match(p, mi)) {
+         if (m)  playlist_files_append(results, &mi, 1, false);
       } else {
-         if (!m) playlist_files_append(results, &(p->files[i]), 1, false);
+         if (!m) playlist_files_append(results, &mi, 1, false);
       }
    }
 
    return results;
 }
 
+/*
+ * Setup matching of a playlist's files against the (just changed) global
+ * query.  For a playlist with a token index, that index is built if this is
+ * the first time, and the query is compiled against it.
+ */
+void
+playlist_match_prepare(playlist *p)
+{
+   if (p->tokens == NULL)
+      return;
+
+   if (!p->tokens->built)
+      tokindex_build(p->tokens, playlist_files(p), p->nfiles);
+
+   tokindex_prepare(p->tokens);
+}
+
+/* match a file of a playlist against the global query */
+bool
+playlist_match(const playlist *p, const meta_info *mi)
+{
+   if (p->tokens != NULL)
+      return tokindex_match(p->tokens, mi);
+
+   return mi_match(mi);
+}
+
 /*
  * Builds an array of all files in the given directory with a '.playlist'
  * extension, returning the number of such files found.
@@ -373,25 +1112,71 @@ retrieve_playlist_filenames(const char *dirname, char ***fnames)
    return fcount;
 }
 
-playlist_changeset*
-changeset_create(short type, size_t size, meta_info **files, int loc)
+playlist_slice *
+playlist_slice_new(meta_info **files, int nfiles)
+{
+   playlist_slice *s;
+
+   if ((s = malloc(sizeof(playlist_slice))) == NULL)
+      err(1, "%s: malloc(3) failed", __FUNCTION__);
+
+   if ((s->files = calloc(MAX(nfiles, 1), sizeof(meta_info*))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   if (files != NULL)
+      memcpy(s->files, files, nfiles * sizeof(meta_info*));
+
+   s->nfiles = nfiles;
+   s->refs = 1;
+   return s;
+}
+
+playlist_slice *
+playlist_slice_ref(playlist_slice *s)
+{
+   s->refs++;
+   return s;
+}
+
+void
+playlist_slice_unref(playlist_slice *s)
 {
-   size_t i;
+   if (--s->refs > 0)
+      return;
 
+   free(s->files);
+   free(s);
+}
+
+playlist_changeset*
+changeset_create(short type, size_t size, meta_info **files, int loc,
+   playlist_slice *slice)
+{
    playlist_changeset *c;
 
    if ((c = malloc(sizeof(playlist_changeset))) == NULL)
       err(1, "%s: malloc(3) failed", __FUNCTION__);
 
-   if ((c->files = calloc(size, sizeof(meta_info*))) == NULL)
-      err(1, "%s: calloc(3) failed", __FUNCTION__);
-
    c->type = type;
    c->size = size;
    c->location = loc;
 
-   for (i = 0; i < size; i++)
-      c->files[i] = files[i];
+   if (size >= HISTORY_SLICE_MIN && slice != NULL) {
+      c->slice = playlist_slice_ref(slice);
+      c->files = files;
+      c->capacity = 0;
+   } else if (size >= HISTORY_SLICE_MIN) {
+      c->slice = playlist_slice_new(files, size);
+      c->files = c->slice->files;
+      c->capacity = 0;
+   } else {
+      if ((c->files = calloc(MAX(size, 1), sizeof(meta_info*))) == NULL)
+         err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+      memcpy(c->files, files, size * sizeof(meta_info*));
+      c->slice = NULL;
+      c->capacity = MAX(size, 1);
+   }
 
    return c;
 }
@@ -399,63 +1184,218 @@ changeset_create(short type, size_t size, meta_info **files, int loc)
 void
 changeset_free(playlist_changeset *c)
 {
-   free(c->files);
+   if (c->slice != NULL)
+      playlist_slice_unref(c->slice);
+   else
+      free(c->files);
+
    free(c);
 }
 
-playlist_changeset**
-playlist_history_new(void)
+/*
+ * The history of all playlists: the memory it holds (counting a changeset's
+ * files even when its slice is shared), and the playlists with any, least
+ * recently edited first.
+ */
+static size_t    history_bytes = 0;
+static playlist *history_oldest = NULL;
+static playlist *history_newest = NULL;
+
+#define HISTORY_SLOT(p, i) (((p)->hist_first + (i)) % history_size)
+
+static size_t
+changeset_bytes(const playlist_changeset *c)
 {
-   playlist_changeset **h;
-   int i;
+   return sizeof(playlist_changeset) + sizeof(meta_info*)
+        * (c->slice != NULL ? c->size : (size_t) c->capacity);
+}
 
-   if ((h = calloc(history_size, sizeof(playlist_changeset*))) == NULL)
-      err(1, "%s: calloc(3) failed", __FUNCTION__);
+/* take a playlist off the list of those with history, if it's on it */
+static void
+playlist_history_unlink(playlist *p)
+{
+   if (p->hist_prev != NULL)
+      p->hist_prev->hist_next = p->hist_next;
+   else if (history_oldest == p)
+      history_oldest = p->hist_next;
+   else
+      return;
+
+   if (p->hist_next != NULL)
+      p->hist_next->hist_prev = p->hist_prev;
+   else
+      history_newest = p->hist_prev;
+
+   p->hist_prev = NULL;
+   p->hist_next = NULL;
+}
+
+/* make a playlist the most recently edited */
+static void
+playlist_history_touch(playlist *p)
+{
+   playlist_history_unlink(p);
+   p->hist_prev = history_newest;
+   if (history_newest != NULL)
+      history_newest->hist_next = p;
+   else
+      history_oldest = p;
+
+   history_newest = p;
+}
 
-   for (i = 0; i < history_size; i++)
-      h[i] = NULL;
+/* drop the changeset at a slot of the history (the caller fixes the rest) */
+static void
+playlist_history_drop(playlist *p, int i)
+{
+   playlist_changeset **slot;
 
-   return h;
+   slot = &p->history[HISTORY_SLOT(p, i)];
+   history_bytes -= changeset_bytes(*slot);
+   changeset_free(*slot);
+   *slot = NULL;
 }
 
-void
+static void
 playlist_history_free_future(playlist *p)
 {
-   int i;
+   while (p->hist_count > p->hist_present + 1)
+      playlist_history_drop(p, --p->hist_count);
+}
 
-   for (i = p->hist_present + 1; i < history_size; i++) {
-      if (p->history[i] != NULL) {
-         changeset_free(p->history[i]);
-         p->history[i] = NULL;
-      }
+/* drop the oldest applied changeset, or the newest undone if none are */
+static void
+playlist_history_drop_oldest(playlist *p)
+{
+   if (p->hist_present == -1) {
+      playlist_history_drop(p, --p->hist_count);
+      p->hist_open = false;
+   } else {
+      playlist_history_drop(p, 0);
+      p->hist_first = (p->hist_first + 1) % history_size;
+      p->hist_count--;
+      p->hist_present--;
+   }
+
+   if (p->hist_count == 0)
+      playlist_history_unlink(p);
+}
+
+/*
+ * Drop changesets, from the least recently edited playlists first, until
+ * the history of all of them fits in history_budget.  The newest changeset
+ * of the given playlist is always kept.
+ */
+static void
+playlist_history_trim(playlist *keep)
+{
+   playlist *p;
+
+   while (history_bytes > history_budget && (p = history_oldest) != NULL) {
+      if (p == keep && p->hist_count == 1)
+         break;
+
+      playlist_history_drop_oldest(p);
    }
 }
 
 void
 playlist_history_free(playlist *p)
 {
-   p->hist_present = 0;
+   p->hist_present = -1;
    playlist_history_free_future(p);
+   playlist_history_unlink(p);
    free(p->history);
-   p->history = 0;
+   p->history = NULL;
+   p->hist_first = 0;
+   p->hist_open = false;
 }
 
 void
 playlist_history_push(playlist *p, playlist_changeset *c)
 {
-   int i;
+   if (p->history == NULL) {
+      p->history = calloc(history_size, sizeof(playlist_changeset*));
+      if (p->history == NULL)
+         err(1, "%s: calloc(3) failed", __FUNCTION__);
+   }
 
-   if (p->hist_present < history_size - 1)
-      playlist_history_free_future(p);
-   else {
-      for (i = 0; i < history_size - 1; i++)
-         p->history[i] = p->history[i + 1];
+   playlist_history_free_future(p);
+   if (p->hist_count == history_size)
+      playlist_history_drop_oldest(p);
 
-      p->hist_present--;
+   p->hist_count++;
+   p->hist_present++;
+   p->history[HISTORY_SLOT(p, p->hist_present)] = c;
+   p->hist_open = (c->size == 1);
+   history_bytes += changeset_bytes(c);
+
+   playlist_history_touch(p);
+   playlist_history_trim(p);
+}
+
+/*
+ * Merge a single file added or removed at loc into the newest changeset, if
+ * it's the same kind of edit and right next to it, returning whether it was.
+ */
+static bool
+playlist_history_merge(playlist *p, short type, meta_info *f, int loc)
+{
+   playlist_changeset *c;
+   meta_info **files;
+   bool   prepend;
+   int    capacity;
+
+   if (!p->hist_open || p->hist_count == 0
+   ||  p->hist_present != p->hist_count - 1)
+      return false;
+
+   c = p->history[HISTORY_SLOT(p, p->hist_present)];
+   if (c->type != type || c->slice != NULL || c->size >= HISTORY_SLICE_MIN)
+      return false;
+
+   /* adds go before or after the files added, removes at or before */
+   if (loc == c->location)
+      prepend = (type == CHANGE_ADD);
+   else if (type == CHANGE_ADD && loc == c->location + (int) c->size)
+      prepend = false;
+   else if (type == CHANGE_REMOVE && loc == c->location - 1)
+      prepend = true;
+   else
+      return false;
+
+   if ((int) c->size == c->capacity) {
+      capacity = c->capacity * 2;
+      if ((files = realloc(c->files, capacity * sizeof(meta_info*))) == NULL)
+         err(1, "%s: realloc(3) failed", __FUNCTION__);
+
+      history_bytes += (capacity - c->capacity) * sizeof(meta_info*);
+      c->files = files;
+      c->capacity = capacity;
    }
 
-   p->hist_present++;
-   p->history[p->hist_present] = c;
+   if (prepend) {
+      memmove(c->files + 1, c->files, c->size * sizeof(meta_info*));
+      c->files[0] = f;
+      c->location = loc;
+   } else
+      c->files[c->size] = f;
+
+   c->size++;
+   playlist_history_touch(p);
+   playlist_history_trim(p);
+   return true;
+}
+
+/* record files (in slice s, if it's set) added or removed in the history */
+static void
+playlist_history_record(playlist *p, short type, meta_info **f, int loc,
+   int size, playlist_slice *s)
+{
+   if (size == 1 && playlist_history_merge(p, type, f[0], loc))
+      return;
+
+   playlist_history_push(p, changeset_create(type, size, f, loc, s));
 }
 
 /* returns 0 if successfull, 1 if there was no history to undo */
@@ -467,20 +1407,22 @@ playlist_undo(playlist *p)
    if (p->hist_present == -1)
       return 1;
 
-   c = p->history[p->hist_present];
+   c = p->history[HISTORY_SLOT(p, p->hist_present)];
 
    switch (c->type) {
    case CHANGE_ADD:
       playlist_files_remove(p, c->location, c->size, false);
       break;
    case CHANGE_REMOVE:
-      playlist_files_add(p, c->files, c->location, c->size, false);
+      playlist_files_insert(p, c->slice, c->files, c->location, c->size,
+         false);
       break;
    default:
       errx(1, "%s: invalid change type", __FUNCTION__);
    }
 
    p->hist_present--;
+   p->hist_open = false;
    return 0;
 }
 
@@ -490,15 +1432,15 @@ playlist_redo(playlist *p)
 {
    playlist_changeset *c;
 
-   if (p->hist_present == history_size - 1
-   ||  p->history[p->hist_present + 1] == NULL)
+   if (p->hist_present + 1 >= p->hist_count)
       return 1;
 
-   c = p->history[p->hist_present + 1];
+   c = p->history[HISTORY_SLOT(p, p->hist_present + 1)];
 
    switch (c->type) {
    case CHANGE_ADD:
-      playlist_files_add(p, c->files, c->location, c->size, false);
+      playlist_files_insert(p, c->slice, c->files, c->location, c->size,
+         false);
       break;
    case CHANGE_REMOVE:
       playlist_files_remove(p, c->location, c->size, false);
@@ -508,5 +1450,6 @@ playlist_redo(playlist *p)
    }
 
    p->hist_present++;
+   p->hist_open = false;
    return 0;
 }
@@ -30,60 +30,156 @@
 #include <unistd.h>
 
 #include "debug.h"
+#include "libindex.h"
 #include "meta_info.h"
+#include "savefile.h"
+#include "tokindex.h"
 
 #include "compat.h"
 
-#define PLAYLIST_CHUNK_SIZE   100
-#define DEFAULT_HISTORY_SIZE  100
-extern int history_size;
+#define PLAYLIST_CHUNK_SIZE     100
+#define DEFAULT_HISTORY_SIZE    100                /* changesets each */
+#define DEFAULT_HISTORY_BUDGET  (8 * 1024 * 1024)  /* bytes, all playlists */
+extern int    history_size;
+extern size_t history_budget;
+
+/*
+ * An immutable array of files, shared by reference count.  Each holder of a
+ * slice (the yank buffer, changesets, and playlists sharing their files, see
+ * playlist_files_share()) keeps its own pointer into it and count of files,
+ * so a slice may serve as many different runs of files as there are holders.
+ */
+typedef struct {
+   meta_info **files;
+   int         nfiles;
+   int         refs;
+} playlist_slice;
+
+/* create a slice of n files copied from f (left to fill in if f is NULL) */
+playlist_slice *playlist_slice_new(meta_info **f, int n);
+playlist_slice *playlist_slice_ref(playlist_slice *s);
+void playlist_slice_unref(playlist_slice *s);
+
+/*
+ * A change to a playlist, for undo/redo.  Changes of HISTORY_SLICE_MIN or
+ * more files keep them in a slice.  Smaller ones have their own array, and
+ * consecutive single file edits next to each other (adding or removing the
+ * files one by one) are merged into one changeset.
+ */
+#define HISTORY_SLICE_MIN  64
 
 typedef struct {
 #define CHANGE_ADD    0
 #define CHANGE_REMOVE 1
-   short       type;
-   size_t      size;
-   meta_info **files;
-   int         location;
+   short            type;
+   size_t           size;
+   meta_info      **files;
+   int              location;
+
+   playlist_slice  *slice;     /* holding the files, or NULL */
+   int              capacity;  /* of files, when not in a slice */
 
 } playlist_changeset;
 
 /* the core playlist structure */
-typedef struct {
+typedef struct playlist {
    char  *filename;     /* filename containing the playlist */
    char  *name;         /* name of the playlist used in display */
    bool   needs_saving; /* does this playlist have unsaved changes? */
 
-   /* the array of files (their meta information) in the playlist */
+   /*
+    * the files (their meta information) in the playlist, kept in a gap
+    * buffer: the capacity - nfiles unused slots sit at index gap, so adds
+    * and removes at (or near) the same place as the last one move only the
+    * files in between.  use playlist_file() to get at a file by its index,
+    * and playlist_files() for a plain array of them all.
+    */
    meta_info **files;
    int         nfiles;     /* number of files in the playlist */
    int         capacity;   /* current size malloc()'d for the files */
+   int         gap;        /* index where the unused slots are */
+
+   /*
+    * if set, files points into this slice, shared with others (there is no
+    * gap then).  the files are copied before the playlist is changed.
+    */
+   playlist_slice *shared;
+
+   /*
+    * history of the playlist, a ring of history_size changesets allocated
+    * on the first edit.  it holds hist_count changesets starting at slot
+    * hist_first, the first hist_present + 1 of which are applied and the
+    * rest undone.  playlists with history are listed from least to most
+    * recently edited, which is the order the history_budget is enforced in.
+    */
+   playlist_changeset   **history;
+   int                    hist_first;
+   int                    hist_count;
+   int                    hist_present;
+   bool                   hist_open;    /* can the newest take more edits? */
+   struct playlist       *hist_prev;
+   struct playlist       *hist_next;
+
+   /* indexes kept in sync with files (only set for the library) */
+   libindex  *index;
+   tokindex  *tokens;
+
+   /* does this playlist keep the refs of its files (see below)? */
+   bool       refs;
 
-   /* history of the playlist */
-   playlist_changeset   **history;        /* complete history */
-   int                    hist_present;   /* current changeset in history */
+   /* false until a playlist_lazy() one is read by playlist_resolve() */
+   bool       loaded;
 
 } playlist;
 
+/*
+ * A reference from a meta_info (mi->refs) to a playlist holding it, one for
+ * each time it's in that playlist.  These are kept for the playlists that
+ * have refs turned on with playlist_refs_track(), which the media library
+ * does for all of its playlists except the library itself.  That way the
+ * playlists holding a file are known without searching them all, and
+ * playlist_refs_patch() can replace a file everywhere it's used.
+ *
+ * As with the library index, the position is only a hint: it's set when the
+ * file is added (or found) and not updated as other files move around it.
+ */
+typedef struct playlist_ref {
+   playlist  *p;
+   int        hint;
+} playlist_ref;
+
 /*
  * IMPORTANT NOTES ABOUT THE "playlist" STRUCTURE:
- * 1. The elements of the "files" array are simply pointers to the
- *    already existing meta-info elements in the media database.
+ * 1. The files are simply pointers to the already existing meta-info
+ *    elements in the media database.
  *
  * 2. When loading a playlist from a file, each element of the playlist
- *    is compared against the media database to find a corresponding entry.
- *    If no such file exists in the media database, a new record is added
- *    to the DB but it contains *only* the filename read from the playlist
- *    file (no meta info).
+ *    is looked up in the media database's id or filename index to find a
+ *    corresponding entry.  If no such file exists in the media database, a
+ *    new record is created for the playlist but it contains *only* the
+ *    filename read from the playlist file (no meta info).
  *
- * 3. The media database mentioned above is simply an array of meta_info
- *    structs, passed to the functions when necessary below.
+ * 3. A playlist with indexes (the library) keeps them up to date as files
+ *    are added, removed, or replaced.
+ */
+
+/* the file at index i of a playlist (i is evaluated more than once) */
+#define playlist_file(p, i) \
+   ((p)->files[(i) < (p)->gap ? (i) : (i) + (p)->capacity - (p)->nfiles])
+
+/*
+ * all files of a playlist as a plain array, which may be reordered in
+ * place but is only good until the playlist is next changed
  */
+meta_info **playlist_files(playlist *p);
 
-/* create/destroy/duplicate playlist structs */
+/*
+ * create/destroy/duplicate playlist structs.  a duplicate shares the files
+ * of the original until either is changed.
+ */
 playlist *playlist_new(void);
 void playlist_free(playlist *p);
-playlist *playlist_dup(const playlist *original, const char *filename,
+playlist *playlist_dup(playlist *original, const char *filename,
                        const char* name);
 
 /* add/remove/replace files from a playlist */
@@ -92,22 +188,134 @@ void playlist_files_append(playlist *p, meta_info **f, int size, bool);
 void playlist_files_remove(playlist *p, int start, int size, bool);
 void playlist_file_replace(playlist *p, int index, meta_info *newEntry);
 
+/*
+ * Get a slice holding files [start, start + size) of a playlist, setting
+ * *f to the first of them.  When that's at least half of the playlist, the
+ * playlist's own files are shared (costing nothing until it's changed),
+ * otherwise they're copied.  The caller owns the reference returned.
+ */
+playlist_slice *playlist_files_share(playlist *p, int start, int size,
+   meta_info ***f);
+
+/*
+ * Add files held in a slice, the same as playlist_files_add().  Into an
+ * empty playlist, the files are shared rather than copied, and the history
+ * shares them too.
+ */
+void playlist_files_add_slice(playlist *p, playlist_slice *s, meta_info **f,
+   int start, int size, bool record);
+
+/*
+ * Remove files from a playlist, the same as playlist_files_remove(), and
+ * return a slice of exactly them (shared with the history) that the caller
+ * owns the reference to.
+ */
+playlist_slice *playlist_files_cut(playlist *p, int start, int size,
+   bool record);
+
+/*
+ * find the position of a file in a playlist by filename, -1 if not found.
+ * for a playlist with an index this starts at the index's position hint.
+ */
+int playlist_find(playlist *p, const char *filename);
+
+/*
+ * Next to each playlist file (one filename per line, which is what other
+ * programs can read and edit) playlist_save() writes "<filename>.ids", with
+ * the database id of each file in the playlist:
+ *
+ *    PLAYLIST_IDS_MAGIC
+ *    playlist_ids_header
+ *    uint32_t ids[nfiles]
+ *    savefile_trailer          checksum of the above
+ *
+ * playlist_read() reads that instead of the playlist file when it was saved
+ * against the same database, the playlist file is unchanged since (same
+ * inode, size, and modification time), and all of its ids are still in the
+ * library.  Otherwise the playlist file is read and looked up by filename.
+ * A playlist with files that are not in the database has no ids file.
+ */
+#define PLAYLIST_IDS_MAGIC    "vitunes-ids2"
+
+typedef struct {
+   uint32_t header_size;   /* sizeof(playlist_ids_header) when written */
+   uint32_t nfiles;        /* number of ids that follow */
+   uint64_t db_stamp;      /* the database the ids belong to */
+   uint64_t text_ino;      /* inode, size, and mtime of the playlist file */
+   int64_t  text_size;
+   int64_t  text_mtime;
+} playlist_ids_header;
+
+/* start/stop keeping the refs of a playlist's files */
+void playlist_refs_track(playlist *p, bool track);
+
+/*
+ * replace a file with another in every playlist keeping refs that holds it
+ * (using playlist_file_replace()), returning the number of entries replaced.
+ */
+int playlist_refs_patch(meta_info *old, meta_info *new);
+
+/*
+ * Loading a playlist is done in two steps, so that many can be read at once
+ * by worker threads.  playlist_read() reads the file into the private arrays
+ * of a playlist_contents, touching nothing but the database index (which
+ * must not change meanwhile).  Then playlist_build(), on the main thread,
+ * creates a record for each file not in the database and builds the
+ * playlist.  playlist_load() does both.
+ */
+typedef struct {
+   char        *filename;
+   meta_info  **files;     /* NULL for files not in the database */
+   int          nfiles;
+   int          capacity;
+   char       **missing;   /* filenames of those, in order */
+   int          nmissing;
+   int          missing_capacity;
+   int          error;     /* errno if the file couldn't be read, else 0 */
+} playlist_contents;
+
+playlist_contents *playlist_contents_new(const char *filename);
+void playlist_read(playlist_contents *c, const libindex *db);
+playlist *playlist_build(playlist_contents *c);     /* frees c */
+
+/*
+ * A playlist can also be created from just its filename with playlist_lazy(),
+ * which gives it its name without reading the file.  It's empty (and not
+ * loaded) until playlist_resolve() reads it, which must be done before its
+ * files are used or it's saved.  Files not in the database get records the
+ * same as with playlist_build(), but without warnings.
+ */
+playlist *playlist_lazy(const char *filename);
+int playlist_resolve(playlist *p, const libindex *db);
+
 /* load/save/delete playlists from/to/from filesystem */
-playlist *playlist_load(const char *filename, meta_info **db, int ndb);
-void playlist_save(const playlist *p);
+playlist *playlist_load(const char *filename, const libindex *db);
+void playlist_save(const playlist *p, const libindex *db);
 void playlist_delete(playlist *p);
 
 /* filter a playlist to all records matching/not-matching a given string */
-playlist *playlist_filter(const playlist *p, bool m);
+playlist *playlist_filter(playlist *p, bool m);
+
+/*
+ * match files of a playlist against the global query, same as mi_match().
+ * playlist_match_prepare() must be called each time the query is changed.
+ * for the library, this uses (building it the first time) the token index.
+ */
+void playlist_match_prepare(playlist *p);
+bool playlist_match(const playlist *p, const meta_info *mi);
 
 /* retrieve all playlist files in a given directory and return number found */
 int retrieve_playlist_filenames(const char *dirname, char ***files);
 
-/* for modification and use of the playlist history */
-playlist_changeset *changeset_create(short t, size_t s, meta_info **f, int l);
+/*
+ * for modification and use of the playlist history.  a changeset shares
+ * the given slice (which may be NULL) holding the files, if it would
+ * otherwise copy them to a slice of its own.
+ */
+playlist_changeset *changeset_create(short t, size_t s, meta_info **f, int l,
+   playlist_slice *slice);
 void changeset_free(playlist_changeset *c);
 
-playlist_changeset **playlist_history_new();
 void playlist_history_free(playlist *p);
 
 void playlist_history_push(playlist *p, playlist_changeset *c);
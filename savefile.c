@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "savefile.h"
+
+/*
+ * The checksum works through the data 8 bytes at a time (zero-padding the
+ * last few), which is why every buffer flushed but the last must be a
+ * multiple of 8 bytes.
+ */
+#define SUM_SEED  0x736176656669ULL
+#define SUM_K1    0x9e3779b97f4a7c15ULL
+#define SUM_K2    0xc2b2ae3d27d4eb4fULL
+
+static uint64_t
+sum_update(uint64_t h, const unsigned char *p, size_t len)
+{
+   uint64_t w;
+
+   for (; len >= 8; len -= 8, p += 8) {
+      memcpy(&w, p, 8);
+      h ^= w * SUM_K2;
+      h = ((h << 31) | (h >> 33)) * SUM_K1;
+   }
+
+   if (len > 0) {
+      w = 0;
+      memcpy(&w, p, len);
+      h ^= w * SUM_K2;
+      h = ((h << 31) | (h >> 33)) * SUM_K1;
+   }
+
+   return h;
+}
+
+static uint64_t
+sum_final(uint64_t h, uint64_t len)
+{
+   h ^= len;
+   h ^= h >> 33;
+   h *= SUM_K2;
+   h ^= h >> 29;
+   return h;
+}
+
+uint64_t
+savefile_checksum(const void *data, size_t len)
+{
+   return sum_final(sum_update(SUM_SEED, data, len), len);
+}
+
+bool
+savefile_verify(const void *data, size_t size, size_t *len)
+{
+   savefile_trailer t;
+
+   if (size < sizeof(t))
+      return false;
+
+   memcpy(&t, (const char *) data + size - sizeof(t), sizeof(t));
+   if (memcmp(t.magic, SAVEFILE_MAGIC, sizeof(t.magic)) != 0
+   ||  t.size != size - sizeof(t)
+   ||  t.checksum != savefile_checksum(data, t.size))
+      return false;
+
+   *len = t.size;
+   return true;
+}
+
+savefile *
+savefile_open(const char *path)
+{
+   savefile *f;
+
+   if ((f = calloc(1, sizeof(savefile))) == NULL
+   ||  (f->buf = malloc(SAVEFILE_BUFSIZE)) == NULL
+   ||  (f->path = strdup(path)) == NULL
+   ||  asprintf(&f->tmp_path, "%s.tmp.%ld", path, (long) getpid()) == -1)
+      err(1, "%s: out of memory", __FUNCTION__);
+
+   f->fd = open(f->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if (f->fd == -1) {
+      free(f->buf);
+      free(f->path);
+      free(f->tmp_path);
+      free(f);
+      return NULL;
+   }
+
+   f->sum = SUM_SEED;
+   return f;
+}
+
+/* write out the buffer */
+static void
+savefile_flush(savefile *f)
+{
+   ssize_t n;
+   size_t  done;
+
+   f->sum = sum_update(f->sum, (unsigned char *) f->buf, f->used);
+   for (done = 0; done < f->used && f->error == 0; done += n) {
+      if ((n = write(f->fd, f->buf + done, f->used - done)) == -1) {
+         if (errno == EINTR)
+            n = 0;
+         else
+            f->error = errno;
+      }
+   }
+
+   f->used = 0;
+}
+
+void
+savefile_write(savefile *f, const void *data, size_t len)
+{
+   const char *p;
+   size_t      n;
+
+   f->size += len;
+   for (p = data; len > 0; p += n, len -= n) {
+      n = MIN(len, SAVEFILE_BUFSIZE - f->used);
+      memcpy(f->buf + f->used, p, n);
+      f->used += n;
+      if (f->used == SAVEFILE_BUFSIZE)
+         savefile_flush(f);
+   }
+}
+
+void
+savefile_puts(savefile *f, const char *s)
+{
+   savefile_write(f, s, strlen(s));
+}
+
+/* fsync(2) the directory holding a file, so a rename(2) in it is kept */
+static void
+savefile_sync_dir(const char *path)
+{
+   char *copy;
+   int   fd;
+
+   if ((copy = strdup(path)) == NULL)
+      err(1, "%s: strdup failed", __FUNCTION__);
+
+   if ((fd = open(dirname(copy), O_RDONLY)) != -1) {
+      fsync(fd);
+      close(fd);
+   }
+
+   free(copy);
+}
+
+static void
+savefile_free(savefile *f)
+{
+   free(f->buf);
+   free(f->path);
+   free(f->tmp_path);
+   free(f);
+}
+
+int
+savefile_close(savefile *f, bool trailer)
+{
+   savefile_trailer t;
+   int              error;
+
+   if (trailer) {
+      savefile_flush(f);
+      memset(&t, 0, sizeof(t));
+      memcpy(t.magic, SAVEFILE_MAGIC, sizeof(t.magic));
+      t.size = f->size;
+      t.checksum = sum_final(f->sum, f->size);
+      savefile_write(f, &t, sizeof(t));
+   }
+
+   savefile_flush(f);
+   if (f->error == 0 && fsync(f->fd) == -1)
+      f->error = errno;
+   if (close(f->fd) == -1 && f->error == 0)
+      f->error = errno;
+   if (f->error == 0 && rename(f->tmp_path, f->path) == -1)
+      f->error = errno;
+
+   if ((error = f->error) != 0)
+      unlink(f->tmp_path);
+   else
+      savefile_sync_dir(f->path);
+
+   savefile_free(f);
+   if (error != 0) {
+      errno = error;
+      return -1;
+   }
+   return 0;
+}
+
+void
+savefile_abort(savefile *f)
+{
+   close(f->fd);
+   unlink(f->tmp_path);
+   savefile_free(f);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SAVEFILE_H
+#define SAVEFILE_H
+
+#include <sys/param.h>
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compat.h"
+
+/*
+ * Crash-safe writing of whole files (the database, playlists, and their ids
+ * files).  A file is written under a temporary name next to it, through a
+ * large buffer, then fsync(2)'d and rename(2)'d over the old file, so a
+ * crash leaves either the old file or the new one, never a partial one.
+ *
+ * A running checksum of everything written is kept, which savefile_close()
+ * can append as a savefile_trailer for savefile_verify() to check when the
+ * file is read back.  Formats that other programs read (the playlists) are
+ * written without one.
+ */
+
+#define SAVEFILE_BUFSIZE  (1024 * 1024)   /* must be a multiple of 8 */
+#define SAVEFILE_MAGIC    "vtsum01"
+
+typedef struct {
+   char     magic[8];     /* SAVEFILE_MAGIC */
+   uint64_t size;         /* bytes before the trailer */
+   uint64_t checksum;     /* savefile_checksum() of them */
+} savefile_trailer;
+
+typedef struct {
+   char     *path;        /* file being replaced */
+   char     *tmp_path;    /* what it's written as until then */
+   int       fd;
+   char     *buf;
+   size_t    used;        /* bytes in buf */
+   uint64_t  size;        /* bytes written, buffered or not */
+   uint64_t  sum;         /* checksum state of the bytes flushed */
+   int       error;       /* first errno writing, 0 if none */
+} savefile;
+
+/* start writing a new version of path.  returns NULL (and errno) on error */
+savefile *savefile_open(const char *path);
+
+/* write to a savefile.  errors are remembered and reported when closed */
+void savefile_write(savefile *f, const void *data, size_t len);
+void savefile_puts(savefile *f, const char *s);
+
+/*
+ * finish a savefile, with a trailer if asked, replacing the old file with
+ * it.  returns 0 on success, or -1 (and errno) after removing the temporary
+ * file, leaving the old file as it was.  either way f is freed.
+ */
+int  savefile_close(savefile *f, bool trailer);
+
+/* give up on a savefile, leaving the old file as it was */
+void savefile_abort(savefile *f);
+
+/* the checksum stored in a trailer for len bytes of data */
+uint64_t savefile_checksum(const void *data, size_t len);
+
+/*
+ * check that a file read into memory ends with a good trailer, setting *len
+ * to the size of the data before it.  returns false if it doesn't.
+ */
+bool savefile_verify(const void *data, size_t size, size_t *len);
+
+#endif
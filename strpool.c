@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "strpool.h"
+
+#define STRPOOL_INITIAL_CAPACITY 4096
+#define STRPOOL_CHUNK_SIZE       65536
+
+typedef struct {
+   const char *s;       /* NULL = empty slot */
+   uint32_t    hash;
+} strpool_entry;
+
+/* strings are copied into a list of chunks, each filled front to back */
+typedef struct strpool_chunk {
+   struct strpool_chunk *next;
+   size_t                used;
+   size_t                size;
+   char                  data[];
+} strpool_chunk;
+
+static struct {
+   strpool_entry  *entries;
+   size_t          capacity;   /* always a power of 2 */
+   size_t          nused;
+   strpool_chunk  *chunks;     /* the one being filled is first */
+} pool;
+
+static pthread_mutex_t strpool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a hash of a string */
+static uint32_t
+strpool_hash(const char *s)
+{
+   uint32_t h = 2166136261u;
+
+   while (*s != '\0') {
+      h ^= (unsigned char) *s++;
+      h *= 16777619u;
+   }
+
+   return h;
+}
+
+/* slot holding s, or if it isn't in the table, where it should go */
+static strpool_entry *
+strpool_slot(const char *s, uint32_t hash)
+{
+   strpool_entry *e;
+   size_t         mask, i;
+
+   mask = pool.capacity - 1;
+   for (i = hash & mask; ; i = (i + 1) & mask) {
+      e = &(pool.entries[i]);
+      if (e->s == NULL || (e->hash == hash && strcmp(e->s, s) == 0))
+         return e;
+   }
+}
+
+/* rebuild the table with the given capacity */
+static void
+strpool_resize(size_t capacity)
+{
+   strpool_entry *old, *e;
+   size_t         oldcap, i;
+
+   old = pool.entries;
+   oldcap = pool.capacity;
+
+   if ((pool.entries = calloc(capacity, sizeof(strpool_entry))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   pool.capacity = capacity;
+   for (i = 0; i < oldcap; i++) {
+      if (old[i].s != NULL) {
+         e = strpool_slot(old[i].s, old[i].hash);
+         *e = old[i];
+      }
+   }
+
+   free(old);
+}
+
+/* copy s into the current chunk, starting a new one if it doesn't fit */
+static const char *
+strpool_copy(const char *s)
+{
+   strpool_chunk *c;
+   size_t         len, size;
+   char          *copy;
+
+   len = strlen(s) + 1;
+   c = pool.chunks;
+   if (c == NULL || c->size - c->used < len) {
+      /* big strings get a chunk of their own, behind the current one */
+      size = MAX(len, STRPOOL_CHUNK_SIZE);
+      if ((c = malloc(sizeof(strpool_chunk) + size)) == NULL)
+         err(1, "%s: malloc(3) failed", __FUNCTION__);
+
+      c->used = 0;
+      c->size = size;
+      if (len > STRPOOL_CHUNK_SIZE / 4 && pool.chunks != NULL) {
+         c->next = pool.chunks->next;
+         pool.chunks->next = c;
+      } else {
+         c->next = pool.chunks;
+         pool.chunks = c;
+      }
+   }
+
+   copy = c->data + c->used;
+   memcpy(copy, s, len);
+   c->used += len;
+   return copy;
+}
+
+/* find s, adding it (copied or not) if it's not there yet */
+static const char *
+strpool_find(const char *s, bool copy)
+{
+   strpool_entry *e;
+   const char    *ret;
+   uint32_t       hash;
+
+   if (s == NULL)
+      return NULL;
+
+   hash = strpool_hash(s);
+
+   pthread_mutex_lock(&strpool_lock);
+
+   if (pool.nused * 2 >= pool.capacity)
+      strpool_resize(pool.capacity == 0 ? STRPOOL_INITIAL_CAPACITY
+                                        : pool.capacity * 2);
+
+   e = strpool_slot(s, hash);
+   if (e->s == NULL) {
+      e->s = (copy ? strpool_copy(s) : s);
+      e->hash = hash;
+      pool.nused++;
+   }
+   ret = e->s;
+
+   pthread_mutex_unlock(&strpool_lock);
+   return ret;
+}
+
+const char *
+strpool_intern(const char *s)
+{
+   return strpool_find(s, true);
+}
+
+const char *
+strpool_adopt(const char *s)
+{
+   return strpool_find(s, false);
+}
+
+void
+strpool_clear(void)
+{
+   strpool_chunk *c, *next;
+
+   pthread_mutex_lock(&strpool_lock);
+
+   for (c = pool.chunks; c != NULL; c = next) {
+      next = c->next;
+      free(c);
+   }
+
+   free(pool.entries);
+   pool.entries = NULL;
+   pool.capacity = 0;
+   pool.nused = 0;
+   pool.chunks = NULL;
+
+   pthread_mutex_unlock(&strpool_lock);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compat.h"
+
+/*
+ * The string pool: one global, shared copy of every distinct meta-info
+ * string (artist, album, genre, ...).  A 20 track album keeps its artist
+ * and album names once instead of 20 times, and two interned strings are
+ * equal exactly when they are the same pointer.
+ *
+ * Strings are kept in an open-addressed hash table and copied into large
+ * chunks of memory, and are never freed individually, only all at once by
+ * strpool_clear().  Interned strings must never be modified.  All routines
+ * are safe to call from several threads at once.
+ */
+
+/* return the pooled copy of s (NULL for NULL), copying s in if it's new */
+const char *strpool_intern(const char *s);
+
+/*
+ * like strpool_intern(), but if s is new it is added to the pool as is,
+ * without copying.  the caller must keep s valid until strpool_clear().
+ * used for strings in the mmap(2)'d database.
+ */
+const char *strpool_adopt(const char *s);
+
+/* drop all strings in the pool and free its memory */
+void strpool_clear(void);
+
+#endif
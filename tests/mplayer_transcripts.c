@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Feeds recorded mplayer slave-mode transcripts through the mplayer backend's
+ * line reader (mplayer_monitor()) and checks the position, volume, and
+ * playnext events that come out.  The backend is included whole, so its
+ * static state can be set up and inspected; no mplayer is run.
+ *
+ * Build and run with "make test".
+ */
+
+#include "../players/mplayer.c"
+
+static int failures = 0;
+static int playnexts = 0;
+static int feed_fd = -1;
+
+#define CHECK(cond) do { \
+   if (!(cond)) { \
+      fprintf(stderr, "%s:%d: %s: check failed: %s\n", \
+         __FILE__, __LINE__, __FUNCTION__, #cond); \
+      failures++; \
+   } \
+} while (0)
+
+static void
+count_playnext(void)
+{
+   playnexts++;
+}
+
+/* what mplayer_start() does, with a pipe written by the test for mplayer */
+static void
+start(void)
+{
+   int fds[2];
+
+   if (pipe(fds) == -1)
+      err(1, "pipe");
+   if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1)
+      err(1, "fcntl");
+
+   if (feed_fd != -1)
+      close(feed_fd);
+   if (mplayer_state.pipe_read > 0)
+      close(mplayer_state.pipe_read);
+   feed_fd = fds[1];
+
+   mplayer_state.pipe_read  = fds[0];
+   mplayer_state.pipe_eof   = false;
+   mplayer_state.qhead      = 0;
+   mplayer_state.qcount     = 0;
+   mplayer_reader.len       = 0;
+
+   mplayer_state.playing  = false;
+   mplayer_state.paused   = false;
+   mplayer_state.volume   = -1;
+   mplayer_state.position = 0;
+   mplayer_state.current_song = NULL;
+
+   playnexts = 0;
+}
+
+/* write a piece of transcript, and let the monitor read all of it */
+static void
+feed(const char *chunk)
+{
+   size_t len;
+   int    i;
+
+   len = strlen(chunk);
+   if (write(feed_fd, chunk, len) != (ssize_t) len)
+      err(1, "write");
+
+   /* each call reads at most what fits in the buffer */
+   for (i = 0; i < 8; i++)
+      mplayer_monitor();
+}
+
+static void
+test_split_answer(void)
+{
+   start();
+   mplayer_play("/music/a.mp3");
+
+   feed("ANS_time_p");
+   CHECK(mplayer_get_position() == 0);
+   feed("os=12.5\n");
+   CHECK(mplayer_get_position() == 12.5);
+   CHECK(playnexts == 0);
+
+   /* and one split right before its newline */
+   mplayer_poll();
+   feed("ANS_time_pos=13.5");
+   CHECK(mplayer_get_position() == 12.5);
+   feed("\n");
+   CHECK(mplayer_get_position() == 13.5);
+}
+
+static void
+test_noise(void)
+{
+   start();
+   mplayer_play("/music/a.mp3");
+
+   feed("\n"
+        "Playing /music/a.mp3.\n"
+        "Audio only file format detected.\n"
+        "==========================================================\n"
+        "Opening audio decoder: [mpg123] MPEG 1.0/2.0/2.5 layers I, II, "
+           "III\n"
+        "AUDIO: 44100 Hz, 2 ch, s16le, 320.0 kbit/22.68% "
+           "(ratio: 40000->176400)\n"
+        "Selected audio codec: [mpg123] afm: mpg123 "
+           "(MPEG 1.0/2.0/2.5 layers I, II, III)\n"
+        "==========================================================\n"
+        "AO: [pulse] 44100Hz 2ch s16le (2 bytes per sample)\n"
+        "Video: no video\n"
+        "Starting playback...\n"
+        "ANS_time_pos=0.1\n");
+   CHECK(mplayer_get_position() == 0.1f);
+
+   /* noise between a query and its answer, and a malformed answer */
+   mplayer_poll();
+   feed("A:   2.0 (02.0) of 215.0 (03:35.0)  0.4%\n"
+        "ANS_time_pos=\n"
+        "ANS_time_pos=2.5\n");
+   CHECK(mplayer_get_position() == 2.5);
+   CHECK(playnexts == 0);
+}
+
+static void
+test_long_line(void)
+{
+   char line[MPLAYER_LINE_MAX * 2];
+
+   start();
+   mplayer_play("/music/a.mp3");
+
+   /* a line filling the buffer is thrown away, answers around it are not */
+   memset(line, 'x', sizeof(line) - 1);
+   line[sizeof(line) - 1] = '\0';
+   feed(line);
+   feed("\nANS_time_pos=4.0\n");
+   CHECK(mplayer_get_position() == 4.0);
+   CHECK(mplayer_reader.len == 0);
+
+   /* even one that looks like an answer */
+   mplayer_poll();
+   memcpy(line, "ANS_ERROR=PROPERTY_UNAVAILABLE", 30);
+   feed(line);
+   feed("\nANS_time_pos=5.0\n");
+   CHECK(mplayer_get_position() == 5.0);
+   CHECK(playnexts == 0);
+}
+
+static void
+test_stale_after_loadfile(void)
+{
+   start();
+   mplayer_play("/music/a.mp3");
+   feed("ANS_time_pos=200.0\n");
+   CHECK(mplayer_get_position() == 200.0);
+
+   /* a poll goes out, and the next song is loaded before it's answered */
+   mplayer_poll();
+   mplayer_play("/music/b.mp3");
+   CHECK(mplayer_get_position() == 0);
+
+   /* the answer to the poll is about a.mp3 and changes nothing */
+   feed("ANS_time_pos=201.0\n");
+   CHECK(mplayer_get_position() == 0);
+
+   /* the answer to the query sent with loadfile is about b.mp3 */
+   feed("ANS_time_pos=0.2\n");
+   CHECK(mplayer_get_position() == 0.2f);
+
+   /* the same when the stale query fails, as it does at the end of a.mp3 */
+   mplayer_poll();
+   mplayer_play("/music/c.mp3");
+   feed("ANS_ERROR=PROPERTY_UNAVAILABLE\n"
+        "ANS_time_pos=0.3\n");
+   CHECK(mplayer_get_position() == 0.3f);
+   CHECK(playnexts == 0);
+}
+
+static void
+test_end_of_song(void)
+{
+   start();
+   mplayer_play("/music/a.mp3");
+   feed("ANS_time_pos=214.9\n");
+
+   mplayer_poll();
+   feed("\n\nEOF code: 1\n\nANS_ERROR=PROPERTY_UNAVAILABLE\n");
+   CHECK(playnexts == 1);
+
+   /* failures that answer nothing are ignored */
+   feed("ANS_ERROR=PROPERTY_UNAVAILABLE\n");
+   CHECK(playnexts == 1);
+
+   /* nor does a failure end a paused song (no polls are sent then) */
+   mplayer_play("/music/b.mp3");
+   mplayer_pause();
+   feed("ANS_ERROR=PROPERTY_UNAVAILABLE\n");
+   CHECK(playnexts == 1);
+}
+
+static void
+test_volume(void)
+{
+   start();
+   mplayer_play("/music/a.mp3");
+   feed("ANS_time_pos=1.0\n");
+
+   mplayer_volume_query();
+   feed("ANS_volume=55.000000\n");
+   CHECK(mplayer_get_volume() == 55);
+
+   /* a failed volume query ahead of a poll doesn't end the song */
+   mplayer_volume_query();
+   mplayer_poll();
+   feed("ANS_ERROR=PROPERTY_UNAVAILABLE\n");
+   CHECK(playnexts == 0);
+   feed("ANS_time_pos=6.0\n");
+   CHECK(mplayer_get_position() == 6.0);
+
+   /* nor one behind it */
+   mplayer_poll();
+   mplayer_volume_query();
+   feed("ANS_time_pos=7.0\n"
+        "ANS_ERROR=PROPERTY_UNAVAILABLE\n");
+   CHECK(mplayer_get_position() == 7.0);
+   CHECK(playnexts == 0);
+   CHECK(mplayer_state.qcount == 0);
+
+   /* the volume is set again for the next song, and queried */
+   mplayer_play("/music/b.mp3");
+   feed("ANS_time_pos=0.0\n"
+        "ANS_volume=55.000000\n");
+   CHECK(mplayer_get_volume() == 55);
+   CHECK(mplayer_state.qcount == 0);
+}
+
+static void
+test_eof(void)
+{
+   start();
+   mplayer_play("/music/a.mp3");
+   CHECK(mplayer_fd() == mplayer_state.pipe_read);
+
+   /* what's left before EOF is still read */
+   feed("ANS_time_pos=3.0\n");
+   close(feed_fd);
+   feed_fd = -1;
+   mplayer_monitor();
+
+   CHECK(mplayer_get_position() == 3.0);
+   CHECK(mplayer_fd() == -1);
+   CHECK(playnexts == 0);
+}
+
+int
+main(void)
+{
+   int fd;
+
+   /* commands sent to "mplayer" go nowhere */
+   if ((fd = open("/dev/null", O_WRONLY)) == -1)
+      err(1, "/dev/null");
+   mplayer_state.pipe_write = fd;
+   mplayer_set_callback_playnext(count_playnext);
+
+   test_split_answer();
+   test_noise();
+   test_long_line();
+   test_stale_after_loadfile();
+   test_end_of_song();
+   test_volume();
+   test_eof();
+
+   if (failures > 0) {
+      fprintf(stderr, "%d check(s) failed\n", failures);
+      return 1;
+   }
+
+   printf("mplayer transcripts: all checks passed\n");
+   return 0;
+}
@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "tokindex.h"
+
+#define TOKINDEX_INITIAL_CAPACITY   1024
+#define TOKINDEX_CHUNK_SIZE         8
+
+/*
+ * a query token whose candidate words have more postings than this many
+ * times the number of records is not worth sorting, it is scanned instead
+ */
+#define TOKINDEX_GATHER_FACTOR      2
+
+/* is c part of a word (see tokindex.h) */
+#define TOKINDEX_WORDCHAR(c) \
+   (isalnum((unsigned char) (c)) || (unsigned char) (c) >= 0x80)
+
+/* FNV-1a hash of a word */
+static uint32_t
+tokindex_hash(const char *s, size_t len)
+{
+   uint32_t h = 2166136261u;
+   size_t   i;
+
+   for (i = 0; i < len; i++) {
+      h ^= (unsigned char) s[i];
+      h *= 16777619u;
+   }
+
+   return h;
+}
+
+/*
+ * Return the slot holding the given word, or if it's not in the table, the
+ * (empty) slot where it should be inserted.  Words are never removed, so
+ * there are no tombstones.
+ */
+static tokindex_word *
+tokindex_slot(const tokindex *idx, const char *word, size_t len, uint32_t hash)
+{
+   tokindex_word *w;
+   size_t         mask, i;
+
+   mask = idx->capacity - 1;
+   for (i = hash & mask; ; i = (i + 1) & mask) {
+      w = &(idx->words[i]);
+      if (w->word == NULL)
+         return w;
+
+      if (w->hash == hash && strncmp(w->word, word, len) == 0
+      &&  w->word[len] == '\0')
+         return w;
+   }
+}
+
+static void
+tokindex_resize(tokindex *idx, size_t capacity)
+{
+   tokindex_word *old, *w;
+   size_t         oldcap, i;
+
+   old = idx->words;
+   oldcap = idx->capacity;
+
+   if ((idx->words = calloc(capacity, sizeof(tokindex_word))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   idx->capacity = capacity;
+   for (i = 0; i < oldcap; i++) {
+      if (old[i].word == NULL)
+         continue;
+
+      w = tokindex_slot(idx, old[i].word, strlen(old[i].word), old[i].hash);
+      *w = old[i];
+   }
+
+   free(old);
+}
+
+/* find a word in the vocabulary, adding it if create is set */
+static tokindex_word *
+tokindex_lookup(tokindex *idx, const char *word, size_t len, bool create)
+{
+   tokindex_word *w;
+   uint32_t       hash;
+
+   hash = tokindex_hash(word, len);
+   w = tokindex_slot(idx, word, len, hash);
+   if (w->word != NULL || !create)
+      return (w->word != NULL ? w : NULL);
+
+   /* keep the load under 3/4 */
+   if ((idx->nwords + 1) * 4 >= idx->capacity * 3) {
+      tokindex_resize(idx, idx->capacity * 2);
+      w = tokindex_slot(idx, word, len, hash);
+   }
+
+   if ((w->word = strndup(word, len)) == NULL)
+      err(1, "%s: strndup(3) failed", __FUNCTION__);
+
+   w->hash = hash;
+   idx->nwords++;
+   return w;
+}
+
+/* position of mi in a posting list, or where it would be inserted */
+static int
+tokindex_postings_find(const tokindex_postings *p, const meta_info *mi,
+   bool *found)
+{
+   int lo, hi, mid;
+
+   lo = 0;
+   hi = p->nrecs;
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if ((uintptr_t) p->recs[mid] < (uintptr_t) mi)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   *found = (lo < p->nrecs && p->recs[lo] == mi);
+   return lo;
+}
+
+static void
+tokindex_postings_grow(tokindex_postings *p, int n)
+{
+   if (p->nrecs + n <= p->capacity)
+      return;
+
+   while (p->nrecs + n > p->capacity)
+      p->capacity = (p->capacity == 0 ? TOKINDEX_CHUNK_SIZE : p->capacity * 2);
+
+   p->recs = realloc(p->recs, p->capacity * sizeof(meta_info*));
+   if (p->recs == NULL)
+      err(1, "%s: realloc(3) failed", __FUNCTION__);
+}
+
+/* add a record to a posting list, if it's not already there */
+static void
+tokindex_postings_add(tokindex_postings *p, meta_info *mi)
+{
+   bool found;
+   int  i;
+
+   /* records are usually added in address order (see tokindex_build) */
+   if (p->nrecs == 0 || (uintptr_t) p->recs[p->nrecs - 1] < (uintptr_t) mi)
+      i = p->nrecs;
+   else {
+      i = tokindex_postings_find(p, mi, &found);
+      if (found)
+         return;
+   }
+
+   tokindex_postings_grow(p, 1);
+   memmove(p->recs + i + 1, p->recs + i, (p->nrecs - i) * sizeof(meta_info*));
+   p->recs[i] = mi;
+   p->nrecs++;
+}
+
+static void
+tokindex_postings_remove(tokindex_postings *p, const meta_info *mi)
+{
+   bool found;
+   int  i;
+
+   i = tokindex_postings_find(p, mi, &found);
+   if (!found)
+      return;
+
+   memmove(p->recs + i, p->recs + i + 1, (p->nrecs - i - 1) * sizeof(meta_info*));
+   p->nrecs--;
+}
+
+/* add/remove a record to/from the postings of each word in a string */
+static void
+tokindex_string(tokindex *idx, meta_info *mi, const char *s, int in, bool add,
+   char **buf, size_t *bufsize)
+{
+   tokindex_word *w;
+   size_t         len, i;
+
+   len = strlen(s) + 1;
+   if (len > *bufsize) {
+      if ((*buf = realloc(*buf, len)) == NULL)
+         err(1, "%s: realloc(3) failed", __FUNCTION__);
+      *bufsize = len;
+   }
+
+   while (*s != '\0') {
+      while (*s != '\0' && !TOKINDEX_WORDCHAR(*s))
+         s++;
+
+      for (i = 0; TOKINDEX_WORDCHAR(s[i]); i++)
+         (*buf)[i] = tolower((unsigned char) s[i]);
+
+      if (i == 0)
+         break;
+
+      w = tokindex_lookup(idx, *buf, i, add);
+      if (add)
+         tokindex_postings_add(&(w->in[in]), mi);
+      else if (w != NULL)
+         tokindex_postings_remove(&(w->in[in]), mi);
+
+      s += i;
+   }
+}
+
+/* add/remove a record to/from the postings of each of its words */
+static void
+tokindex_record(tokindex *idx, meta_info *mi, bool add)
+{
+   const char *s;
+   char  *buf;
+   size_t bufsize;
+   int    i;
+
+   buf = NULL;
+   bufsize = 0;
+
+   tokindex_string(idx, mi, mi->filename, TOKINDEX_FILENAME, add,
+      &buf, &bufsize);
+   for (i = 0; i < MI_NUM_CINFO; i++) {
+      if ((s = mi_cinfo(mi, i)) != NULL)
+         tokindex_string(idx, mi, s, TOKINDEX_CINFO, add, &buf, &bufsize);
+   }
+
+   free(buf);
+}
+
+/* drop the whole vocabulary */
+static void
+tokindex_clear(tokindex *idx)
+{
+   size_t i;
+
+   for (i = 0; i < idx->capacity; i++) {
+      if (idx->words[i].word == NULL)
+         continue;
+
+      free(idx->words[i].word);
+      free(idx->words[i].in[TOKINDEX_CINFO].recs);
+      free(idx->words[i].in[TOKINDEX_FILENAME].recs);
+   }
+
+   free(idx->words);
+   idx->words = NULL;
+   idx->capacity = 0;
+   idx->nwords = 0;
+   idx->nrecords = 0;
+   idx->built = false;
+   idx->prepared = false;
+}
+
+tokindex *
+tokindex_new(void)
+{
+   tokindex *idx;
+
+   if ((idx = calloc(1, sizeof(tokindex))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   tokindex_resize(idx, TOKINDEX_INITIAL_CAPACITY);
+   return idx;
+}
+
+void
+tokindex_free(tokindex *idx)
+{
+   int i;
+
+   tokindex_clear(idx);
+   for (i = 0; i < MI_MAX_QUERY_TOKENS; i++)
+      free(idx->qpost[i].recs);
+
+   free(idx);
+}
+
+static int
+tokindex_addr_cmp(const void *a, const void *b)
+{
+   uintptr_t x = (uintptr_t) *(meta_info * const *) a;
+   uintptr_t y = (uintptr_t) *(meta_info * const *) b;
+
+   return (x > y) - (x < y);
+}
+
+void
+tokindex_build(tokindex *idx, meta_info **files, int nfiles)
+{
+   meta_info **sorted;
+   int         i;
+
+   tokindex_clear(idx);
+   tokindex_resize(idx, TOKINDEX_INITIAL_CAPACITY);
+
+   /* adding in address order only ever appends to the posting lists */
+   if ((sorted = malloc((nfiles + 1) * sizeof(meta_info*))) == NULL)
+      err(1, "%s: malloc(3) failed", __FUNCTION__);
+
+   memcpy(sorted, files, nfiles * sizeof(meta_info*));
+   qsort(sorted, nfiles, sizeof(meta_info*), tokindex_addr_cmp);
+
+   for (i = 0; i < nfiles; i++)
+      tokindex_record(idx, sorted[i], true);
+
+   free(sorted);
+   idx->nrecords = nfiles;
+   idx->built = true;
+}
+
+void
+tokindex_add(tokindex *idx, meta_info *mi)
+{
+   if (!idx->built)
+      return;
+
+   tokindex_record(idx, mi, true);
+   idx->nrecords++;
+   idx->prepared = false;
+}
+
+void
+tokindex_remove(tokindex *idx, meta_info *mi)
+{
+   if (!idx->built)
+      return;
+
+   tokindex_record(idx, mi, false);
+   idx->nrecords--;
+   idx->prepared = false;
+}
+
+/*
+ * Collect the records with a word containing the given (case-folded) piece
+ * of a query token into p, sorted and without duplicates.  Returns false if
+ * there are too many to be worth it.
+ */
+static bool
+tokindex_gather(const tokindex *idx, const char *piece, tokindex_postings *p)
+{
+   const tokindex_word *w;
+   size_t  i, max;
+   int     in, j, n;
+
+   max = (size_t) idx->nrecords * TOKINDEX_GATHER_FACTOR;
+   p->nrecs = 0;
+   for (i = 0; i < idx->capacity; i++) {
+      w = &(idx->words[i]);
+      if (w->word == NULL || strstr(w->word, piece) == NULL)
+         continue;
+
+      for (in = TOKINDEX_CINFO; in <= TOKINDEX_FILENAME; in++) {
+         if (in == TOKINDEX_FILENAME && !mi_query_match_filename)
+            continue;
+
+         if ((size_t) (p->nrecs + w->in[in].nrecs) > max)
+            return false;
+
+         tokindex_postings_grow(p, w->in[in].nrecs);
+         memcpy(p->recs + p->nrecs, w->in[in].recs,
+            w->in[in].nrecs * sizeof(meta_info*));
+         p->nrecs += w->in[in].nrecs;
+      }
+   }
+
+   qsort(p->recs, p->nrecs, sizeof(meta_info*), tokindex_addr_cmp);
+   for (j = n = 0; j < p->nrecs; j++) {
+      if (n == 0 || p->recs[n - 1] != p->recs[j])
+         p->recs[n++] = p->recs[j];
+   }
+   p->nrecs = n;
+
+   return true;
+}
+
+/* intersect the sorted list a with the sorted list b, leaving result in a */
+static void
+tokindex_intersect(tokindex_postings *a, const tokindex_postings *b)
+{
+   int i, j, n;
+
+   i = j = n = 0;
+   while (i < a->nrecs && j < b->nrecs) {
+      if (a->recs[i] == b->recs[j]) {
+         a->recs[n++] = a->recs[i];
+         i++;
+         j++;
+      } else if ((uintptr_t) a->recs[i] < (uintptr_t) b->recs[j])
+         i++;
+      else
+         j++;
+   }
+
+   a->nrecs = n;
+}
+
+void
+tokindex_prepare(tokindex *idx)
+{
+   tokindex_postings  piece_post;
+   char              *token, *s, *e;
+   int                i, npieces;
+   bool               whole;
+
+   memset(&piece_post, 0, sizeof(piece_post));
+
+   for (i = 0; i < _mi_query.ntokens; i++) {
+      idx->qtype[i] = TOKINDEX_SCAN;
+
+      /* numeric comparisons (year>=1990) are checked record by record */
+      if (_mi_query.field[i] >= 0)
+         continue;
+
+      if ((token = strdup(_mi_query.tokens[i])) == NULL)
+         err(1, "%s: strdup(3) failed", __FUNCTION__);
+
+      for (s = token; *s != '\0'; s++)
+         *s = tolower((unsigned char) *s);
+
+      /* candidates must contain every word-run of the token */
+      npieces = 0;
+      whole = false;
+      for (s = token; *s != '\0'; s = e) {
+         while (*s != '\0' && !TOKINDEX_WORDCHAR(*s))
+            s++;
+         for (e = s; TOKINDEX_WORDCHAR(*e); e++)
+            ;
+         if (e == s)
+            break;
+
+         whole = (s == token && *e == '\0');
+         if (*e != '\0')
+            *e++ = '\0';
+
+         if (!tokindex_gather(idx, s, &piece_post)) {
+            npieces = 0;
+            break;
+         }
+
+         if (npieces++ == 0) {
+            idx->qpost[i].nrecs = 0;
+            tokindex_postings_grow(&(idx->qpost[i]), piece_post.nrecs);
+            memcpy(idx->qpost[i].recs, piece_post.recs,
+               piece_post.nrecs * sizeof(meta_info*));
+            idx->qpost[i].nrecs = piece_post.nrecs;
+         } else
+            tokindex_intersect(&(idx->qpost[i]), &piece_post);
+      }
+
+      if (npieces > 0)
+         idx->qtype[i] = (whole ? TOKINDEX_EXACT : TOKINDEX_SUPERSET);
+
+      free(token);
+   }
+
+   free(piece_post.recs);
+   idx->prepared = true;
+}
+
+bool
+tokindex_match(const tokindex *idx, const meta_info *mi)
+{
+   bool  in, verify;
+   int   i;
+
+   if (!idx->prepared)
+      return mi_match(mi);
+
+   verify = false;
+   for (i = 0; i < _mi_query.ntokens; i++) {
+      if (idx->qtype[i] == TOKINDEX_SCAN) {
+         verify = true;
+         continue;
+      }
+
+      tokindex_postings_find(&(idx->qpost[i]), mi, &in);
+      if (idx->qtype[i] == TOKINDEX_EXACT) {
+         if (in != (bool) _mi_query.match[i])
+            return false;
+      } else if (!in) {
+         /* can't contain the token */
+         if (_mi_query.match[i])
+            return false;
+      } else
+         verify = true;
+   }
+
+   return (verify ? mi_match(mi) : true);
+}
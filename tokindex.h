@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TOKINDEX_H
+#define TOKINDEX_H
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "meta_info.h"
+
+#include "compat.h"
+
+/*
+ * The token index: an inverted index from every word appearing in the
+ * filename or cinfo fields of the library's records to the records
+ * containing it.  It is owned by the global medialib (mdb.tokens), built the
+ * first time the library is filtered or searched, and from then on kept in
+ * sync with mdb.library by the playlist_files_* routines.
+ *
+ * A word is a maximal run of letters, digits and non-ASCII bytes, and is
+ * stored case-folded with tolower(3), just as strcasestr(3) compares.  Any
+ * match of a query token inside a field therefore puts each word-run of the
+ * token inside a single word of the field, so the records matching a token
+ * are found by scanning the (much smaller) vocabulary instead of every
+ * record.  If the token is a single word-run, this is exactly the set of
+ * records mi_match() would accept for it.  Otherwise it is a superset, and
+ * records in it are checked with mi_match().  Results always equal those of
+ * mi_match().
+ *
+ * Posting lists hold meta_info pointers sorted by address, so they do not
+ * depend on the order of the library.
+ */
+
+typedef struct {
+   meta_info **recs;
+   int         nrecs;
+   int         capacity;
+} tokindex_postings;
+
+/* which part of the records a word appeared in */
+#define TOKINDEX_CINFO     0
+#define TOKINDEX_FILENAME  1
+
+typedef struct {
+   char              *word;      /* case-folded word, NULL = empty slot */
+   uint32_t           hash;      /* hash of word */
+   tokindex_postings  in[2];     /* records with the word, see above */
+} tokindex_word;
+
+/* how a compiled query token can be answered (see tokindex_prepare()) */
+#define TOKINDEX_SCAN      0     /* not at all, use mi_match() */
+#define TOKINDEX_EXACT     1     /* postings are exactly the matches */
+#define TOKINDEX_SUPERSET  2     /* postings include all matches */
+
+typedef struct {
+   tokindex_word     *words;
+   size_t             capacity;   /* always a power of 2 */
+   size_t             nwords;
+   int                nrecords;   /* records indexed */
+   bool               built;
+
+   /* the global query, as compiled by tokindex_prepare() */
+   bool               prepared;
+   int                qtype[MI_MAX_QUERY_TOKENS];
+   tokindex_postings  qpost[MI_MAX_QUERY_TOKENS];
+} tokindex;
+
+/* create/destroy an index */
+tokindex *tokindex_new(void);
+void tokindex_free(tokindex *idx);
+
+/* (re)build the index from scratch from the given records */
+void tokindex_build(tokindex *idx, meta_info **files, int nfiles);
+
+/* add/remove records (both are no-ops until the index is built) */
+void tokindex_add(tokindex *idx, meta_info *mi);
+void tokindex_remove(tokindex *idx, meta_info *mi);
+
+/*
+ * compile the global query (see mi_query_*) against the index.  this must
+ * be done each time the query changes, and before tokindex_match() is used.
+ * changing the index drops the compiled query.
+ */
+void tokindex_prepare(tokindex *idx);
+
+/*
+ * match a record of the index against the global query.  same result as
+ * mi_match(), but usually without looking at the record's strings.
+ */
+bool tokindex_match(const tokindex *idx, const meta_info *mi);
+
+#endif
@@ -33,7 +33,6 @@ int visual_mode_start = -1;
 volatile sig_atomic_t VSIG_QUIT = 0;            /* 1 = quit vitunes */
 volatile sig_atomic_t VSIG_RESIZE = 0;          /* 1 = resize display */
 volatile sig_atomic_t VSIG_SIGCHLD = 0;         /* 1 = got sigchld */
-volatile sig_atomic_t VSIG_PLAYER_MONITOR = 0;  /* 1 = update player stats */
 
 /*
  * enum used for QUIT_CAUSE values. Currently only one is used, but might add
@@ -73,7 +72,6 @@ char *player_backend;
 int  handle_switches(int argc, char *argv[]);
 void usage(const char *);
 void signal_handler(int);
-void setup_timer();
 
 
 int
@@ -138,7 +136,6 @@ main(int argc, char *argv[])
    signal(SIGQUIT,  signal_handler);   /* quit */
    signal(SIGTERM,  signal_handler);   /* quit */
    signal(SIGWINCH, signal_handler);   /* resize */
-   setup_timer();                      /* periodic timer to update player */
 
    /* init small stuff (XXX some must be done before medialib_load) */
    mi_query_init();        /* global query description */
@@ -147,8 +144,8 @@ main(int argc, char *argv[])
    ybuffer_init();         /* global yank/copy buffer */
    toggleset_init();       /* global toggleset (list of toggle-lists) */
 
-   /* load media library (database and all playlists) & sort */
-   medialib_load(db_file, playlist_dir);
+   /* load media library (database, playlists read when used) & sort */
+   medialib_load(db_file, playlist_dir, true);
    if (mdb.library->nfiles == 0) {
       printf("The vitunes database is currently empty.\n");
       printf("See 'vitunes -e help add' for how to add files.");
@@ -156,7 +153,7 @@ main(int argc, char *argv[])
    }
 
    /* apply default sort to library */
-   qsort(mdb.library->files, mdb.library->nfiles, sizeof(meta_info*), mi_compare);
+   mi_sort(playlist_files(mdb.library), mdb.library->nfiles);
 
    /* setup user interface and default colors */
    kb_init();
@@ -185,30 +182,67 @@ main(int argc, char *argv[])
 
    previous_command = -1;
    while (!VSIG_QUIT) {
-      struct timeval  tv;
+      struct timeval  tv, *tvp;
+      int             pfd, wfd, maxfd, ms, wms, nready;
 
-      /* handle any signal flags */
+      /* handle any signal flags and output from the player */
       process_signals();
 
-      tv.tv_sec = 1;
-      tv.tv_usec = 0;
+      /* repaint whatever the last round of input and signals changed */
+      paint_flush();
+
+      /* only wake up on a timer when the player or watcher need it */
+      tvp = NULL;
+      ms = player_poll_timeout();
+      if ((wms = watcher_timeout()) >= 0 && (ms < 0 || wms < ms))
+         ms = wms;
+      if (ms >= 0) {
+         tv.tv_sec = ms / 1000;
+         tv.tv_usec = (ms % 1000) * 1000;
+         tvp = &tv;
+      }
+
+      /* while playlists are left to read, read one whenever we're idle */
+      if (mdb.nunloaded > 0) {
+         tv.tv_sec = 0;
+         tv.tv_usec = 0;
+         tvp = &tv;
+      }
 
       FD_ZERO(&fds);
       FD_SET(0, &fds);
-      if(sock > 0)
+      maxfd = 0;
+      if(sock > 0) {
          FD_SET(sock, &fds);
+         maxfd = MAX(maxfd, sock);
+      }
+      if((pfd = player_fd()) >= 0) {
+         FD_SET(pfd, &fds);
+         maxfd = MAX(maxfd, pfd);
+      }
+      if((wfd = watcher_fd()) >= 0) {
+         FD_SET(wfd, &fds);
+         maxfd = MAX(maxfd, wfd);
+      }
       errno = 0;
-      if(select((sock > 0 ? sock : 0) + 1, &fds, NULL, NULL, &tv) == -1) {
+      if((nready = select(maxfd + 1, &fds, NULL, NULL, tvp)) == -1) {
          if(errno == 0 || errno == EINTR)
             continue;
          break;
       }
 
+      if(nready == 0 && mdb.nunloaded > 0)
+         medialib_playlist_resolve_next();
+
       if(sock > 0) {
          if(FD_ISSET(sock, &fds))
             sock_recv_and_exec(sock);
       }
 
+      if(wfd >= 0 && FD_ISSET(wfd, &fds))
+         watcher_read();
+      process_watcher();
+
       if(FD_ISSET(0, &fds)) {
          /* handle any available input */
          if ((input = getch()) && input != ERR) {
@@ -228,6 +262,7 @@ main(int argc, char *argv[])
 
    ui_destroy();
    player_destroy();
+   watcher_stop();
    medialib_destroy();
 
    mi_query_clear();
@@ -278,9 +313,6 @@ signal_handler(int sig)
       case SIGTERM:
          VSIG_QUIT = 1;
          break;
-      case SIGALRM:
-         VSIG_PLAYER_MONITOR = 1;
-         break;
       case SIGWINCH:
          VSIG_RESIZE = 1;
          break;
@@ -290,7 +322,46 @@ signal_handler(int sig)
    }
 }
 
-/* handle any signal flags */
+/*
+ * apply the changes to watched directories once they're due (see watcher.h),
+ * keeping the playing file and the view of the playlist window in place
+ */
+void
+process_watcher()
+{
+   watcher_counts  counts;
+   playlist       *queue;
+   const char     *playing;
+   int             idx;
+
+   queue = player_info.queue;
+   playing = NULL;
+   if (queue != NULL && player_info.qidx >= 0
+   &&  player_info.qidx < queue->nfiles)
+      playing = playlist_file(queue, player_info.qidx)->filename;
+
+   if (!watcher_flush(&counts))
+      return;
+
+   /* records are never freed, so the playing filename is still good */
+   if (playing != NULL && (idx = playlist_find(queue, playing)) != -1)
+      player_info.qidx = idx;
+
+   /* keep the cursor on a file, if there are any left */
+   ui.playlist->nrows = viewing_playlist->nfiles;
+   if (ui.playlist->voffset + ui.playlist->crow >= ui.playlist->nrows)
+      ui.playlist->crow = ui.playlist->nrows - ui.playlist->voffset - 1;
+   if (ui.playlist->crow < 0) {
+      ui.playlist->voffset = MAX(0, ui.playlist->voffset + ui.playlist->crow);
+      ui.playlist->crow = 0;
+   }
+
+   paint_damage(PAINT_LIBRARY | PAINT_PLAYLIST);
+   paint_message("library: %d added, %d updated, %d removed",
+      counts.added, counts.updated, counts.removed);
+}
+
+/* handle any signal flags and anything the player has to say */
 void
 process_signals()
 {
@@ -308,25 +379,24 @@ process_signals()
    }
 
    /* monitor player */
-   if (VSIG_PLAYER_MONITOR) {
+   if (player_fd() >= 0) {
       player_monitor();
 
       if (prev_is_playing || player.playing())
-         paint_player();
+         paint_damage(PAINT_PLAYER);
 
       /* need to repaint anything else? */
       if (prev_is_playing != player.playing()) {
-         paint_library();
-         paint_playlist();
+         paint_damage(PAINT_LIBRARY | PAINT_PLAYLIST);
       } else if (prev_queue != player_info.queue) {
-         paint_library();
+         paint_damage(PAINT_LIBRARY);
          if (prev_queue == viewing_playlist) {
-            paint_playlist();
+            paint_damage(PAINT_PLAYLIST);
          }
       }
       if (player_info.queue == viewing_playlist
       &&  prev_qidx != player_info.qidx) {
-         paint_playlist();
+         paint_damage(PAINT_PLAYLIST);
       }
       if (prev_volume != player.volume()) {
          paint_message("volume: %3.0f%%", player.volume());
@@ -336,7 +406,6 @@ process_signals()
       prev_queue = player_info.queue;
       prev_qidx = player_info.qidx;
       prev_is_playing = player.playing();
-      VSIG_PLAYER_MONITOR = 0;
    }
 
    /* restart player if needed */
@@ -346,33 +415,6 @@ process_signals()
    }
 }
 
-/* setup timer signal handler above */
-void
-setup_timer()
-{
-   struct sigaction sig_act;
-   struct itimerval timer;
-
-   /* create timer signal handler */
-   if (sigemptyset(&sig_act.sa_mask) < 0)
-      err(1, "setup_timer: sigemptyset failed");
-
-   sig_act.sa_flags = 0;
-   sig_act.sa_handler = signal_handler;
-   if (sigaction(SIGALRM, &sig_act, NULL) < 0)
-      err(1, "setup_timer: sigaction failed");
-
-   /* setup timer details */
-   timer.it_value.tv_sec = 0;
-   timer.it_value.tv_usec = 500000;    /* 1 half-second */
-   timer.it_interval.tv_sec = 0;
-   timer.it_interval.tv_usec = 500000; /* 1 half-second */
-
-   /* register timer */
-   if (setitimer(ITIMER_REAL, &timer, NULL) < 0)
-      err(1, "setup_timer: setitimer failed");
-}
-
 /*
  * load config file and execute all command-mode commands within.
  * XXX note that this requires mdb, ui, and player to all be loaded/setup
@@ -33,6 +33,7 @@
 #include "medialib.h"
 #include "player.h"
 #include "uinterface.h"
+#include "watcher.h"
 #include "e_commands.h"
 
 #include "compat.h"
@@ -52,5 +53,6 @@ extern volatile sig_atomic_t VSIG_QUIT;
 /* other */
 void load_config();
 void process_signals();
+void process_watcher();
 
 #endif
@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "watcher.h"
+
+#ifdef COMPAT_HAVE_INOTIFY
+#  include <sys/inotify.h>
+#endif
+
+/* the directories given to watcher_add(), NULL terminated */
+static char  **roots = NULL;
+static int     nroots = 0;
+
+/* files changed since the last flush, and when the first and last came */
+static char  **pending = NULL;
+static int     npending = 0;
+static int     pending_capacity = 0;
+static long    pending_first;
+static long    pending_last;
+
+/* milliseconds on a clock that only goes forward */
+static long
+watcher_now(void)
+{
+   struct timespec ts;
+
+   if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+      err(1, "%s: clock_gettime failed", __FUNCTION__);
+
+   return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* remember a file (dir/name, or just dir if name is NULL) as changed */
+static void
+watcher_pend(const char *dir, const char *name)
+{
+   char **new_pending;
+   int    capacity;
+
+   if (npending == pending_capacity) {
+      capacity = (pending_capacity == 0 ? 64 : pending_capacity * 2);
+      new_pending = realloc(pending, capacity * sizeof(char*));
+      if (new_pending == NULL)
+         err(1, "%s: realloc(3) failed", __FUNCTION__);
+
+      pending = new_pending;
+      pending_capacity = capacity;
+   }
+
+   if (name == NULL)
+      pending[npending] = strdup(dir);
+   else if (asprintf(&pending[npending], "%s/%s", dir, name) == -1)
+      pending[npending] = NULL;
+
+   if (pending[npending] == NULL)
+      err(1, "%s: failed to copy filename", __FUNCTION__);
+
+   pending_last = watcher_now();
+   if (npending++ == 0)
+      pending_first = pending_last;
+}
+
+static int
+watcher_strcmp(const void *a, const void *b)
+{
+   return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+#ifdef COMPAT_HAVE_INOTIFY
+
+#define WATCHER_EVENTS \
+   (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+   | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+/* the inotify(7) instance, and the directory of each of its watches */
+static int     ifd = -1;
+static char  **dirs = NULL;
+static int     dirs_capacity = 0;
+
+/* record the directory a watch is for (it may have been moved) */
+static void
+watcher_set_dir(int wd, const char *dir)
+{
+   char **new_dirs;
+   int    capacity;
+
+   if (wd >= dirs_capacity) {
+      capacity = MAX(dirs_capacity * 2, wd + 1);
+      if ((new_dirs = realloc(dirs, capacity * sizeof(char*))) == NULL)
+         err(1, "%s: realloc(3) failed", __FUNCTION__);
+
+      memset(new_dirs + dirs_capacity, 0,
+         (capacity - dirs_capacity) * sizeof(char*));
+      dirs = new_dirs;
+      dirs_capacity = capacity;
+   }
+
+   free(dirs[wd]);
+   if ((dirs[wd] = strdup(dir)) == NULL)
+      err(1, "%s: strdup(3) failed", __FUNCTION__);
+}
+
+/*
+ * Watch a directory and all directories below it, returning how many, or -1
+ * with errno set (when out of watches, see inotify(7), those added so far
+ * are kept).  The files in them are taken as changed if pend is set, for
+ * a directory that just appeared.
+ */
+static int
+watcher_add_tree(const char *dir, bool pend)
+{
+   FTSENT *ftsent;
+   FTS    *fts;
+   char   *paths[2];
+   int     wd, n, error;
+
+   paths[0] = (char *) dir;
+   paths[1] = NULL;
+   if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+      return -1;
+
+   n = 0;
+   error = 0;
+   while (error == 0 && (ftsent = fts_read(fts)) != NULL) {
+      switch (ftsent->fts_info) {
+         case FTS_D:
+            wd = inotify_add_watch(ifd, ftsent->fts_path, WATCHER_EVENTS);
+            if (wd == -1) {
+               error = errno;
+               break;
+            }
+            watcher_set_dir(wd, ftsent->fts_path);
+            n++;
+            break;
+
+         case FTS_F:
+            if (pend)
+               watcher_pend(ftsent->fts_path, NULL);
+            break;
+      }
+   }
+
+   fts_close(fts);
+   if (error != 0) {
+      errno = error;
+      return -1;
+   }
+
+   return n;
+}
+
+/*
+ * A directory was removed or moved away: stop watching it and below it, and
+ * take every file of the library in it as changed.
+ */
+static void
+watcher_forget_tree(const char *dir)
+{
+   meta_info *mi;
+   size_t     len;
+   int        i;
+
+   len = strlen(dir);
+   for (i = 0; i < dirs_capacity; i++) {
+      if (dirs[i] != NULL && strncmp(dirs[i], dir, len) == 0
+      &&  (dirs[i][len] == '\0' || dirs[i][len] == '/'))
+         inotify_rm_watch(ifd, i);
+   }
+
+   for (i = 0; i < mdb.library->nfiles; i++) {
+      mi = playlist_file(mdb.library, i);
+      if (!mi->is_url && strncmp(mi->filename, dir, len) == 0
+      &&  mi->filename[len] == '/')
+         watcher_pend(mi->filename, NULL);
+   }
+}
+
+/* handle one event */
+static void
+watcher_event(const struct inotify_event *ev)
+{
+   char *path;
+   int   i;
+
+   /* events were lost: check everything (once) */
+   if (ev->mask & IN_Q_OVERFLOW) {
+      for (i = 0; i < nroots; i++) {
+         watcher_forget_tree(roots[i]);
+         watcher_add_tree(roots[i], true);
+      }
+      return;
+   }
+
+   if (ev->wd < 0 || ev->wd >= dirs_capacity || dirs[ev->wd] == NULL)
+      return;
+
+   /* the watch is gone (removed, or its directory was) */
+   if (ev->mask & IN_IGNORED) {
+      free(dirs[ev->wd]);
+      dirs[ev->wd] = NULL;
+      return;
+   }
+
+   if (ev->len == 0)
+      return;
+
+   if (!(ev->mask & IN_ISDIR)) {
+      /* a new file is only looked at once it's written */
+      if (!(ev->mask & IN_CREATE))
+         watcher_pend(dirs[ev->wd], ev->name);
+      return;
+   }
+
+   if (asprintf(&path, "%s/%s", dirs[ev->wd], ev->name) == -1)
+      errx(1, "%s: asprintf failed", __FUNCTION__);
+
+   if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+      watcher_add_tree(path, true);
+   else
+      watcher_forget_tree(path);
+
+   free(path);
+}
+
+int
+watcher_add(const char *dir)
+{
+   char **new_roots;
+   char   fullname[PATH_MAX];
+   int    i, n;
+
+   if (realpath(dir, fullname) == NULL)
+      return -1;
+
+   if (ifd == -1 && (ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+      return -1;
+
+   if ((n = watcher_add_tree(fullname, false)) == -1)
+      return -1;
+
+   for (i = 0; i < nroots; i++) {
+      if (strcmp(roots[i], fullname) == 0)
+         return n;
+   }
+
+   if ((new_roots = realloc(roots, (nroots + 2) * sizeof(char*))) == NULL)
+      err(1, "%s: realloc(3) failed", __FUNCTION__);
+
+   roots = new_roots;
+   if ((roots[nroots++] = strdup(fullname)) == NULL)
+      err(1, "%s: strdup(3) failed", __FUNCTION__);
+   roots[nroots] = NULL;
+
+   return n;
+}
+
+int
+watcher_fd(void)
+{
+   return ifd;
+}
+
+void
+watcher_read(void)
+{
+   const struct inotify_event *ev;
+   char    buf[64 * 1024]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+   ssize_t n, off;
+
+   if (ifd == -1)
+      return;
+
+   for (;;) {
+      if ((n = read(ifd, buf, sizeof(buf))) == -1) {
+         if (errno == EINTR)
+            continue;
+         if (errno == EAGAIN)
+            return;
+         err(1, "%s: read(2) failed", __FUNCTION__);
+      }
+
+      off = 0;
+      while (off < n) {
+         ev = (const struct inotify_event *) (buf + off);
+         watcher_event(ev);
+         off += sizeof(struct inotify_event) + ev->len;
+      }
+   }
+}
+
+static void
+watcher_close(void)
+{
+   int i;
+
+   if (ifd != -1)
+      close(ifd);
+   ifd = -1;
+
+   for (i = 0; i < dirs_capacity; i++)
+      free(dirs[i]);
+   free(dirs);
+   dirs = NULL;
+   dirs_capacity = 0;
+}
+
+#else
+
+int
+watcher_add(const char *dir UNUSED)
+{
+   errno = EOPNOTSUPP;
+   return -1;
+}
+
+int
+watcher_fd(void)
+{
+   return -1;
+}
+
+void
+watcher_read(void)
+{
+}
+
+static void
+watcher_close(void)
+{
+}
+
+#endif
+
+void
+watcher_stop(void)
+{
+   int i;
+
+   watcher_close();
+
+   for (i = 0; i < nroots; i++)
+      free(roots[i]);
+   free(roots);
+   roots = NULL;
+   nroots = 0;
+
+   for (i = 0; i < npending; i++)
+      free(pending[i]);
+   free(pending);
+   pending = NULL;
+   npending = 0;
+   pending_capacity = 0;
+}
+
+char **
+watcher_roots(void)
+{
+   return roots;
+}
+
+int
+watcher_timeout(void)
+{
+   long due, now;
+
+   if (npending == 0)
+      return -1;
+
+   due = MIN(pending_last + WATCHER_DELAY, pending_first + WATCHER_MAX_DELAY);
+   now = watcher_now();
+   return (due > now ? due - now : 0);
+}
+
+bool
+watcher_flush(watcher_counts *c)
+{
+   int i;
+
+   memset(c, 0, sizeof(watcher_counts));
+   if (npending == 0 || watcher_timeout() > 0)
+      return false;
+
+   /* each file once, in order */
+   qsort(pending, npending, sizeof(char*), watcher_strcmp);
+   for (i = 0; i < npending; i++) {
+      if (i == 0 || strcmp(pending[i], pending[i - 1]) != 0) {
+         switch (medialib_db_check(pending[i])) {
+            case MEDIALIB_CHECK_ADDED:
+               c->added++;
+               break;
+            case MEDIALIB_CHECK_UPDATED:
+               c->updated++;
+               break;
+            case MEDIALIB_CHECK_REMOVED:
+               c->removed++;
+               break;
+         }
+      }
+   }
+
+   for (i = 0; i < npending; i++)
+      free(pending[i]);
+   npending = 0;
+
+   if (c->added + c->updated + c->removed == 0)
+      return false;
+
+   medialib_db_save(mdb.db_file);
+   return true;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fts.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "medialib.h"
+
+#include "compat.h"
+
+/*
+ * Watching directories of media files while vitunes runs, so the library
+ * follows changes to them without an "-e update" and ":reload db" (which
+ * stops playback).  This uses inotify(7), so is only supported on Linux.
+ *
+ * watcher_add() watches a directory and every directory below it (adding
+ * new ones as they appear).  When watcher_fd() is readable, watcher_read()
+ * collects the files changed, added, or removed.  Once no more changes have
+ * come for WATCHER_DELAY ms (or the first has waited WATCHER_MAX_DELAY ms),
+ * watcher_flush() checks just those files against the library with
+ * medialib_db_check() and saves the database.  watcher_timeout() says how
+ * long until then, for select(2).
+ */
+#define WATCHER_DELAY        500
+#define WATCHER_MAX_DELAY   5000
+
+/* what watcher_flush() did to the library */
+typedef struct {
+   int   added;
+   int   updated;
+   int   removed;
+} watcher_counts;
+
+/*
+ * start watching a directory, returning the number of directories watched
+ * for it, or -1 with errno set.  watcher_stop() stops watching them all.
+ */
+int  watcher_add(const char *dir);
+void watcher_stop(void);
+
+/* the directories given to watcher_add(), NULL terminated */
+char **watcher_roots(void);
+
+int  watcher_fd(void);           /* -1 if not watching anything */
+int  watcher_timeout(void);      /* ms until a flush is due, -1 if none */
+void watcher_read(void);
+
+/* apply the changes if they're due, returning whether the library changed */
+bool watcher_flush(watcher_counts *c);
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "workq.h"
+
+static void *
+workq_worker(void *arg)
+{
+   workq         *q = arg;
+   unsigned long  seq;
+   void          *job;
+
+   pthread_mutex_lock(&q->lock);
+   while (!q->quit) {
+      if (q->next == q->tail) {
+         pthread_cond_wait(&q->work_ready, &q->lock);
+         continue;
+      }
+
+      seq = q->next++;
+      job = q->slots[seq % q->window].job;
+
+      pthread_mutex_unlock(&q->lock);
+      q->fn(job);
+      pthread_mutex_lock(&q->lock);
+
+      q->slots[seq % q->window].done = true;
+      pthread_cond_broadcast(&q->work_done);
+   }
+   pthread_mutex_unlock(&q->lock);
+
+   return NULL;
+}
+
+workq *
+workq_new(int nthreads, int window, workq_fn fn)
+{
+   workq *q;
+   int    i;
+
+   if (nthreads < 1 || window < 1)
+      errx(1, "%s: bad thread count/window (%d/%d)", __FUNCTION__, nthreads,
+         window);
+
+   if ((q = malloc(sizeof(workq))) == NULL)
+      err(1, "%s: malloc(3) failed", __FUNCTION__);
+
+   if ((q->slots = calloc(window, sizeof(workq_slot))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   if ((q->threads = calloc(nthreads, sizeof(pthread_t))) == NULL)
+      err(1, "%s: calloc(3) failed", __FUNCTION__);
+
+   q->fn       = fn;
+   q->nthreads = nthreads;
+   q->window   = window;
+   q->head     = 0;
+   q->next     = 0;
+   q->tail     = 0;
+   q->quit     = false;
+
+   if (pthread_mutex_init(&q->lock, NULL) != 0
+   ||  pthread_cond_init(&q->work_ready, NULL) != 0
+   ||  pthread_cond_init(&q->work_done, NULL) != 0)
+      errx(1, "%s: failed to initialize locks", __FUNCTION__);
+
+   for (i = 0; i < nthreads; i++) {
+      if (pthread_create(&(q->threads[i]), NULL, workq_worker, q) != 0)
+         errx(1, "%s: pthread_create failed", __FUNCTION__);
+   }
+
+   return q;
+}
+
+void
+workq_free(workq *q)
+{
+   int i;
+
+   pthread_mutex_lock(&q->lock);
+   q->quit = true;
+   pthread_cond_broadcast(&q->work_ready);
+   pthread_mutex_unlock(&q->lock);
+
+   for (i = 0; i < q->nthreads; i++)
+      pthread_join(q->threads[i], NULL);
+
+   pthread_cond_destroy(&q->work_done);
+   pthread_cond_destroy(&q->work_ready);
+   pthread_mutex_destroy(&q->lock);
+
+   free(q->threads);
+   free(q->slots);
+   free(q);
+}
+
+/* wait for the oldest job to finish and hand it back (lock must be held) */
+static void *
+workq_pop(workq *q)
+{
+   void *job;
+
+   while (!q->slots[q->head % q->window].done)
+      pthread_cond_wait(&q->work_done, &q->lock);
+
+   job = q->slots[q->head % q->window].job;
+   q->head++;
+   return job;
+}
+
+void *
+workq_submit(workq *q, void *job)
+{
+   void *finished;
+
+   pthread_mutex_lock(&q->lock);
+
+   finished = NULL;
+   if (q->tail - q->head == q->window)
+      finished = workq_pop(q);
+
+   q->slots[q->tail % q->window].job  = job;
+   q->slots[q->tail % q->window].done = false;
+   q->tail++;
+   pthread_cond_signal(&q->work_ready);
+
+   pthread_mutex_unlock(&q->lock);
+   return finished;
+}
+
+void *
+workq_next(workq *q)
+{
+   void *job;
+
+   pthread_mutex_lock(&q->lock);
+
+   job = NULL;
+   if (q->head != q->tail)
+      job = workq_pop(q);
+
+   pthread_mutex_unlock(&q->lock);
+   return job;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2010, 2011 Ryan Flannery <ryan.flannery@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef WORKQ_H
+#define WORKQ_H
+
+#include <err.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "debug.h"
+
+#include "compat.h"
+
+/*
+ * A small pool of worker threads with a bounded, ordered queue of jobs.
+ *
+ * The main thread submits jobs (opaque pointers) which the workers run,
+ * in any order and in parallel, by calling the queue's function on them.
+ * Jobs are always handed back to the main thread in the order they were
+ * submitted, so results can be merged deterministically.
+ *
+ * At most 'window' jobs are in flight at a time.  Once the window is full,
+ * submitting another job first waits for the oldest one to finish and
+ * returns it, so the caller should process whatever workq_submit() returns:
+ *
+ *    while (more work) {
+ *       if ((job = workq_submit(q, new_job)) != NULL)
+ *          merge(job);
+ *    }
+ *    while ((job = workq_next(q)) != NULL)
+ *       merge(job);
+ *
+ * The job function runs on a worker thread and must not touch any state the
+ * main thread may be modifying.
+ */
+
+typedef void (*workq_fn)(void *job);
+
+typedef struct {
+   void       *job;
+   bool        done;
+} workq_slot;
+
+typedef struct {
+   workq_fn          fn;         /* function run on each job */
+
+   pthread_t        *threads;
+   int               nthreads;
+
+   workq_slot       *slots;      /* ring buffer of in-flight jobs */
+   unsigned long     window;     /* size of ring buffer */
+   unsigned long     head;       /* oldest job not yet handed back */
+   unsigned long     next;       /* next job to be picked up by a worker */
+   unsigned long     tail;       /* where the next job submitted goes */
+   bool              quit;
+
+   pthread_mutex_t   lock;
+   pthread_cond_t    work_ready;  /* a job was submitted (or quit) */
+   pthread_cond_t    work_done;   /* a job was finished */
+} workq;
+
+/* create/destroy a queue.  destroying waits for all workers to exit */
+workq *workq_new(int nthreads, int window, workq_fn fn);
+void workq_free(workq *q);
+
+/* submit a job, returning the oldest finished job if the window was full */
+void *workq_submit(workq *q, void *job);
+
+/* wait for and return the oldest job, or NULL if there are none left */
+void *workq_next(workq *q);
+
+#endif